@@ -0,0 +1,842 @@
+#ifndef BATCHSIM_H
+#define BATCHSIM_H
+
+#include "Engine.h"
+#include <map>
+
+// Define TEKKEN_NO_SIMD to use the portable scalar kernels.
+#if !defined(TEKKEN_NO_SIMD) && defined(__AVX2__)
+#define TEKKEN_LANES_AVX2
+#include <immintrin.h>
+#elif !defined(TEKKEN_NO_SIMD) && defined(__SSE2__)
+#define TEKKEN_LANES_SSE2
+#include <emmintrin.h>
+#endif
+
+// ========== LANE KERNELS ==========
+//
+// Vector versions of the Fighter state updates, over one tile of 64 lanes
+// stored as plain arrays. `mask` selects the lanes to update; the others
+// are left untouched. AVX2 when compiled with -mavx2, SSE2 on any x86-64,
+// scalar loops elsewhere. Each kernel computes exactly what the scalar
+// Fighter method does, so results are bit-identical.
+
+struct LaneKernels {
+    static const int TILE = 64;
+
+    // hp -= damage; if (hp < 0) hp = 0;   (Fighter::takeDamage)
+    static void damage(double* hp, uint64_t mask, double damage) {
+#if defined(TEKKEN_LANES_AVX2)
+        const __m256d amount = _mm256_set1_pd(damage);
+        const __m256d zero = _mm256_setzero_pd();
+        for (int i = 0; i < TILE; i += 4) {
+            unsigned bits = (unsigned)(mask >> i) & 0xF;
+            __m256d h = _mm256_loadu_pd(hp + i);
+            __m256d n = _mm256_sub_pd(h, amount);
+            n = _mm256_blendv_pd(n, zero, _mm256_cmp_pd(n, zero, _CMP_LT_OQ));
+            _mm256_storeu_pd(hp + i, _mm256_blendv_pd(h, n, laneMask4(bits)));
+        }
+#elif defined(TEKKEN_LANES_SSE2)
+        const __m128d amount = _mm_set1_pd(damage);
+        const __m128d zero = _mm_setzero_pd();
+        for (int i = 0; i < TILE; i += 2) {
+            unsigned bits = (unsigned)(mask >> i) & 0x3;
+            __m128d h = _mm_loadu_pd(hp + i);
+            __m128d n = _mm_sub_pd(h, amount);
+            n = select2(_mm_cmplt_pd(n, zero), zero, n);
+            _mm_storeu_pd(hp + i, select2(laneMask2(bits), n, h));
+        }
+#else
+        for (int i = 0; i < TILE; i++) {
+            if (!((mask >> i) & 1)) continue;
+            hp[i] -= damage;
+            if (hp[i] < 0) hp[i] = 0;
+        }
+#endif
+    }
+
+    // hp += amount; if (hp > maxHP) hp = maxHP;   (Fighter::heal)
+    static void heal(double* hp, uint64_t mask, double amount, double maxHP) {
+#if defined(TEKKEN_LANES_AVX2)
+        const __m256d add = _mm256_set1_pd(amount);
+        const __m256d cap = _mm256_set1_pd(maxHP);
+        for (int i = 0; i < TILE; i += 4) {
+            unsigned bits = (unsigned)(mask >> i) & 0xF;
+            __m256d h = _mm256_loadu_pd(hp + i);
+            __m256d n = _mm256_add_pd(h, add);
+            n = _mm256_blendv_pd(n, cap, _mm256_cmp_pd(n, cap, _CMP_GT_OQ));
+            _mm256_storeu_pd(hp + i, _mm256_blendv_pd(h, n, laneMask4(bits)));
+        }
+#elif defined(TEKKEN_LANES_SSE2)
+        const __m128d add = _mm_set1_pd(amount);
+        const __m128d cap = _mm_set1_pd(maxHP);
+        for (int i = 0; i < TILE; i += 2) {
+            unsigned bits = (unsigned)(mask >> i) & 0x3;
+            __m128d h = _mm_loadu_pd(hp + i);
+            __m128d n = _mm_add_pd(h, add);
+            n = select2(_mm_cmpgt_pd(n, cap), cap, n);
+            _mm_storeu_pd(hp + i, select2(laneMask2(bits), n, h));
+        }
+#else
+        for (int i = 0; i < TILE; i++) {
+            if (!((mask >> i) & 1)) continue;
+            hp[i] += amount;
+            if (hp[i] > maxHP) hp[i] = maxHP;
+        }
+#endif
+    }
+
+    // Lanes with hp > 0   (Fighter::isAlive)
+    static uint64_t alive(const double* hp) {
+        uint64_t out = 0;
+#if defined(TEKKEN_LANES_AVX2)
+        const __m256d zero = _mm256_setzero_pd();
+        for (int i = 0; i < TILE; i += 4) {
+            __m256d gt = _mm256_cmp_pd(_mm256_loadu_pd(hp + i), zero, _CMP_GT_OQ);
+            out |= (uint64_t)_mm256_movemask_pd(gt) << i;
+        }
+#elif defined(TEKKEN_LANES_SSE2)
+        const __m128d zero = _mm_setzero_pd();
+        for (int i = 0; i < TILE; i += 2) {
+            out |= (uint64_t)_mm_movemask_pd(_mm_cmpgt_pd(_mm_loadu_pd(hp + i), zero)) << i;
+        }
+#else
+        for (int i = 0; i < TILE; i++) {
+            if (hp[i] > 0) out |= 1ULL << i;
+        }
+#endif
+        return out;
+    }
+
+    // Lanes whose flag byte (0 or 1) is set
+    static uint64_t bitsOf(const uint8_t* flags) {
+        uint64_t out = 0;
+#if defined(TEKKEN_LANES_AVX2) || defined(TEKKEN_LANES_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        for (int i = 0; i < TILE; i += 16) {
+            __m128i f = _mm_loadu_si128((const __m128i*)(flags + i));
+            out |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpgt_epi8(f, zero)) << i;
+        }
+#else
+        for (int i = 0; i < TILE; i++) out |= (uint64_t)flags[i] << i;
+#endif
+        return out;
+    }
+
+    // Lanes where compareValues(op, lhs, rhs) holds
+    static uint64_t compare(const double* lhs, const double* rhs, CmpOp op) {
+        uint64_t out = 0;
+#if defined(TEKKEN_LANES_AVX2)
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        const __m256d eps = _mm256_set1_pd(0.001);
+        for (int i = 0; i < TILE; i += 4) {
+            __m256d l = _mm256_loadu_pd(lhs + i);
+            __m256d r = _mm256_loadu_pd(rhs + i);
+            __m256d c;
+            switch (op) {
+                case CmpOp::EQ: c = _mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(l, r)), eps, _CMP_LT_OQ); break;
+                case CmpOp::NE: c = _mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(l, r)), eps, _CMP_GE_OQ); break;
+                case CmpOp::GT: c = _mm256_cmp_pd(l, r, _CMP_GT_OQ); break;
+                case CmpOp::GE: c = _mm256_cmp_pd(l, r, _CMP_GE_OQ); break;
+                case CmpOp::LT: c = _mm256_cmp_pd(l, r, _CMP_LT_OQ); break;
+                case CmpOp::LE: c = _mm256_cmp_pd(l, r, _CMP_LE_OQ); break;
+                default: c = _mm256_setzero_pd(); break;
+            }
+            out |= (uint64_t)_mm256_movemask_pd(c) << i;
+        }
+#elif defined(TEKKEN_LANES_SSE2)
+        const __m128d sign = _mm_set1_pd(-0.0);
+        const __m128d eps = _mm_set1_pd(0.001);
+        for (int i = 0; i < TILE; i += 2) {
+            __m128d l = _mm_loadu_pd(lhs + i);
+            __m128d r = _mm_loadu_pd(rhs + i);
+            __m128d c;
+            switch (op) {
+                case CmpOp::EQ: c = _mm_cmplt_pd(_mm_andnot_pd(sign, _mm_sub_pd(l, r)), eps); break;
+                case CmpOp::NE: c = _mm_cmpge_pd(_mm_andnot_pd(sign, _mm_sub_pd(l, r)), eps); break;
+                case CmpOp::GT: c = _mm_cmpgt_pd(l, r); break;
+                case CmpOp::GE: c = _mm_cmpge_pd(l, r); break;
+                case CmpOp::LT: c = _mm_cmplt_pd(l, r); break;
+                case CmpOp::LE: c = _mm_cmple_pd(l, r); break;
+                default: c = _mm_setzero_pd(); break;
+            }
+            out |= (uint64_t)_mm_movemask_pd(c) << i;
+        }
+#else
+        for (int i = 0; i < TILE; i++) {
+            if (compareValues(op, lhs[i], rhs[i])) out |= 1ULL << i;
+        }
+#endif
+        return out;
+    }
+
+private:
+#if defined(TEKKEN_LANES_AVX2)
+    // Blend mask selecting the lanes set in `bits`
+    static __m256d laneMask4(unsigned bits) {
+        static const int64_t table[16][4] = {
+            { 0,  0,  0,  0}, {-1,  0,  0,  0}, { 0, -1,  0,  0}, {-1, -1,  0,  0},
+            { 0,  0, -1,  0}, {-1,  0, -1,  0}, { 0, -1, -1,  0}, {-1, -1, -1,  0},
+            { 0,  0,  0, -1}, {-1,  0,  0, -1}, { 0, -1,  0, -1}, {-1, -1,  0, -1},
+            { 0,  0, -1, -1}, {-1,  0, -1, -1}, { 0, -1, -1, -1}, {-1, -1, -1, -1}};
+        return _mm256_loadu_pd((const double*)table[bits]);
+    }
+#elif defined(TEKKEN_LANES_SSE2)
+    static __m128d laneMask2(unsigned bits) {
+        static const int64_t table[4][2] = {{0, 0}, {-1, 0}, {0, -1}, {-1, -1}};
+        return _mm_loadu_pd((const double*)table[bits]);
+    }
+    static __m128d select2(__m128d mask, __m128d a, __m128d b) {
+        return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+    }
+#endif
+};
+
+// ========== BATCH SIMULATOR ==========
+//
+// Plays many independent duels of one matchup in lockstep, with uniform
+// random ability choice on both sides. State is kept as structure-of-arrays
+// (HP, ring and alive bits, RNG streams, pending-effect timers) in tiles of
+// 64 lanes; every turn runs the same bytecode over all lanes of a tile with
+// per-instruction lane masks. Branches split the mask and merge again,
+// which works because the compiler only emits forward jumps.
+//
+// Duel i draws its choices exactly like RandomPolicy(policySeed(seed, i, 0))
+// and RandomPolicy(policySeed(seed, i, 1)) in a DuelEngine, so every result
+// matches the scalar engine. Lanes whose pending-effect lists get too long
+// for the fixed slots, and matchups with abilities the batch interpreter
+// cannot run (ShowCommand, user commands or lambda conditions), finish on
+// the scalar engine instead.
+
+struct BatchStats {
+    long wins1;
+    long wins2;
+    long draws;
+    long totalRounds;
+    long scalarDuels;   // duels finished by the scalar engine
+};
+
+class BatchSimulator {
+public:
+    static const int TILE = LaneKernels::TILE;
+    static const int SLOTS = 32;    // pending effects per fighter and list
+
+    BatchSimulator(const Fighter& f1, const Fighter& f2, int maxRoundLimit = 1000,
+                   size_t lanes = 4096)
+        : tmpl1(f1), tmpl2(f2), maxRounds(maxRoundLimit), supported(true), maxSchedules(0),
+          laneLimit(lanes < TILE ? TILE : (lanes + TILE - 1) / TILE * TILE),
+          engine(maxRoundLimit), work1("", "", 0), work2("", "", 0) {
+        const Fighter* side[2] = {&f1, &f2};
+        for (int s = 0; s < 2; s++) {
+            maxHP[s] = side[s]->maxHP;
+            heal[s] = side[s]->maxHP * archetypes().healFraction(side[s]->archetype);
+            archetype[s] = side[s]->archetype;
+            typeId[s] = side[s]->typeId;
+            nameId[s] = side[s]->nameId;
+        }
+        for (int s = 0; s < 2; s++) {
+            abilityBase[s] = (int)programs.size();
+            for (auto& ability : side[s]->abilities) {
+                if (ability->program.empty() && ability->action) supported = false;
+                addProgram(ability->program.empty() ? noop() : ability->program, nullptr);
+            }
+            abilityCount[s] = (int)programs.size() - abilityBase[s];
+        }
+        for (size_t p = 0; p < programs.size(); p++) {
+            scanProgram(p);
+        }
+        // A fighter with at most `threshold` entries per list at the start of
+        // a turn cannot exceed SLOTS during that turn (see exportRiskyLanes).
+        threshold = maxSchedules == 0 ? SLOTS : (SLOTS - maxSchedules) / (2 * maxSchedules + 1);
+        if (threshold < 1) supported = false;
+    }
+
+    // True if the matchup runs on the lane interpreter rather than the scalar engine
+    bool vectorized() const { return supported; }
+
+    BatchStats run(size_t duels, uint64_t seed, std::vector<DuelResult>* results = nullptr) {
+        BatchStats stats = {0, 0, 0, 0, 0};
+        if (results) results->assign(duels, DuelResult());
+        for (size_t first = 0; first < duels; first += laneLimit) {
+            size_t count = std::min(laneLimit, duels - first);
+            if (supported) {
+                runPass(first, count, seed, stats, results);
+            } else {
+                for (size_t i = first; i < first + count; i++) {
+                    RandomPolicy p1(policySeed(seed, i, 0)), p2(policySeed(seed, i, 1));
+                    record(stats, results, i, engine.run(tmpl1, tmpl2, p1, p2));
+                    stats.scalarDuels++;
+                }
+            }
+        }
+        return stats;
+    }
+
+private:
+    enum { DELAYED = 0, RECURRING = 1 };
+
+    struct ProgramInfo {
+        const Program* program;
+        std::shared_ptr<Command> command;   // the scheduled CompiledCommand, for effects
+        std::vector<uint16_t> targets;      // program id of commands[i]
+    };
+
+    const Fighter& tmpl1;
+    const Fighter& tmpl2;
+    int maxRounds;
+    bool supported;
+    int maxSchedules;
+    int threshold;
+    size_t laneLimit;
+
+    double maxHP[2];
+    double heal[2];
+    uint8_t archetype[2];
+    uint32_t typeId[2];
+    uint32_t nameId[2];
+    int abilityBase[2];
+    int abilityCount[2];
+    std::vector<ProgramInfo> programs;
+    std::map<const Command*, uint16_t> effectIds;
+
+    // Lane state, structure-of-arrays
+    size_t capacity;
+    size_t tiles;
+    std::vector<double> hp[2];
+    std::vector<uint64_t> rng[2];
+    std::vector<uint64_t> ring[2];
+    std::vector<uint64_t> active;
+    std::vector<size_t> duelOf;
+    std::vector<int16_t> timers;        // [side][list][slot][lane]
+    std::vector<uint16_t> effects;      // [side][list][slot][lane]
+    std::vector<uint8_t> counts;        // [side][list][lane]
+
+    // Scratch
+    std::vector<uint64_t> pcMask;
+    std::vector<uint64_t> condMask;
+    std::vector<uint64_t> choiceMask;
+    std::vector<std::pair<uint16_t, uint64_t>> firing;
+    double lhsValues[TILE];
+    double rhsValues[TILE];
+    uint8_t startCount[TILE];
+
+    DuelEngine engine;
+    DuelArena arena;    // pending effects of the lane being finished on `engine`
+    Fighter work1;
+    Fighter work2;
+
+    static const Program& noop() {
+        static Program program = AbilityCompiler::compile(nullptr);
+        return program;
+    }
+
+    uint16_t addProgram(const Program& program, std::shared_ptr<Command> command) {
+        ProgramInfo info;
+        info.program = &program;
+        info.command = command;
+        programs.push_back(info);
+        return (uint16_t)(programs.size() - 1);
+    }
+
+    // Checks that the lane interpreter can run program p, and registers the
+    // programs it schedules.
+    void scanProgram(size_t p) {
+        const Program& program = *programs[p].program;
+        programs[p].targets.assign(program.commands.size(), 0);
+        pcMask.resize(std::max(pcMask.size(), program.code.size()));
+        condMask.resize(std::max(condMask.size(), program.conditionCode.size()));
+        int schedules = 0;
+        for (const Instruction& in : program.code) {
+            if (in.op == OpCode::EXECUTE) supported = false;
+            if (in.op == OpCode::FOR_ROUNDS || in.op == OpCode::AFTER_ROUNDS) {
+                schedules++;
+                if (in.count < -1000 || in.count > 30000) supported = false;
+                auto compiled = std::dynamic_pointer_cast<CompiledCommand>(program.commands[in.index]);
+                if (!compiled) {
+                    supported = false;
+                    continue;
+                }
+                auto it = effectIds.find(compiled.get());
+                if (it == effectIds.end()) {
+                    uint16_t id = addProgram(compiled->program, compiled);
+                    it = effectIds.emplace(compiled.get(), id).first;
+                }
+                programs[p].targets[in.index] = it->second;
+            }
+        }
+        for (const CondInstruction& in : program.conditionCode) {
+            if (in.op == CondOp::EVALUATE) supported = false;
+        }
+        maxSchedules = std::max(maxSchedules, schedules);
+    }
+
+    size_t slot(int side, int list, int k) const {
+        return ((size_t)(side * 2 + list) * SLOTS + k) * capacity;
+    }
+    uint8_t& count(int side, int list, size_t lane) {
+        return counts[(size_t)(side * 2 + list) * capacity + lane];
+    }
+
+    static void record(BatchStats& stats, std::vector<DuelResult>* results, size_t duel,
+                       const DuelResult& r) {
+        stats.wins1 += r.winner == 1;
+        stats.wins2 += r.winner == 2;
+        stats.draws += r.winner == 0;
+        stats.totalRounds += r.rounds;
+        if (results) (*results)[duel] = r;
+    }
+
+    void finish(BatchStats& stats, std::vector<DuelResult>* results, size_t lane,
+                int winner, int round) {
+        DuelResult r;
+        r.winner = winner;
+        r.rounds = round;
+        r.finalHP1 = hp[0][lane];
+        r.finalHP2 = hp[1][lane];
+        record(stats, results, duelOf[lane], r);
+        clearLists(lane);
+    }
+
+    // Lanes that are not running keep empty lists (see processDelayed)
+    void clearLists(size_t lane) {
+        for (int s = 0; s < 2; s++) {
+            count(s, DELAYED, lane) = 0;
+            count(s, RECURRING, lane) = 0;
+        }
+    }
+
+    // ----- lane interpreter -----
+
+    void schedule(int side, int list, uint16_t effect, int rounds, size_t tile, uint64_t mask) {
+        for (; mask; mask &= mask - 1) {
+            size_t lane = tile * TILE + __builtin_ctzll(mask);
+            uint8_t& c = count(side, list, lane);
+            timers[slot(side, list, c) + lane] = (int16_t)rounds;
+            effects[slot(side, list, c) + lane] = effect;
+            c++;
+        }
+    }
+
+    // Lanes of `mask` for which the condition tape starting at `start` holds
+    uint64_t evalCondition(const Program& program, int32_t start, size_t tile,
+                           uint64_t mask, int attacker) {
+        const CondInstruction* code = program.conditionCode.data();
+        uint64_t* at = condMask.data();
+        size_t base = tile * TILE;
+        uint64_t r = 0;
+        at[start] = mask;
+        for (int32_t pc = start; ; pc++) {
+            const CondInstruction& in = code[pc];
+            uint64_t m = at[pc];
+            at[pc] = 0;
+            if (in.op == CondOp::END) break;
+            if (!m) continue;
+            uint64_t value = 0;
+            switch (in.op) {
+                case CondOp::COMPARE:
+                    value = LaneKernels::compare(operand(in.lhs, base, attacker, lhsValues),
+                                                 operand(in.rhs, base, attacker, rhsValues), in.cmp);
+                    break;
+                case CondOp::SYMBOL_COMPARE: {
+                    int side = in.lhs.isAttacker ? attacker : 1 - attacker;
+                    uint32_t symbol = in.lhs.kind == ValueSource::TYPE ? typeId[side] : nameId[side];
+                    value = (symbol == in.symbol) == (in.cmp == CmpOp::EQ) ? ~0ULL : 0;
+                    break;
+                }
+                case CondOp::SET:
+                    value = in.value ? ~0ULL : 0;
+                    break;
+                case CondOp::JUMP_IF_FALSE:
+                    at[in.target] |= m & ~r;
+                    at[pc + 1] |= m & r;
+                    continue;
+                case CondOp::JUMP_IF_TRUE:
+                    at[in.target] |= m & r;
+                    at[pc + 1] |= m & ~r;
+                    continue;
+                case CondOp::NOT:
+                    value = ~r;
+                    break;
+                default:
+                    break;
+            }
+            r = (r & ~m) | (value & m);
+            at[pc + 1] |= m;
+        }
+        return r & mask;
+    }
+
+    const double* operand(const ValueSource& src, size_t base, int attacker, double* scratch) {
+        int side = src.isAttacker ? attacker : 1 - attacker;
+        switch (src.kind) {
+            case ValueSource::HP:
+                return hp[side].data() + base;
+            case ValueSource::OUT_OF_RING: {
+                uint64_t bits = ring[side][base / TILE];
+                for (int i = 0; i < TILE; i++) scratch[i] = (bits >> i) & 1 ? 0.0 : 1.0;
+                return scratch;
+            }
+            default:
+                for (int i = 0; i < TILE; i++) scratch[i] = src.constant;
+                return scratch;
+        }
+    }
+
+    void execProgram(uint16_t id, size_t tile, uint64_t mask, int attacker, int round) {
+        const ProgramInfo& info = programs[id];
+        const Program& program = *info.program;
+        const Instruction* code = program.code.data();
+        uint64_t* at = pcMask.data();
+        size_t base = tile * TILE;
+        int defender = 1 - attacker;
+        at[0] = mask;
+        for (size_t pc = 0; code[pc].op != OpCode::END; pc++) {
+            uint64_t m = at[pc];
+            at[pc] = 0;
+            if (!m) continue;
+            const Instruction& in = code[pc];
+            int target = in.onDefender ? defender : attacker;
+            switch (in.op) {
+                case OpCode::DAMAGE: {
+                    uint64_t hit = m & ring[target][tile];
+                    if (hit) {
+                        const DamageModifier& mod = archetypes().modifier(archetype[attacker], archetype[target], round);
+                        LaneKernels::damage(hp[target].data() + base, hit, in.amount * mod.attack * mod.defense);
+                    }
+                    break;
+                }
+                case OpCode::HEAL:
+                    LaneKernels::heal(hp[target].data() + base, m, in.amount, maxHP[target]);
+                    break;
+                case OpCode::TAG_OUT:
+                    ring[target][tile] &= ~m;
+                    break;
+                case OpCode::TAG_IN:
+                    ring[target][tile] |= m;
+                    break;
+                case OpCode::FOR_ROUNDS:
+                    schedule(attacker, RECURRING, info.targets[in.index], in.count, tile, m);
+                    break;
+                case OpCode::AFTER_ROUNDS:
+                    schedule(defender, DELAYED, info.targets[in.index], in.count, tile, m);
+                    break;
+                case OpCode::BRANCH_IF_FALSE: {
+                    uint64_t yes = evalCondition(program, in.index, tile, m, attacker);
+                    at[in.target] |= m & ~yes;
+                    m &= yes;
+                    break;
+                }
+                case OpCode::JUMP:
+                    at[in.target] |= m;
+                    m = 0;
+                    break;
+                default:
+                    break;
+            }
+            at[pc + 1] |= m;
+        }
+        at[program.code.size() - 1] = 0;
+    }
+
+    // Runs the effects of slot k for the lanes in `mask`, grouped by effect
+    void fireSlot(int side, int list, int k, size_t tile, uint64_t mask, int round) {
+        firing.clear();
+        size_t s = slot(side, list, k) + tile * TILE;
+        for (uint64_t m = mask; m; m &= m - 1) {
+            int i = __builtin_ctzll(m);
+            uint16_t effect = effects[s + i];
+            size_t g = 0;
+            while (g < firing.size() && firing[g].first != effect) g++;
+            if (g == firing.size()) firing.push_back(std::make_pair(effect, 0ULL));
+            firing[g].second |= 1ULL << i;
+        }
+        for (auto& group : firing) {
+            execProgram(group.first, tile, group.second, side, round);
+        }
+    }
+
+    // Fighter::processDelayedCommands for one tile. Lanes that are not
+    // running have empty lists, so the slot loops run over the whole tile.
+    void processDelayed(int side, size_t tile, int round) {
+        size_t base = tile * TILE;
+        const uint8_t* c = &count(side, DELAYED, base);
+        int slots = 0;
+        for (int i = 0; i < TILE; i++) slots = std::max<int>(slots, c[i]);
+        if (!slots) return;
+        uint64_t fired = 0;
+        uint8_t flags[TILE];
+        for (int k = 0; k < slots; k++) {
+            int16_t* timer = &timers[slot(side, DELAYED, k) + base];
+            for (int i = 0; i < TILE; i++) {
+                uint8_t pending = k < c[i];
+                timer[i] = (int16_t)(timer[i] - pending);
+                flags[i] = pending & (timer[i] <= 0);
+            }
+            uint64_t fire = LaneKernels::bitsOf(flags);
+            if (fire) fireSlot(side, DELAYED, k, tile, fire, round);
+            fired |= fire;
+        }
+        for (; fired; fired &= fired - 1) {
+            size_t lane = base + __builtin_ctzll(fired);
+            uint8_t& n = count(side, DELAYED, lane);
+            int kept = 0;
+            for (int k = 0; k < n; k++) {
+                if (timers[slot(side, DELAYED, k) + lane] > 0) moveEntry(side, DELAYED, k, kept++, lane);
+            }
+            n = (uint8_t)kept;
+        }
+    }
+
+    // Fighter::processRecurringCommands for one tile
+    void processRecurring(int side, size_t tile, int round) {
+        size_t base = tile * TILE;
+        const uint8_t* c = &count(side, RECURRING, base);
+        int slots = 0;
+        for (int i = 0; i < TILE; i++) {
+            startCount[i] = c[i];
+            slots = std::max<int>(slots, c[i]);
+        }
+        if (!slots) return;
+        uint64_t expired = 0;
+        uint8_t flags[TILE];
+        for (int k = 0; k < slots; k++) {
+            for (int i = 0; i < TILE; i++) flags[i] = k < startCount[i];
+            fireSlot(side, RECURRING, k, tile, LaneKernels::bitsOf(flags), round);
+            int16_t* timer = &timers[slot(side, RECURRING, k) + base];
+            for (int i = 0; i < TILE; i++) {
+                uint8_t pending = k < startCount[i];
+                timer[i] = (int16_t)(timer[i] - pending);
+                flags[i] = pending & (timer[i] <= 0);
+            }
+            expired |= LaneKernels::bitsOf(flags);
+        }
+        for (; expired; expired &= expired - 1) {
+            int i = __builtin_ctzll(expired);
+            size_t lane = base + i;
+            uint8_t& n = count(side, RECURRING, lane);
+            int kept = 0;
+            for (int k = 0; k < n; k++) {
+                // Entries scheduled during processing (k >= startCount) are kept
+                if (k >= startCount[i] || timers[slot(side, RECURRING, k) + lane] > 0) {
+                    moveEntry(side, RECURRING, k, kept++, lane);
+                }
+            }
+            n = (uint8_t)kept;
+        }
+    }
+
+    void moveEntry(int side, int list, int from, int to, size_t lane) {
+        if (from == to) return;
+        timers[slot(side, list, to) + lane] = timers[slot(side, list, from) + lane];
+        effects[slot(side, list, to) + lane] = effects[slot(side, list, from) + lane];
+    }
+
+    // ----- scalar fallback -----
+
+    // Hands lanes that might overflow their pending-effect slots during the
+    // next turn to the scalar engine. With at most T entries per list at the
+    // start of a turn and S schedules per program, a list grows by at most
+    // S * (2T + 1) in one turn (one ability plus T delayed and T recurring
+    // firings), so T + S * (2T + 1) <= SLOTS keeps every lane in bounds.
+    uint64_t exportRiskyLanes(size_t tile, uint64_t mask, int round, bool player1Turn,
+                              BatchStats& stats, std::vector<DuelResult>* results) {
+        size_t base = tile * TILE;
+        const uint8_t* c[4] = {&count(0, DELAYED, base), &count(0, RECURRING, base),
+                               &count(1, DELAYED, base), &count(1, RECURRING, base)};
+        uint8_t over[TILE];
+        uint8_t any = 0;
+        for (int i = 0; i < TILE; i++) {
+            over[i] = (c[0][i] > threshold) | (c[1][i] > threshold) |
+                      (c[2][i] > threshold) | (c[3][i] > threshold);
+            any |= over[i];
+        }
+        if (!any) return mask;
+        uint64_t risky = LaneKernels::bitsOf(over);
+
+        for (uint64_t m = risky & mask; m; m &= m - 1) {
+            int i = __builtin_ctzll(m);
+            size_t lane = base + i;
+
+            Fighter* work[2] = {&work1, &work2};
+            DuelEngine::loadFighter(work1, tmpl1, &arena);
+            DuelEngine::loadFighter(work2, tmpl2, &arena);
+            arena.reset();
+            for (int s = 0; s < 2; s++) {
+                work[s]->currentHP = hp[s][lane];
+                work[s]->inRing = (ring[s][tile] >> i) & 1;
+                // Slot timers hold the remaining turns, which is what add() takes
+                for (int k = 0; k < count(s, DELAYED, lane); k++) {
+                    work[s]->addDelayedCommand(timers[slot(s, DELAYED, k) + lane],
+                                               programs[effects[slot(s, DELAYED, k) + lane]].command);
+                }
+                for (int k = 0; k < count(s, RECURRING, lane); k++) {
+                    work[s]->addRecurringCommand(timers[slot(s, RECURRING, k) + lane],
+                                                 programs[effects[slot(s, RECURRING, k) + lane]].command);
+                }
+            }
+            RandomPolicy p1, p2;
+            p1.generator().setState(rng[0][lane]);
+            p2.generator().setState(rng[1][lane]);
+            DuelResult r = engine.resume(work1, work2, tmpl1.abilities, tmpl2.abilities,
+                                         p1, p2, round, player1Turn);
+            record(stats, results, duelOf[lane], r);
+            clearLists(lane);
+            stats.scalarDuels++;
+            mask &= ~(1ULL << i);
+        }
+        active[tile] = mask;
+        return mask;
+    }
+
+    // ----- driver -----
+
+    void allocate(size_t lanes) {
+        capacity = lanes;
+        tiles = lanes / TILE;
+        for (int s = 0; s < 2; s++) {
+            hp[s].resize(capacity);
+            rng[s].resize(capacity);
+            ring[s].resize(tiles);
+        }
+        active.resize(tiles);
+        duelOf.resize(capacity);
+        timers.resize(capacity * 2 * 2 * SLOTS);
+        effects.resize(capacity * 2 * 2 * SLOTS);
+        counts.resize(capacity * 2 * 2);
+        choiceMask.resize(std::max(abilityCount[0], abilityCount[1]) + 1);
+    }
+
+    void runPass(size_t first, size_t duels, uint64_t seed, BatchStats& stats,
+                 std::vector<DuelResult>* results) {
+        allocate(laneLimit);
+        tiles = (duels + TILE - 1) / TILE;
+        for (size_t t = 0; t < tiles; t++) {
+            size_t lanes = std::min<size_t>(TILE, duels - t * TILE);
+            active[t] = lanes == TILE ? ~0ULL : (1ULL << lanes) - 1;
+            ring[0][t] = ring[1][t] = ~0ULL;
+        }
+        for (size_t lane = 0; lane < tiles * TILE; lane++) {
+            duelOf[lane] = first + lane;
+            for (int s = 0; s < 2; s++) {
+                hp[s][lane] = maxHP[s];
+                FastRng stream(policySeed(seed, first + lane, s));
+                rng[s][lane] = stream.getState();
+                count(s, DELAYED, lane) = 0;
+                count(s, RECURRING, lane) = 0;
+            }
+        }
+
+        int round = 1;
+        bool player1Turn = true;
+        while (tiles > 0 && round <= maxRounds) {
+            int attacker = player1Turn ? 0 : 1;
+            for (size_t t = 0; t < tiles; t++) {
+                uint64_t mask = active[t];
+                if (mask) mask = exportRiskyLanes(t, mask, round, player1Turn, stats, results);
+                if (mask) playTurn(t, mask, attacker, round, stats, results);
+            }
+            player1Turn = !player1Turn;
+            if (player1Turn) {
+                round++;
+                compact();
+            }
+        }
+
+        // Round limit reached: the remaining lanes are draws
+        for (size_t t = 0; t < tiles; t++) {
+            for (uint64_t m = active[t]; m; m &= m - 1) {
+                finish(stats, results, t * TILE + __builtin_ctzll(m), 0, maxRounds);
+            }
+        }
+    }
+
+    void playTurn(size_t t, uint64_t mask, int attacker, int round,
+                  BatchStats& stats, std::vector<DuelResult>* results) {
+        size_t base = t * TILE;
+
+        // Grappler healing on even rounds
+        if (round % 2 == 0) {
+            for (int s = 0; s < 2; s++) {
+                if (heal[s] > 0) LaneKernels::heal(hp[s].data() + base, mask & ring[s][t], heal[s], maxHP[s]);
+            }
+        }
+
+        processDelayed(attacker, t, round);
+        processRecurring(attacker, t, round);
+
+        // Random ability choice, then one pass per ability over its lanes
+        int n = abilityCount[attacker];
+        if (n > 0) {
+            uint64_t choosing = mask & ring[attacker][t];
+            std::fill(choiceMask.begin(), choiceMask.begin() + n, 0);
+            for (uint64_t m = choosing; m; m &= m - 1) {
+                int i = __builtin_ctzll(m);
+                int choice = FastRng::reduce(FastRng::step(rng[attacker][base + i]), n);
+                choiceMask[choice] |= 1ULL << i;
+            }
+            for (int k = 0; k < n; k++) {
+                if (choiceMask[k]) execProgram((uint16_t)(abilityBase[attacker] + k), t, choiceMask[k], attacker, round);
+            }
+        }
+
+        uint64_t alive1 = LaneKernels::alive(hp[0].data() + base);
+        uint64_t alive2 = LaneKernels::alive(hp[1].data() + base);
+        uint64_t done = mask & ~(alive1 & alive2);
+        for (uint64_t m = done; m; m &= m - 1) {
+            int i = __builtin_ctzll(m);
+            bool a1 = (alive1 >> i) & 1, a2 = (alive2 >> i) & 1;
+            finish(stats, results, base + i, a1 && !a2 ? 1 : a2 && !a1 ? 2 : 0, round);
+        }
+        active[t] = mask & ~done;
+    }
+
+    // Packs the running lanes into as few tiles as possible once at least
+    // half of the lanes in use have finished.
+    void compact() {
+        size_t running = 0;
+        for (size_t t = 0; t < tiles; t++) running += __builtin_popcountll(active[t]);
+        if (tiles <= 1 || running * 2 > tiles * TILE) return;
+
+        size_t dst = 0;
+        for (size_t t = 0; t < tiles; t++) {
+            uint64_t bitsActive = active[t];
+            uint64_t ring0 = ring[0][t], ring1 = ring[1][t];
+            for (uint64_t m = bitsActive; m; m &= m - 1) {
+                int i = __builtin_ctzll(m);
+                moveLane(t * TILE + i, dst, (ring0 >> i) & 1, (ring1 >> i) & 1);
+                dst++;
+            }
+        }
+        for (size_t lane = dst; lane < tiles * TILE; lane++) clearLists(lane);
+        tiles = (dst + TILE - 1) / TILE;
+        for (size_t t = 0; t < tiles; t++) {
+            size_t lanes = std::min<size_t>(TILE, dst - t * TILE);
+            active[t] = lanes == TILE ? ~0ULL : (1ULL << lanes) - 1;
+        }
+    }
+
+    // Moves a lane to dst <= src; ring bits are rebuilt tile by tile, so
+    // they are passed in rather than read from the (possibly overwritten) tile.
+    void moveLane(size_t src, size_t dst, bool in0, bool in1) {
+        size_t tile = dst / TILE;
+        uint64_t bit = 1ULL << (dst % TILE);
+        bool in[2] = {in0, in1};
+        for (int s = 0; s < 2; s++) {
+            ring[s][tile] = in[s] ? ring[s][tile] | bit : ring[s][tile] & ~bit;
+            if (src == dst) continue;
+            hp[s][dst] = hp[s][src];
+            rng[s][dst] = rng[s][src];
+            for (int list = 0; list < 2; list++) {
+                uint8_t c = count(s, list, src);
+                for (int k = 0; k < c; k++) {
+                    timers[slot(s, list, k) + dst] = timers[slot(s, list, k) + src];
+                    effects[slot(s, list, k) + dst] = effects[slot(s, list, k) + src];
+                }
+                count(s, list, dst) = c;
+            }
+        }
+        duelOf[dst] = duelOf[src];
+    }
+};
+
+#endif // BATCHSIM_H
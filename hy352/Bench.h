@@ -0,0 +1,311 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <istream>
+#include <iterator>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// ========== BENCHMARK HARNESS ==========
+//
+// Self-contained harness behind `make bench`. A benchmark is a body that
+// performs a given number of operations; the harness doubles the count
+// until one sample takes minSeconds, then keeps the fastest of `samples`
+// samples at that count. Results go to the console and to a JSON file that
+// a later run can be compared against.
+//
+// Allocations per operation are counted by a replaced global operator new:
+// put TEKKEN_BENCH_COUNT_ALLOCATIONS once at namespace scope in the
+// program's main file. Without it the allocation columns are reported as
+// missing (-1 in JSON).
+
+// ========== ALLOCATION COUNTING ==========
+
+struct AllocationCounter {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> bytes;
+    bool enabled;
+};
+
+// Constant-initialized, so operator new can use it before main
+inline AllocationCounter& allocationCounter() {
+    static AllocationCounter counter = {{0}, {0}, false};
+    return counter;
+}
+
+inline void countAllocation(size_t bytes) {
+    AllocationCounter& c = allocationCounter();
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// The array and sized forms of the standard library forward to these two.
+// Kept out of line: inlined into callers, GCC pairs the malloc/free inside
+// with new/delete and warns about a mismatch.
+#if defined(__GNUC__)
+#define TEKKEN_BENCH_NOINLINE __attribute__((noinline))
+#else
+#define TEKKEN_BENCH_NOINLINE
+#endif
+
+#define TEKKEN_BENCH_COUNT_ALLOCATIONS                                       \
+    TEKKEN_BENCH_NOINLINE void* operator new(size_t size) {                  \
+        countAllocation(size);                                               \
+        if (void* p = std::malloc(size ? size : 1)) return p;                \
+        throw std::bad_alloc();                                              \
+    }                                                                        \
+    TEKKEN_BENCH_NOINLINE void operator delete(void* p) noexcept {           \
+        std::free(p);                                                        \
+    }                                                                        \
+    static const bool tekkenAllocationsCounted_ = (allocationCounter().enabled = true);
+
+// Keeps the compiler from dropping a computation whose result is unused
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+// ========== RESULTS ==========
+
+struct BenchResult {
+    std::string name;       // "group/benchmark", e.g. "command/damage"
+    long iterations;        // operations per sample
+    double nsPerOp;         // fastest sample
+    double opsPerSec;
+    double allocsPerOp;     // -1: not counted
+    double bytesPerOp;
+};
+
+// Reads the "benchmarks" array of a file written by BenchSuite::writeJson.
+// Only the fields it writes are understood; anything else is skipped.
+class BenchJsonReader {
+    std::string text;
+    size_t pos;
+
+    void skipSpace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\n' || text[pos] == '\r' || text[pos] == '\t')) pos++;
+    }
+    bool consume(char c) {
+        skipSpace();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+    std::string readString() {
+        std::string s;
+        if (!consume('"')) return s;
+        while (pos < text.size() && text[pos] != '"') {
+            if (text[pos] == '\\' && pos + 1 < text.size()) pos++;
+            s += text[pos++];
+        }
+        pos++;
+        return s;
+    }
+    double readNumber() {
+        skipSpace();
+        const char* start = text.c_str() + pos;
+        char* end;
+        double v = strtod(start, &end);
+        pos += end - start;
+        return v;
+    }
+    // Skips a value of any kind
+    void skipValue() {
+        skipSpace();
+        if (pos >= text.size()) return;
+        char c = text[pos];
+        if (c == '"') {
+            readString();
+        } else if (c == '{' || c == '[') {
+            char close = c == '{' ? '}' : ']';
+            pos++;
+            while (!consume(close) && pos < text.size()) {
+                if (c == '{') {
+                    readString();
+                    consume(':');
+                }
+                skipValue();
+                consume(',');
+            }
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            readNumber();
+        } else {
+            while (pos < text.size() && isalpha((unsigned char)text[pos])) pos++;
+        }
+    }
+    BenchResult readResult() {
+        BenchResult r = {"", 0, 0, 0, -1, -1};
+        consume('{');
+        while (!consume('}') && pos < text.size()) {
+            std::string key = readString();
+            consume(':');
+            if (key == "name") r.name = readString();
+            else if (key == "iterations") r.iterations = (long)readNumber();
+            else if (key == "ns_per_op") r.nsPerOp = readNumber();
+            else if (key == "ops_per_sec") r.opsPerSec = readNumber();
+            else if (key == "allocs_per_op") r.allocsPerOp = readNumber();
+            else if (key == "bytes_per_op") r.bytesPerOp = readNumber();
+            else skipValue();
+            consume(',');
+        }
+        return r;
+    }
+
+public:
+    explicit BenchJsonReader(std::istream& in)
+        : text(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()), pos(0) {}
+
+    std::vector<BenchResult> read() {
+        std::vector<BenchResult> results;
+        if (!consume('{')) return results;
+        while (!consume('}') && pos < text.size()) {
+            std::string key = readString();
+            consume(':');
+            if (key == "benchmarks" && consume('[')) {
+                while (!consume(']') && pos < text.size()) {
+                    results.push_back(readResult());
+                    consume(',');
+                }
+            } else {
+                skipValue();
+            }
+            consume(',');
+        }
+        return results;
+    }
+};
+
+// ========== SUITE ==========
+
+class BenchSuite {
+public:
+    double minSeconds;              // length of one sample
+    int samples;
+    std::string filter;             // only names containing it; empty: all
+    std::vector<BenchResult> results;
+
+    BenchSuite() : minSeconds(0.1), samples(5) {}
+
+    bool selected(const std::string& name) const {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    // body(n) performs n operations. Setup that should not be timed goes
+    // before the call; per-operation setup belongs in the body.
+    template <typename F>
+    void run(const std::string& name, F body) {
+        if (!selected(name)) return;
+        long n = 1;
+        double seconds = time(body, n);
+        while (seconds < minSeconds) {
+            double grow = seconds > 0 ? minSeconds / seconds * 1.2 : 100;
+            n = (long)(n * std::min(100.0, std::max(2.0, grow)));
+            seconds = time(body, n);
+        }
+
+        AllocationCounter& counter = allocationCounter();
+        double best = seconds;
+        uint64_t count = 0, bytes = 0;
+        for (int s = 0; s < samples; s++) {
+            uint64_t count0 = counter.count.load(), bytes0 = counter.bytes.load();
+            best = std::min(best, time(body, n));
+            count = counter.count.load() - count0;
+            bytes = counter.bytes.load() - bytes0;
+        }
+
+        BenchResult r;
+        r.name = name;
+        r.iterations = n;
+        r.nsPerOp = best * 1e9 / n;
+        r.opsPerSec = n / best;
+        r.allocsPerOp = counter.enabled ? (double)count / n : -1;
+        r.bytesPerOp = counter.enabled ? (double)bytes / n : -1;
+        results.push_back(r);
+        printRow(stdout, r);
+    }
+
+    static void printHeader(FILE* out) {
+        fprintf(out, "%-32s %12s %14s %12s %12s\n", "benchmark", "ns/op", "ops/sec", "allocs/op", "bytes/op");
+    }
+
+    static void printRow(FILE* out, const BenchResult& r) {
+        if (r.allocsPerOp < 0) {
+            fprintf(out, "%-32s %12.2f %14.0f %12s %12s\n", r.name.c_str(), r.nsPerOp, r.opsPerSec, "-", "-");
+        } else {
+            fprintf(out, "%-32s %12.2f %14.0f %12.2f %12.1f\n", r.name.c_str(), r.nsPerOp, r.opsPerSec,
+                    r.allocsPerOp, r.bytesPerOp);
+        }
+        fflush(out);
+    }
+
+    void writeJson(std::ostream& out) const {
+        char line[512];
+        out << "{\n  \"suite\": \"tekken\",\n";
+        snprintf(line, sizeof line, "  \"min_seconds\": %g,\n  \"samples\": %d,\n", minSeconds, samples);
+        out << line << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult& r = results[i];
+            snprintf(line, sizeof line,
+                     "    {\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.3f, \"ops_per_sec\": %.1f, "
+                     "\"allocs_per_op\": %.4f, \"bytes_per_op\": %.2f}%s\n",
+                     r.name.c_str(), r.iterations, r.nsPerOp, r.opsPerSec, r.allocsPerOp, r.bytesPerOp,
+                     i + 1 < results.size() ? "," : "");
+            out << line;
+        }
+        out << "  ]\n}\n";
+    }
+
+    // Prints each benchmark next to its baseline entry and returns how many
+    // got slower than `threshold` (0.10: 10% more ns/op) or allocate more.
+    int compare(const std::vector<BenchResult>& baseline, FILE* out, double threshold = 0.10) const {
+        int regressions = 0;
+        fprintf(out, "%-32s %12s %12s %9s %16s\n", "benchmark", "base ns/op", "ns/op", "change", "allocs/op (base)");
+        for (const BenchResult& r : results) {
+            const BenchResult* base = nullptr;
+            for (const BenchResult& b : baseline) {
+                if (b.name == r.name) base = &b;
+            }
+            if (!base) {
+                fprintf(out, "%-32s %12s %12.2f %9s\n", r.name.c_str(), "-", r.nsPerOp, "new");
+                continue;
+            }
+            double change = base->nsPerOp > 0 ? r.nsPerOp / base->nsPerOp - 1 : 0;
+            bool moreAllocs = base->allocsPerOp >= 0 && r.allocsPerOp > base->allocsPerOp + 1e-3;
+            bool slower = change > threshold;
+            regressions += slower || moreAllocs;
+            char allocs[32] = "-";
+            if (r.allocsPerOp >= 0 && base->allocsPerOp >= 0) {
+                snprintf(allocs, sizeof allocs, "%.2f (%.2f)", r.allocsPerOp, base->allocsPerOp);
+            }
+            fprintf(out, "%-32s %12.2f %12.2f %+8.1f%% %16s%s\n", r.name.c_str(), base->nsPerOp, r.nsPerOp,
+                    change * 100, allocs, slower ? "  slower" : moreAllocs ? "  allocates more" : "");
+        }
+        return regressions;
+    }
+
+private:
+    template <typename F>
+    static double time(F& body, long n) {
+        auto start = std::chrono::steady_clock::now();
+        body(n);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif // BENCH_H
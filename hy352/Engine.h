@@ -0,0 +1,308 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "Tekken.h"
+#include <cstdint>
+#include <stdexcept>
+
+// ========== HEADLESS DUEL ENGINE ==========
+//
+// Non-interactive counterpart of runDuel(): the same round rules, but
+// ability choices come from policy objects and nothing is printed.
+// A DuelEngine keeps its two working fighters between matches and takes
+// their pending effects from a DuelArena that is reset per match, so once
+// warmed up a duel does not touch the heap.
+
+struct DuelResult {
+    int winner;        // 1 or 2; 0 if both fell or the round limit was reached
+    int rounds;        // round in which the duel ended
+    double finalHP1;
+    double finalHP2;
+};
+
+typedef std::vector<std::shared_ptr<Ability>> AbilityList;
+
+// ========== ABILITY POLICIES ==========
+
+class AbilityPolicy {
+public:
+    virtual ~AbilityPolicy() = default;
+
+    // Called before every duel the policy takes part in.
+    virtual void reset() {}
+
+    // Returns an index into abilities, or -1 to skip the turn.
+    virtual int choose(Fighter* self, Fighter* opponent,
+                       const AbilityList& abilities, int round) = 0;
+};
+
+// Small, fast generator (xorshift64*) used by the random policies.
+class FastRng {
+    uint64_t state;
+public:
+    explicit FastRng(uint64_t s = 0x9E3779B97F4A7C15ULL) { seed(s); }
+
+    void seed(uint64_t s) {
+        // splitmix64 step so that nearby seeds give unrelated streams
+        uint64_t z = s + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        state = (z ^ (z >> 31)) | 1;
+    }
+
+    uint64_t next() { return step(state); }
+
+    // Uniform integer in [0, n)
+    int below(int n) { return reduce(next(), n); }
+
+    // Raw generator state, for engines that keep many streams side by side
+    uint64_t getState() const { return state; }
+    void setState(uint64_t s) { state = s; }
+
+    static uint64_t step(uint64_t& s) {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545F4914F6CDD1DULL;
+    }
+
+    static int reduce(uint64_t x, int n) {
+        return (int)(((x >> 32) * (uint64_t)n) >> 32);
+    }
+};
+
+// Seed of the policy playing `side` (0 or 1) in duel number `stream` of a
+// run seeded with `seed`. Batch runners use it so that any duel can be
+// replayed on its own with two RandomPolicy objects.
+inline uint64_t policySeed(uint64_t seed, uint64_t stream, int side) {
+    return (seed * 0x9E3779B97F4A7C15ULL + stream) * 2 + side;
+}
+
+// Uniform choice. The stream carries on across duels; call reseed() to
+// replay a duel exactly.
+class RandomPolicy : public AbilityPolicy {
+    FastRng rng;
+public:
+    explicit RandomPolicy(uint64_t s = 1) : rng(s) {}
+
+    void reseed(uint64_t s) { rng.seed(s); }
+    FastRng& generator() { return rng; }
+
+    int choose(Fighter*, Fighter*, const AbilityList& abilities, int) override {
+        return rng.below((int)abilities.size());
+    }
+};
+
+class ScriptedPolicy : public AbilityPolicy {
+    std::vector<int> script;
+    size_t pos;
+public:
+    // Indices are 0-based and the script wraps around when exhausted.
+    explicit ScriptedPolicy(const std::vector<int>& s) : script(s), pos(0) {}
+
+    void reset() override { pos = 0; }
+
+    int choose(Fighter*, Fighter*, const AbilityList&, int) override {
+        if (script.empty()) return -1;
+        int choice = script[pos];
+        if (++pos == script.size()) pos = 0;
+        return choice;
+    }
+};
+
+// Tries every ability on scratch copies of both fighters and picks the one
+// that takes the most HP from the opponent right now (ties go to the one
+// that leaves the policy's own fighter healthier, then to the lowest index).
+class GreedyDamagePolicy : public AbilityPolicy {
+    Fighter scratchSelf;
+    Fighter scratchOpponent;
+public:
+    GreedyDamagePolicy() : scratchSelf("", "", 0), scratchOpponent("", "", 0) {}
+
+    int choose(Fighter* self, Fighter* opponent,
+               const AbilityList& abilities, int round) override {
+        int best = 0;
+        double bestDamage = -1;
+        double bestOwnHP = -1;
+        // Trial runs are not part of the duel
+        EventSink* savedSink = eventSink();
+        eventSink() = nullptr;
+        for (size_t i = 0; i < abilities.size(); i++) {
+            scratchSelf = *self;
+            scratchOpponent = *opponent;
+            abilities[i]->use(&scratchSelf, &scratchOpponent, round);
+            double damage = opponent->currentHP - scratchOpponent.currentHP;
+            if (damage > bestDamage ||
+                (damage == bestDamage && scratchSelf.currentHP > bestOwnHP)) {
+                best = (int)i;
+                bestDamage = damage;
+                bestOwnHP = scratchSelf.currentHP;
+            }
+        }
+        eventSink() = savedSink;
+        return best;
+    }
+};
+
+class CallbackPolicy : public AbilityPolicy {
+public:
+    typedef std::function<int(Fighter*, Fighter*, const AbilityList&, int)> Callback;
+
+    explicit CallbackPolicy(Callback cb) : callback(cb) {}
+
+    int choose(Fighter* self, Fighter* opponent,
+               const AbilityList& abilities, int round) override {
+        return callback(self, opponent, abilities, round);
+    }
+private:
+    Callback callback;
+};
+
+// ========== DUEL ENGINE ==========
+
+class DuelEngine {
+    DuelArena arena;    // pending effects of the current match
+    Fighter fighter1;
+    Fighter fighter2;
+    int maxRounds;
+    EventSink* events;  // nullptr: no events
+    std::vector<int>* choiceLog;
+
+    static void grapplerHeal(Fighter& f) {
+        double amount = f.typeHealAmount();
+        if (amount > 0) f.heal(amount);
+    }
+
+public:
+    explicit DuelEngine(int maxRoundLimit = 1000)
+        : fighter1("", "", 0), fighter2("", "", 0), maxRounds(maxRoundLimit), events(nullptr),
+          choiceLog(nullptr) {}
+
+    // Sink for the events of the following duels (see Events.h); the
+    // default, nullptr, reports nothing and skips ShowCommand text.
+    void setEventSink(EventSink* sink) { events = sink; }
+
+    // Every choice of the following duels is appended to `log`, in the
+    // order the policies were asked (see Replay.h); nullptr stops it.
+    void setChoiceLog(std::vector<int>* log) { choiceLog = log; }
+
+    void setMaxRounds(int limit) { maxRounds = limit; }
+    int roundLimit() const { return maxRounds; }
+
+    // Working fighter of player 1 or 2, as the last duel left it
+    const Fighter& fighter(int player) const { return player == 1 ? fighter1 : fighter2; }
+
+    // Turns a working fighter into a fresh copy of tmpl, without its
+    // abilities. Its pending effects will be allocated from `arena`.
+    static void loadFighter(Fighter& working, const Fighter& tmpl, DuelArena* arena = nullptr) {
+        working.name = tmpl.name;
+        working.type = tmpl.type;
+        working.nameId = tmpl.nameId;
+        working.typeId = tmpl.typeId;
+        working.archetype = tmpl.archetype;
+        working.maxHP = tmpl.maxHP;
+        working.reset(arena);
+    }
+
+    // Plays one duel between the two fighters (typically entries of
+    // fighters of a World, which are left untouched) and returns the outcome.
+    DuelResult run(const Fighter& tmpl1, const Fighter& tmpl2,
+                   AbilityPolicy& policy1, AbilityPolicy& policy2) {
+        // Both fighters let go of the last match's storage before the
+        // arena is recycled for this one
+        loadFighter(fighter1, tmpl1, &arena);
+        loadFighter(fighter2, tmpl2, &arena);
+        arena.reset();
+        policy1.reset();
+        policy2.reset();
+        return resume(fighter1, fighter2, tmpl1.abilities, tmpl2.abilities,
+                      policy1, policy2, 1, true);
+    }
+
+    // Plays the rest of a duel from the given position: the working
+    // fighters' current state, the round and whose turn comes next.
+    DuelResult resume(Fighter& f1, Fighter& f2,
+                      const AbilityList& abilities1, const AbilityList& abilities2,
+                      AbilityPolicy& policy1, AbilityPolicy& policy2,
+                      int round, bool player1Turn) const {
+        EventSink* savedSink = eventSink();
+        eventSink() = events;
+
+        int announced = 0;
+        while (f1.isAlive() && f2.isAlive() && round <= maxRounds) {
+            TEKKEN_PROFILE_TIMER(TURN);
+            if (round != announced) {
+                TEKKEN_EVENT(roundStart(round));
+                announced = round;
+            }
+
+            // Grappler healing on even rounds
+            if (round % 2 == 0) {
+                grapplerHeal(f1);
+                grapplerHeal(f2);
+            }
+
+            Fighter* attacker = player1Turn ? &f1 : &f2;
+            Fighter* defender = player1Turn ? &f2 : &f1;
+            const AbilityList& abilities = player1Turn ? abilities1 : abilities2;
+            AbilityPolicy& policy = player1Turn ? policy1 : policy2;
+
+            {
+                TEKKEN_PROFILE_TIMER(EFFECTS);
+                attacker->processDelayedCommands(defender, round);
+                attacker->processRecurringCommands(defender, round);
+            }
+
+            if (attacker->inRing && !abilities.empty()) {
+                int choice = policy.choose(attacker, defender, abilities, round);
+                if (choiceLog) choiceLog->push_back(choice);
+                if (choice >= 0 && choice < (int)abilities.size()) {
+                    abilities[choice]->use(attacker, defender, round);
+                }
+            }
+
+            player1Turn = !player1Turn;
+            if (player1Turn && f1.isAlive() && f2.isAlive()) round++;
+        }
+
+        if (!f1.isAlive()) TEKKEN_EVENT(knockOut(f1, round));
+        if (!f2.isAlive()) TEKKEN_EVENT(knockOut(f2, round));
+        eventSink() = savedSink;
+
+        DuelResult result;
+        result.winner = !f2.isAlive() && f1.isAlive() ? 1
+                      : !f1.isAlive() && f2.isAlive() ? 2 : 0;
+        result.rounds = round > maxRounds ? maxRounds : round;
+        result.finalHP1 = f1.currentHP;
+        result.finalHP2 = f2.currentHP;
+        return result;
+    }
+};
+
+// Convenience wrapper that looks both fighters up by name.
+inline DuelResult runHeadlessDuel(const std::string& name1, const std::string& name2,
+                                  AbilityPolicy& policy1, AbilityPolicy& policy2,
+                                  int maxRounds = 1000, const World& world = defaultWorld()) {
+    const Fighter* f1 = world.findFighter(name1);
+    const Fighter* f2 = world.findFighter(name2);
+    if (!f1 || !f2) {
+        throw std::invalid_argument("runHeadlessDuel: unknown fighter");
+    }
+    DuelEngine engine(maxRounds);
+    return engine.run(*f1, *f2, policy1, policy2);
+}
+
+// Lets `policy` play `player` (1 or 2) in runDuel instead of std::cin;
+// nullptr gives the seat back. The policy must outlive the duel.
+inline void setComputerPlayer(int player, AbilityPolicy* policy) {
+    if (!policy) {
+        computerPlayer(player) = nullptr;
+        return;
+    }
+    policy->reset();
+    computerPlayer(player) = [policy](Fighter* self, Fighter* opponent, int round) {
+        return policy->choose(self, opponent, self->abilities, round);
+    };
+}
+
+#endif // ENGINE_H
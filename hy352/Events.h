@@ -0,0 +1,130 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "Tekken.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+// ========== EVENT SINKS ==========
+//
+// Implementations of EventSink (see Tekken.h). Select one for a thread with
+// eventSink() = &sink, or for headless duels with DuelEngine::setEventSink.
+
+// Human-readable log, one line per event. Lines are collected in memory
+// and written out in large blocks instead of being flushed one by one.
+class TextEventSink : public EventSink {
+    std::ostream& out;
+    std::string buffer;
+    size_t flushAt;
+
+    void line(const char* format, ...) {
+        char text[256];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        buffer.append(text, n < 0 ? 0 : std::min<size_t>(n, sizeof(text) - 1));
+        if (buffer.size() >= flushAt) flush();
+    }
+
+public:
+    explicit TextEventSink(std::ostream& o, size_t bufferBytes = 1 << 16)
+        : out(o), flushAt(bufferBytes) {
+        buffer.reserve(bufferBytes + 256);
+    }
+    ~TextEventSink() override { flush(); }
+
+    void flush() {
+        out.write(buffer.data(), (std::streamsize)buffer.size());
+        buffer.clear();
+    }
+
+    void roundStart(int round) override {
+        line("=== Round %d ===\n", round);
+    }
+    void damage(const Fighter& target, double amount, int) override {
+        line("%s takes %.2f damage (%.2f HP left)\n", target.name.c_str(), amount, target.currentHP);
+    }
+    void heal(const Fighter& target, double amount) override {
+        line("%s heals %.2f (%.2f HP)\n", target.name.c_str(), amount, target.currentHP);
+    }
+    void tag(const Fighter& target, bool in) override {
+        line("%s is tagged %s\n", target.name.c_str(), in ? "in" : "out");
+    }
+    void show(const std::string& text) override {
+        buffer += text;
+        buffer += '\n';
+        if (buffer.size() >= flushAt) flush();
+    }
+    void knockOut(const Fighter& fighter, int round) override {
+        line("%s is knocked out in round %d\n", fighter.name.c_str(), round);
+    }
+};
+
+// Fixed-size binary record for RingEventSink.
+enum class EventType : uint8_t { ROUND_START, DAMAGE, HEAL, TAG_OUT, TAG_IN, SHOW, KNOCK_OUT };
+
+struct BattleEvent {
+    EventType type;
+    int32_t round;
+    uint32_t subject;   // fighter nameId; SHOW: internSymbol(text)
+    double value;       // damage or heal amount
+};
+
+// Keeps the last `capacity` events (rounded up to a power of two) in a
+// preallocated ring; older ones are overwritten. Recording an event is a
+// few stores, so it can stay attached to long simulations.
+class RingEventSink : public EventSink {
+    std::vector<BattleEvent> ring;
+    uint64_t written;
+    int32_t round;
+
+    void record(EventType type, uint32_t subject, double value) {
+        BattleEvent& e = ring[written++ & (ring.size() - 1)];
+        e.type = type;
+        e.round = round;
+        e.subject = subject;
+        e.value = value;
+    }
+
+public:
+    explicit RingEventSink(size_t capacity = 4096) : written(0), round(0) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        ring.resize(size);
+    }
+
+    // Events held, oldest first
+    size_t size() const { return (size_t)std::min<uint64_t>(written, ring.size()); }
+    const BattleEvent& operator[](size_t i) const {
+        return ring[(written - size() + i) & (ring.size() - 1)];
+    }
+    // Events overwritten before they were read
+    uint64_t dropped() const { return written - size(); }
+    void clear() { written = 0; }
+
+    void roundStart(int r) override {
+        round = r;
+        record(EventType::ROUND_START, 0, 0);
+    }
+    void damage(const Fighter& target, double amount, int r) override {
+        round = r;
+        record(EventType::DAMAGE, target.nameId, amount);
+    }
+    void heal(const Fighter& target, double amount) override {
+        record(EventType::HEAL, target.nameId, amount);
+    }
+    void tag(const Fighter& target, bool in) override {
+        record(in ? EventType::TAG_IN : EventType::TAG_OUT, target.nameId, 0);
+    }
+    void show(const std::string& text) override {
+        record(EventType::SHOW, internSymbol(text), 0);
+    }
+    void knockOut(const Fighter& fighter, int r) override {
+        round = r;
+        record(EventType::KNOCK_OUT, fighter.nameId, 0);
+    }
+};
+
+#endif // EVENTS_H
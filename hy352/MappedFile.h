@@ -0,0 +1,58 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Memory map of a whole file. SEQUENTIAL suits logs read once front to
+// back (Replay.h); COPY_ON_WRITE maps private writable pages, so a loader
+// can patch the mapping (Ruleset.h) without touching the file, and only
+// the pages it writes are copied.
+class MappedFile {
+public:
+    enum Mode { SEQUENTIAL, COPY_ON_WRITE };
+
+    explicit MappedFile(const std::string& path, Mode mode = SEQUENTIAL) : base(nullptr), length(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open '" + path + "'");
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat '" + path + "'");
+        }
+        length = (size_t)st.st_size;
+        if (length > 0) {
+            int protection = mode == COPY_ON_WRITE ? PROT_READ | PROT_WRITE : PROT_READ;
+            void* p = mmap(nullptr, length, protection, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map '" + path + "'");
+            }
+            if (mode == SEQUENTIAL) madvise(p, length, MADV_SEQUENTIAL);
+            base = (uint8_t*)p;
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (base) munmap(base, length);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return base; }
+    // Only for COPY_ON_WRITE maps
+    uint8_t* mutableData() { return base; }
+    size_t size() const { return length; }
+
+private:
+    uint8_t* base;
+    size_t length;
+};
+
+#endif // MAPPED_FILE_H
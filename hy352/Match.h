@@ -0,0 +1,529 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include "Engine.h"
+#include <cstring>
+#include <type_traits>
+
+// ========== MATCH STATE ==========
+//
+// Everything that changes during a duel, in one trivially copyable struct:
+// both fighters' HP, ring status and pending effects, the round and whose
+// turn it is. Taking a snapshot or restoring one is a plain copy, so search
+// code can branch from a position as often as it likes. What never changes
+// during a duel (max HP, types, compiled abilities) lives in the Match that
+// is built once from the two fighter templates.
+
+struct MatchEffect {
+    int32_t tick;       // owner turn on which it fires (delayed) or runs for the last time (recurring)
+    uint16_t program;   // Match program id
+    uint16_t unused;
+};
+
+struct MatchSide {
+    static const int MAX_EFFECTS = 16;  // per list
+
+    double hp;
+    int32_t delayedTurn;    // process calls so far, as in DelayedEffects
+    int32_t recurringTurn;  // and RecurringEffects
+    uint8_t inRing;
+    uint8_t delayedCount;
+    uint8_t recurringCount;
+    uint8_t unused;
+    MatchEffect delayed[MAX_EFFECTS];      // in scheduling order
+    MatchEffect recurring[MAX_EFFECTS];
+};
+
+struct MatchState {
+    MatchSide side[2];
+    int32_t round;
+    uint8_t player1Turn;
+    uint8_t over;           // the duel has ended
+    uint16_t unused;
+
+    // Side (0 or 1) whose ability choice is pending
+    int mover() const { return player1Turn ? 0 : 1; }
+
+    // Same value for positions that play out the same: pending effects are
+    // hashed by turns remaining, not by their absolute tick.
+    uint64_t hash() const {
+        uint64_t h = mix(0, (uint64_t)(uint32_t)round << 2 | (uint64_t)player1Turn << 1 | over);
+        for (const MatchSide& s : side) {
+            uint64_t bits;
+            std::memcpy(&bits, &s.hp, sizeof(bits));
+            h = mix(h, bits);
+            h = mix(h, (uint64_t)s.inRing << 16 | (uint64_t)s.delayedCount << 8 | s.recurringCount);
+            for (int i = 0; i < s.delayedCount; i++) {
+                h = mix(h, (uint64_t)(uint32_t)(s.delayed[i].tick - s.delayedTurn) << 16 | s.delayed[i].program);
+            }
+            for (int i = 0; i < s.recurringCount; i++) {
+                h = mix(h, (uint64_t)(uint32_t)(s.recurring[i].tick - s.recurringTurn) << 16 | s.recurring[i].program);
+            }
+        }
+        return h;
+    }
+
+private:
+    static uint64_t mix(uint64_t h, uint64_t v) {
+        uint64_t z = h ^ (v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2));
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+static_assert(std::is_trivially_copyable<MatchState>::value, "MatchState must be trivially copyable");
+
+// ========== MATCH ==========
+//
+// The rules of one matchup, applied to MatchState values. A state is always
+// either over or waiting for the mover's ability choice: play() uses the
+// ability, then runs the following turn starts (grappler heal, delayed and
+// recurring effects) up to the next choice, passing turns on which the
+// mover is out of the ring or has no abilities. With the same choices the
+// results equal DuelEngine's.
+//
+// The abilities are compiled again from their command trees. Abilities
+// with lambda conditions or user-defined commands cannot be stored in a
+// MatchState and make the constructor throw std::invalid_argument;
+// ShowCommand is skipped, as in headless duels.
+
+class Match {
+public:
+    Match(const Fighter& f1, const Fighter& f2, int maxRoundLimit = 1000)
+        : maxRounds(maxRoundLimit) {
+        const Fighter* templates[2] = {&f1, &f2};
+        for (int s = 0; s < 2; s++) {
+            const Fighter& f = *templates[s];
+            fighters[s] = &f;
+            maxHP[s] = f.maxHP;
+            heal[s] = f.maxHP * archetypes().healFraction(f.archetype);
+            archetype[s] = f.archetype;
+            typeId[s] = f.typeId;
+            nameId[s] = f.nameId;
+            abilityCount[s] = (int)f.abilities.size();
+            for (auto& ability : f.abilities) {
+                abilityPrograms.push_back(ability->program.empty() ? AbilityCompiler::compile(ability->action)
+                                                                   : ability->program);
+            }
+        }
+        abilityBase[0] = 0;
+        abilityBase[1] = abilityCount[0];
+        for (auto& program : abilityPrograms) {
+            addProgram(program);
+        }
+        for (size_t p = 0; p < programs.size(); p++) {
+            scanProgram(p);
+        }
+    }
+
+    // Programs point into abilityPrograms
+    Match(const Match&) = delete;
+    Match& operator=(const Match&) = delete;
+
+    const Fighter& fighter(int side) const { return *fighters[side]; }
+    int abilities(int side) const { return abilityCount[side]; }
+
+    // Round 1, player 1 to choose
+    MatchState start() const {
+        MatchState s;
+        std::memset(&s, 0, sizeof(s));
+        for (int i = 0; i < 2; i++) {
+            s.side[i].hp = maxHP[i];
+            s.side[i].inRing = 1;
+        }
+        s.round = 1;
+        s.player1Turn = 1;
+        settle(s);
+        return s;
+    }
+
+    // Number of abilities the mover can choose from; 0 once the duel is over
+    int choices(const MatchState& s) const {
+        return s.over ? 0 : abilityCount[s.mover()];
+    }
+
+    // The mover uses ability `choice` (out of range: skips the turn), and
+    // play continues up to the next choice or the end of the duel.
+    void play(MatchState& s, int choice) const {
+        if (s.over) return;
+        int attacker = s.mover();
+        if (choice >= 0 && choice < abilityCount[attacker]) {
+            run(s, abilityBase[attacker] + choice, attacker);
+        }
+        endTurn(s);
+        settle(s);
+    }
+
+    // State of a duel in progress between fighters built from the same
+    // templates, e.g. the working fighters of runDuel or DuelEngine when
+    // a policy is asked for a choice. Pending effects are matched to their
+    // programs by the subtree that scheduled them; effects from other
+    // abilities throw std::invalid_argument.
+    MatchState capture(const Fighter& player1, const Fighter& player2, int round, bool player1Turn) const {
+        MatchState s;
+        std::memset(&s, 0, sizeof(s));
+        const Fighter* f[2] = {&player1, &player2};
+        for (int i = 0; i < 2; i++) {
+            MatchSide& side = s.side[i];
+            side.hp = f[i]->currentHP;
+            side.inRing = f[i]->inRing;
+            side.delayedTurn = (int32_t)f[i]->delayedCommands.turn();
+            side.recurringTurn = (int32_t)f[i]->recurringCommands.turn();
+
+            std::vector<const ScheduledEffect*> delayed;
+            for (const ScheduledEffect& e : f[i]->delayedCommands.entries()) delayed.push_back(&e);
+            std::sort(delayed.begin(), delayed.end(),
+                      [](const ScheduledEffect* a, const ScheduledEffect* b) { return a->seq < b->seq; });
+            for (const ScheduledEffect* e : delayed) {
+                push(side.delayed, side.delayedCount, (int32_t)e->tick, effectId(*e->cmd));
+            }
+            for (const ScheduledEffect& e : f[i]->recurringCommands.entries()) {
+                push(side.recurring, side.recurringCount, (int32_t)e.tick, effectId(*e.cmd));
+            }
+        }
+        s.round = round;
+        s.player1Turn = player1Turn;
+        // A choice is pending, even if turn-start effects just decided the
+        // duel: settle() stops there as well
+        s.over = 0;
+        return s;
+    }
+
+    // Ability and effect programs; effect ids in MatchEffect are below this
+    int programCount() const { return (int)programs.size(); }
+
+    DuelResult result(const MatchState& s) const {
+        bool alive1 = s.side[0].hp > 0, alive2 = s.side[1].hp > 0;
+        DuelResult r;
+        r.winner = !alive2 && alive1 ? 1 : !alive1 && alive2 ? 2 : 0;
+        r.rounds = s.round > maxRounds ? maxRounds : s.round;
+        r.finalHP1 = s.side[0].hp;
+        r.finalHP2 = s.side[1].hp;
+        return r;
+    }
+
+private:
+    struct ProgramInfo {
+        const Program* program;
+        std::vector<uint16_t> targets;      // program id of commands[i]
+    };
+
+    const Fighter* fighters[2];
+    int maxRounds;
+    double maxHP[2];
+    double heal[2];
+    uint8_t archetype[2];
+    uint32_t typeId[2];
+    uint32_t nameId[2];
+    int abilityCount[2];
+    int abilityBase[2];
+    std::vector<Program> abilityPrograms;
+    std::vector<ProgramInfo> programs;
+    std::map<const Command*, uint16_t> effectIds;     // by scheduled subtree
+
+    void addProgram(const Program& program) {
+        ProgramInfo info;
+        info.program = &program;
+        programs.push_back(info);
+    }
+
+    void scanProgram(size_t p) {
+        const Program& program = *programs[p].program;
+        programs[p].targets.assign(program.commands.size(), 0);
+        for (const Instruction& in : program.code) {
+            if (in.op == OpCode::EXECUTE) {
+                if (!dynamic_cast<ShowCommand*>(program.commands[in.index].get())) {
+                    throw std::invalid_argument("Match: user-defined commands are not supported");
+                }
+            } else if (in.op == OpCode::FOR_ROUNDS || in.op == OpCode::AFTER_ROUNDS) {
+                auto compiled = std::dynamic_pointer_cast<CompiledCommand>(program.commands[in.index]);
+                auto it = effectIds.find(effectKey(compiled.get()));
+                if (it == effectIds.end()) {
+                    addProgram(compiled->program);
+                    it = effectIds.emplace(effectKey(compiled.get()), (uint16_t)(programs.size() - 1)).first;
+                }
+                programs[p].targets[in.index] = it->second;
+            }
+        }
+        for (const CondInstruction& in : program.conditionCode) {
+            if (in.op == CondOp::EVALUATE) {
+                throw std::invalid_argument("Match: lambda conditions are not supported");
+            }
+        }
+    }
+
+    // Scheduled bytecode carries its subtree; the tree walker schedules it
+    // directly. Cached programs (Ruleset.h) have no subtree and stand for
+    // themselves.
+    static const Command* effectKey(const CompiledCommand* compiled) {
+        return compiled->source ? compiled->source.get() : compiled;
+    }
+
+    uint16_t effectId(const Command& cmd) const {
+        const CompiledCommand* compiled = dynamic_cast<const CompiledCommand*>(&cmd);
+        auto it = effectIds.find(compiled ? effectKey(compiled) : &cmd);
+        if (it == effectIds.end()) {
+            throw std::invalid_argument("Match: pending effect from another matchup");
+        }
+        return it->second;
+    }
+
+    static void push(MatchEffect* list, uint8_t& count, int32_t tick, uint16_t program) {
+        if (count == MatchSide::MAX_EFFECTS) {
+            throw std::length_error("Match: too many pending effects");
+        }
+        MatchEffect e = {tick, program, 0};
+        list[count++] = e;
+    }
+
+    // ----- turn structure, as in DuelEngine::resume -----
+
+    void endTurn(MatchState& s) const {
+        s.player1Turn = !s.player1Turn;
+        if (s.player1Turn && s.side[0].hp > 0 && s.side[1].hp > 0) s.round++;
+    }
+
+    void settle(MatchState& s) const {
+        while (s.side[0].hp > 0 && s.side[1].hp > 0 && s.round <= maxRounds) {
+            // Grappler healing on even rounds
+            if (s.round % 2 == 0) {
+                for (int i = 0; i < 2; i++) {
+                    if (heal[i] > 0 && s.side[i].inRing) gain(s.side[i], heal[i], maxHP[i]);
+                }
+            }
+            int attacker = s.mover();
+            processDelayed(s, attacker);
+            processRecurring(s, attacker);
+            if (s.side[attacker].inRing && abilityCount[attacker] > 0) return;
+            endTurn(s);
+        }
+        s.over = 1;
+    }
+
+    void processDelayed(MatchState& s, int attacker) const {
+        MatchSide& me = s.side[attacker];
+        int32_t now = ++me.delayedTurn;
+        // Firing never schedules onto the attacker's own delayed list
+        int kept = 0;
+        for (int i = 0; i < me.delayedCount; i++) {
+            MatchEffect e = me.delayed[i];
+            if (e.tick <= now) {
+                run(s, e.program, attacker);
+            } else {
+                me.delayed[kept++] = e;
+            }
+        }
+        me.delayedCount = (uint8_t)kept;
+    }
+
+    void processRecurring(MatchState& s, int attacker) const {
+        MatchSide& me = s.side[attacker];
+        int32_t now = ++me.recurringTurn;
+        int count = me.recurringCount;
+        if (!count) return;
+        for (int i = 0; i < count; i++) {
+            run(s, me.recurring[i].program, attacker);
+        }
+        // Effects scheduled while running start next turn and are kept
+        int kept = 0;
+        for (int i = 0; i < me.recurringCount; i++) {
+            if (i >= count || me.recurring[i].tick > now) me.recurring[kept++] = me.recurring[i];
+        }
+        me.recurringCount = (uint8_t)kept;
+    }
+
+    // ----- interpreter, as runProgram/runCondition -----
+
+    static void gain(MatchSide& side, double amount, double max) {
+        side.hp += amount;
+        if (side.hp > max) side.hp = max;
+    }
+
+    void run(MatchState& s, int id, int attacker) const {
+        const ProgramInfo& info = programs[id];
+        const Program& program = *info.program;
+        const Instruction* code = program.code.data();
+        int defender = 1 - attacker;
+        for (const Instruction* in = code; in->op != OpCode::END; ++in) {
+            int target = in->onDefender ? defender : attacker;
+            MatchSide& t = s.side[target];
+            switch (in->op) {
+                case OpCode::DAMAGE:
+                    if (t.inRing) {
+                        const DamageModifier& m = archetypes().modifier(archetype[attacker], archetype[target], s.round);
+                        t.hp -= in->amount * m.attack * m.defense;
+                        if (t.hp < 0) t.hp = 0;
+                    }
+                    break;
+                case OpCode::HEAL:
+                    gain(t, in->amount, maxHP[target]);
+                    break;
+                case OpCode::TAG_OUT:
+                    t.inRing = 0;
+                    break;
+                case OpCode::TAG_IN:
+                    t.inRing = 1;
+                    break;
+                case OpCode::FOR_ROUNDS: {
+                    MatchSide& a = s.side[attacker];
+                    push(a.recurring, a.recurringCount, a.recurringTurn + std::max(in->count, 1),
+                         info.targets[in->index]);
+                    break;
+                }
+                case OpCode::AFTER_ROUNDS: {
+                    MatchSide& d = s.side[defender];
+                    push(d.delayed, d.delayedCount, d.delayedTurn + std::max(in->count, 1),
+                         info.targets[in->index]);
+                    break;
+                }
+                case OpCode::BRANCH_IF_FALSE:
+                    if (!condition(s, program, in->index, attacker)) in = code + in->target - 1;
+                    break;
+                case OpCode::JUMP:
+                    in = code + in->target - 1;
+                    break;
+                case OpCode::EXECUTE:     // ShowCommand
+                case OpCode::END:
+                    break;
+            }
+        }
+    }
+
+    double numeric(const MatchState& s, const ValueSource& src, int attacker) const {
+        const MatchSide& f = s.side[src.isAttacker ? attacker : 1 - attacker];
+        switch (src.kind) {
+            case ValueSource::HP: return f.hp;
+            case ValueSource::OUT_OF_RING: return f.inRing ? 0.0 : 1.0;
+            default: return src.constant;
+        }
+    }
+
+    bool condition(const MatchState& s, const Program& program, int32_t start, int attacker) const {
+        const CondInstruction* code = program.conditionCode.data();
+        bool r = false;
+        for (const CondInstruction* in = code + start; in->op != CondOp::END; ++in) {
+            switch (in->op) {
+                case CondOp::COMPARE:
+                    r = compareValues(in->cmp, numeric(s, in->lhs, attacker), numeric(s, in->rhs, attacker));
+                    break;
+                case CondOp::SYMBOL_COMPARE: {
+                    int side = in->lhs.isAttacker ? attacker : 1 - attacker;
+                    uint32_t symbol = in->lhs.kind == ValueSource::TYPE ? typeId[side] : nameId[side];
+                    r = (symbol == in->symbol) == (in->cmp == CmpOp::EQ);
+                    break;
+                }
+                case CondOp::SET:
+                    r = in->value;
+                    break;
+                case CondOp::JUMP_IF_FALSE:
+                    if (!r) in = code + in->target - 1;
+                    break;
+                case CondOp::JUMP_IF_TRUE:
+                    if (r) in = code + in->target - 1;
+                    break;
+                case CondOp::NOT:
+                    r = !r;
+                    break;
+                case CondOp::EVALUATE:    // rejected by the constructor
+                case CondOp::END:
+                    break;
+            }
+        }
+        return r;
+    }
+};
+
+// ========== MATCH POLICIES ==========
+//
+// Base of policies that choose by looking ahead on a Match, for one seat
+// (1 or 2) of runDuel or DuelEngine duels. The Match is built from the
+// fighters' templates: a working fighter without abilities (DuelEngine) is
+// looked up by name in the policy's World (defaultWorld() unless set). It is kept while the matchup stays
+// the same. Matchups a Match cannot model (lambda conditions, user-defined
+// commands, too many pending effects) are played greedily.
+
+class MatchPolicy : public AbilityPolicy {
+public:
+    explicit MatchPolicy(int seat) : player(seat), maxRounds(1000), prepared(false), world(&defaultWorld()) {
+        templates[0] = templates[1] = nullptr;
+    }
+
+    // World the duels' fighters come from
+    void setWorld(const World& w) {
+        world = &w;
+        prepared = false;
+    }
+
+    // Round limit of the duels played, as given to DuelEngine
+    void setMaxRounds(int limit) {
+        maxRounds = limit;
+        prepared = false;
+    }
+
+    int choose(Fighter* self, Fighter* opponent, const AbilityList& abilities, int round) override {
+        Fighter* p1 = player == 1 ? self : opponent;
+        Fighter* p2 = player == 1 ? opponent : self;
+        prepare(*p1, *p2);
+        if (match) {
+            try {
+                return decide(*match, match->capture(*p1, *p2, round, player == 1));
+            } catch (const std::exception&) {
+            }
+        }
+        return greedy.choose(self, opponent, abilities, round);
+    }
+
+protected:
+    // Called with nullptr before the current Match is destroyed, then with
+    // the Match of the new matchup (if it could be built)
+    virtual void setMatch(const Match* m) = 0;
+
+    // Choice for the side to move in `s`, which is waiting for one
+    virtual int decide(const Match& m, const MatchState& s) = 0;
+
+private:
+    int player;
+    int maxRounds;
+    bool prepared;
+    const World* world;
+    const Fighter* templates[2];
+    std::vector<const Ability*> signature[2];
+    std::unique_ptr<Match> match;
+    GreedyDamagePolicy greedy;
+
+    const Fighter* templateOf(const Fighter& f) const {
+        if (!f.abilities.empty()) return &f;
+        const Fighter* t = world->findFighter(f.name);
+        return t ? t : &f;
+    }
+
+    void prepare(const Fighter& f1, const Fighter& f2) {
+        const Fighter* t[2] = {templateOf(f1), templateOf(f2)};
+        bool same = prepared;
+        for (int i = 0; i < 2 && same; i++) {
+            same = t[i] == templates[i] && t[i]->abilities.size() == signature[i].size();
+            for (size_t a = 0; same && a < signature[i].size(); a++) {
+                same = t[i]->abilities[a].get() == signature[i][a];
+            }
+        }
+        if (same) return;
+
+        setMatch(nullptr);
+        match.reset();
+        prepared = true;
+        for (int i = 0; i < 2; i++) {
+            templates[i] = t[i];
+            signature[i].clear();
+            for (auto& ability : t[i]->abilities) signature[i].push_back(ability.get());
+        }
+        try {
+            match.reset(new Match(*t[0], *t[1], maxRounds));
+        } catch (const std::exception&) {
+            return;
+        }
+        setMatch(match.get());
+    }
+};
+
+#endif // MATCH_H
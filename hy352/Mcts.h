@@ -0,0 +1,263 @@
+#ifndef MCTS_H
+#define MCTS_H
+
+#include "Match.h"
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <thread>
+
+// ========== MONTE CARLO TREE SEARCH ==========
+//
+// UCT over Match states with uniformly random rollouts, for rulesets whose
+// long AFTER_ROUNDS/FOR_ROUNDS horizons are out of reach of alpha-beta.
+// Root parallelism: every thread grows its own tree from the same root
+// with its own random stream, and the visit counts of the root moves are
+// summed when time is up. Threads share nothing while searching, so the
+// rollout rate grows with the number of cores.
+
+struct MctsLimits {
+    double seconds;         // per move
+    long iterations;        // per thread, instead of the time limit; 0: until time is up
+    unsigned threads;       // 0: one per core
+    int rolloutPlies;       // choices per rollout before HP decides; 0: to the end
+    double exploration;     // UCT constant
+
+    MctsLimits(double s = 0.01, unsigned t = 0)
+        : seconds(s), iterations(0), threads(t), rolloutPlies(0), exploration(1.4) {}
+};
+
+struct MctsStats {
+    long rollouts;          // all threads
+    long nodes;             // summed tree sizes
+    unsigned threads;
+    int bestMove;
+    double value;           // mean rollout result of bestMove for the side to move
+    double seconds;
+
+    MctsStats() : rollouts(0), nodes(0), threads(0), bestMove(-1), value(0), seconds(0) {}
+
+    double rolloutsPerSecond() const { return seconds > 0 ? rollouts / seconds : 0.0; }
+};
+
+struct MctsNode {
+    int32_t firstChild;     // -1 until expanded
+    uint16_t childCount;
+    uint8_t move;           // choice that leads here from the parent
+    uint8_t chooser;        // side that made it
+    uint32_t visits;
+    double wins;            // rollout results for `chooser`
+};
+
+// One thread's tree. Storage is kept between searches.
+class MctsTree {
+public:
+    explicit MctsTree(size_t maxNodes = 1 << 18) : limit(maxNodes) {}
+
+    void search(const Match& match, const MatchState& root, const MctsLimits& limits,
+                std::chrono::steady_clock::time_point deadline, uint64_t seed) {
+        rng.seed(seed);
+        nodes.clear();
+        MctsNode top = {-1, 0, 0, 0, 0, 0.0};
+        nodes.push_back(top);
+        rollouts = 0;
+        for (long i = 0;; i++) {
+            if (limits.iterations ? i >= limits.iterations
+                                  : i > 0 && (i & 63) == 0 && std::chrono::steady_clock::now() >= deadline) break;
+            iterate(match, root, limits);
+        }
+    }
+
+    const MctsNode& node(int i) const { return nodes[i]; }
+    size_t size() const { return nodes.size(); }
+    long rolloutCount() const { return rollouts; }
+
+private:
+    std::vector<MctsNode> nodes;
+    std::vector<int32_t> path;
+    std::vector<double> logTable;     // log(n) for small visit counts
+    size_t limit;
+    FastRng rng;
+    long rollouts;
+
+    double logVisits(uint32_t n) {
+        if (n < 4096) {
+            while (logTable.size() <= n) logTable.push_back(std::log((double)std::max<size_t>(logTable.size(), 1)));
+            return logTable[n];
+        }
+        return std::log((double)n);
+    }
+
+    int32_t select(int32_t parent, double exploration) {
+        const MctsNode& p = nodes[parent];
+        double scale = exploration * std::sqrt(logVisits(p.visits));
+        int32_t best = p.firstChild;
+        double bestScore = -1;
+        for (int32_t c = p.firstChild; c < p.firstChild + p.childCount; c++) {
+            const MctsNode& n = nodes[c];
+            if (n.visits == 0) return c;
+            double score = n.wins / n.visits + scale / std::sqrt((double)n.visits);
+            if (score > bestScore) {
+                bestScore = score;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    bool expand(int32_t id, const Match& match, const MatchState& s) {
+        int count = match.choices(s);
+        if (nodes.size() + count > limit) return false;
+        nodes[id].firstChild = (int32_t)nodes.size();
+        nodes[id].childCount = (uint16_t)count;
+        for (int i = 0; i < count; i++) {
+            MctsNode child = {-1, 0, (uint8_t)i, (uint8_t)s.mover(), 0, 0.0};
+            nodes.push_back(child);
+        }
+        return true;
+    }
+
+    // Result for side 0: 1 win, 0 loss, 0.5 draw; unfinished rollouts score
+    // by HP fraction
+    double rollout(const Match& match, MatchState& s, int plies) {
+        for (int n = 0; !s.over && (plies == 0 || n < plies); n++) {
+            match.play(s, rng.below(match.choices(s)));
+        }
+        rollouts++;
+        if (s.over) {
+            int winner = match.result(s).winner;
+            return winner == 1 ? 1.0 : winner == 2 ? 0.0 : 0.5;
+        }
+        double f0 = s.side[0].hp / match.fighter(0).maxHP;
+        double f1 = s.side[1].hp / match.fighter(1).maxHP;
+        return 0.5 + 0.5 * (f0 - f1);
+    }
+
+    void iterate(const Match& match, const MatchState& root, const MctsLimits& limits) {
+        MatchState s = root;
+        int32_t id = 0;
+        path.clear();
+        path.push_back(0);
+        while (!s.over) {
+            if (nodes[id].firstChild < 0) {
+                if (id != 0 && nodes[id].visits == 0) break;
+                if (!expand(id, match, s)) break;
+            }
+            id = select(id, limits.exploration);
+            match.play(s, nodes[id].move);
+            path.push_back(id);
+        }
+        double result = rollout(match, s, limits.rolloutPlies);
+        for (int32_t n : path) {
+            MctsNode& node = nodes[n];
+            node.visits++;
+            node.wins += node.chooser == 0 ? result : 1.0 - result;
+        }
+    }
+};
+
+class MctsSearch {
+public:
+    explicit MctsSearch(const Match& m, size_t maxNodesPerThread = 1 << 18)
+        : match(m), treeSize(maxNodesPerThread), searches(0) {}
+
+    // Most visited root move over all threads; -1 if the duel is over.
+    // With an iteration limit and a fixed seed the result is reproducible.
+    int bestMove(const MatchState& root, const MctsLimits& limits, MctsStats* stats = nullptr,
+                 uint64_t seed = 1) {
+        MctsStats run;
+        int moves = match.choices(root);
+        auto start = std::chrono::steady_clock::now();
+        if (moves > 0) {
+            unsigned threads = limits.threads ? limits.threads : std::max(1u, std::thread::hardware_concurrency());
+            while (trees.size() < threads) trees.emplace_back(new MctsTree(treeSize));
+            auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                        std::chrono::duration<double>(limits.seconds));
+
+            std::vector<std::exception_ptr> errors(threads);
+            auto work = [&](unsigned t) {
+                try {
+                    trees[t]->search(match, root, limits, deadline, policySeed(policySeed(seed, searches, 0), t, 0));
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            };
+            std::vector<std::thread> pool;
+            for (unsigned t = 1; t < threads; t++) pool.emplace_back(work, t);
+            work(0);
+            for (auto& t : pool) t.join();
+            searches++;
+            for (auto& e : errors) {
+                if (e) std::rethrow_exception(e);
+            }
+
+            // Merge the root statistics
+            std::vector<double> visits(moves, 0.0), wins(moves, 0.0);
+            for (unsigned t = 0; t < threads; t++) {
+                const MctsTree& tree = *trees[t];
+                const MctsNode& top = tree.node(0);
+                for (int c = 0; c < top.childCount; c++) {
+                    const MctsNode& child = tree.node(top.firstChild + c);
+                    visits[child.move] += child.visits;
+                    wins[child.move] += child.wins;
+                }
+                run.rollouts += tree.rolloutCount();
+                run.nodes += (long)tree.size();
+            }
+            run.threads = threads;
+            run.bestMove = 0;
+            for (int m = 1; m < moves; m++) {
+                if (visits[m] > visits[run.bestMove]) run.bestMove = m;
+            }
+            run.value = visits[run.bestMove] > 0 ? wins[run.bestMove] / visits[run.bestMove] : 0.5;
+        }
+        run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (stats) *stats = run;
+        return run.bestMove;
+    }
+
+private:
+    const Match& match;
+    size_t treeSize;
+    std::vector<std::unique_ptr<MctsTree>> trees;
+    uint64_t searches;
+};
+
+// MatchPolicy that plays the MCTS choice.
+class MctsPolicy : public MatchPolicy {
+public:
+    explicit MctsPolicy(int seat, const MctsLimits& l = MctsLimits(), uint64_t s = 1)
+        : MatchPolicy(seat), limits(l), seed(s), moves(0) {}
+
+    void setLimits(const MctsLimits& l) { limits = l; }
+
+    // Last search, and totals over every move searched so far
+    const MctsStats& lastSearch() const { return last; }
+    const MctsStats& totals() const { return total; }
+    long movesSearched() const { return moves; }
+
+protected:
+    void setMatch(const Match* m) override {
+        search.reset(m ? new MctsSearch(*m) : nullptr);
+    }
+
+    int decide(const Match&, const MatchState& s) override {
+        int choice = search->bestMove(s, limits, &last, seed);
+        moves++;
+        total.rollouts += last.rollouts;
+        total.nodes += last.nodes;
+        total.threads = last.threads;
+        total.seconds += last.seconds;
+        return choice;
+    }
+
+private:
+    MctsLimits limits;
+    uint64_t seed;
+    std::unique_ptr<MctsSearch> search;
+    MctsStats last;
+    MctsStats total;
+    long moves;
+};
+
+#endif // MCTS_H
@@ -0,0 +1,516 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// ========== HOT-PATH PROFILE ==========
+//
+// Opt-in instrumentation, compiled in by defining TEKKEN_PROFILE (Tekken.h
+// includes this header then; without it every hook expands to nothing).
+// Counts executions per ability, per command node type and per condition
+// outcome, and keeps log2-bucketed latency histograms of Ability::use and
+// of DuelEngine turns.
+//
+// Every thread writes to its own cache-line-padded ThreadProfile with
+// plain relaxed stores, so the hooks never contend. profileReport() merges
+// all of them on demand; a thread that exits folds its counts into a
+// retired total and hands its slot to the next thread.
+
+enum class ProfiledCommand : uint8_t {
+    DAMAGE, HEAL, TAG, FOR_ROUNDS, AFTER_ROUNDS, IF, COMPOSITE, SHOW, COMPILED, COUNT
+};
+
+// BRANCH is the whole condition of an IF (tree or bytecode). Compiled
+// condition tapes count their comparisons; their AND/OR/NOT are jumps.
+enum class ProfiledCondition : uint8_t {
+    COMPARE, STRING_COMPARE, AND, OR, NOT, BRANCH, COUNT
+};
+
+enum class ProfiledLatency : uint8_t {
+    ABILITY_USE,    // Ability::use
+    TURN,           // one DuelEngine turn: effects, choice and ability
+    EFFECTS,        // start-of-turn delayed and recurring effects
+    COUNT
+};
+
+inline const char* profiledName(ProfiledCommand c) {
+    static const char* const names[] = {"DAMAGE", "HEAL", "TAG", "FOR_ROUNDS", "AFTER_ROUNDS",
+                                        "IF", "COMPOSITE", "SHOW", "COMPILED"};
+    return names[(int)c];
+}
+
+inline const char* profiledName(ProfiledCondition c) {
+    static const char* const names[] = {"COMPARE", "STRING_COMPARE", "AND", "OR", "NOT", "BRANCH"};
+    return names[(int)c];
+}
+
+inline const char* profiledName(ProfiledLatency l) {
+    static const char* const names[] = {"ability_use", "turn", "effects"};
+    return names[(int)l];
+}
+
+// Only the owning thread writes a counter, so a load and a store are enough
+inline void profileBump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// ========== LATENCY HISTOGRAM ==========
+
+// Bucket 0 holds 0 ns, bucket b > 0 holds [2^(b-1), 2^b) ns.
+struct LatencyHistogram {
+    static const int BUCKETS = 48;
+    uint64_t buckets[BUCKETS];
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+
+    LatencyHistogram() { clear(); }
+
+    void clear() {
+        std::fill(buckets, buckets + BUCKETS, 0);
+        count = totalNs = maxNs = 0;
+    }
+
+    static int bucketOf(uint64_t ns) {
+        int b = 0;
+        while (ns && b < BUCKETS - 1) {
+            ns >>= 1;
+            b++;
+        }
+        return b;
+    }
+    // Largest latency that falls into bucket b
+    static uint64_t upperBound(int b) { return b == 0 ? 0 : (UINT64_C(1) << b) - 1; }
+
+    void merge(const LatencyHistogram& other) {
+        for (int b = 0; b < BUCKETS; b++) buckets[b] += other.buckets[b];
+        count += other.count;
+        totalNs += other.totalNs;
+        maxNs = std::max(maxNs, other.maxNs);
+    }
+
+    double meanNs() const { return count ? (double)totalNs / count : 0.0; }
+
+    // Upper bound of the bucket holding the q-th quantile (0 < q <= 1)
+    uint64_t quantileNs(double q) const {
+        uint64_t rank = (uint64_t)(q * count + 0.5), seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += buckets[b];
+            if (seen >= rank && seen > 0) return std::min(upperBound(b), maxNs);
+        }
+        return maxNs;
+    }
+};
+
+// The per-thread form: same layout, written with relaxed stores
+struct ThreadHistogram {
+    std::atomic<uint64_t> buckets[LatencyHistogram::BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+
+    ThreadHistogram() { clear(); }
+
+    void clear() {
+        for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        totalNs.store(0, std::memory_order_relaxed);
+        maxNs.store(0, std::memory_order_relaxed);
+    }
+
+    void add(uint64_t ns) {
+        profileBump(buckets[LatencyHistogram::bucketOf(ns)]);
+        profileBump(count);
+        profileBump(totalNs, ns);
+        if (ns > maxNs.load(std::memory_order_relaxed)) maxNs.store(ns, std::memory_order_relaxed);
+    }
+
+    void addTo(LatencyHistogram& h) const {
+        for (int b = 0; b < LatencyHistogram::BUCKETS; b++) h.buckets[b] += buckets[b].load(std::memory_order_relaxed);
+        h.count += count.load(std::memory_order_relaxed);
+        h.totalNs += totalNs.load(std::memory_order_relaxed);
+        h.maxNs = std::max(h.maxNs, maxNs.load(std::memory_order_relaxed));
+    }
+};
+
+// ========== PER-THREAD COUNTERS ==========
+
+// Ability counters come in chunks allocated on first use, so a thread
+// only pays for the ability ids it actually runs.
+struct ProfileAbilityChunk {
+    static const uint32_t SIZE = 1024;
+    std::atomic<uint64_t> uses[SIZE];
+    std::atomic<uint64_t> totalNs[SIZE];
+
+    ProfileAbilityChunk() {
+        for (uint32_t i = 0; i < SIZE; i++) {
+            uses[i].store(0, std::memory_order_relaxed);
+            totalNs[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Heap-allocated per thread. The padding keeps the counters a cache line
+// away from whatever the allocator puts next to them (new does not honour
+// alignas beyond 16 bytes before C++17).
+struct ThreadProfile {
+    static const uint32_t MAX_CHUNKS = 1024;   // 1M ability ids
+
+    char leadingPadding[64];
+    std::atomic<uint64_t> commands[(int)ProfiledCommand::COUNT];
+    std::atomic<uint64_t> conditions[(int)ProfiledCondition::COUNT][2];     // [kind][outcome]
+    ThreadHistogram latency[(int)ProfiledLatency::COUNT];
+    std::atomic<ProfileAbilityChunk*> chunks[MAX_CHUNKS];
+    char trailingPadding[64];
+
+    ThreadProfile() {
+        for (auto& c : commands) c.store(0, std::memory_order_relaxed);
+        for (auto& c : conditions) {
+            c[0].store(0, std::memory_order_relaxed);
+            c[1].store(0, std::memory_order_relaxed);
+        }
+        for (auto& c : chunks) c.store(nullptr, std::memory_order_relaxed);
+    }
+    ~ThreadProfile() {
+        for (auto& c : chunks) delete c.load(std::memory_order_relaxed);
+    }
+    ThreadProfile(const ThreadProfile&) = delete;
+    ThreadProfile& operator=(const ThreadProfile&) = delete;
+
+    void ability(uint32_t id, uint64_t ns) {
+        uint32_t chunk = id / ProfileAbilityChunk::SIZE;
+        if (chunk >= MAX_CHUNKS) return;
+        ProfileAbilityChunk* c = chunks[chunk].load(std::memory_order_relaxed);
+        if (!c) {
+            c = new ProfileAbilityChunk();
+            chunks[chunk].store(c, std::memory_order_release);
+        }
+        profileBump(c->uses[id % ProfileAbilityChunk::SIZE]);
+        profileBump(c->totalNs[id % ProfileAbilityChunk::SIZE], ns);
+    }
+
+    void clear() {
+        for (auto& c : commands) c.store(0, std::memory_order_relaxed);
+        for (auto& c : conditions) {
+            c[0].store(0, std::memory_order_relaxed);
+            c[1].store(0, std::memory_order_relaxed);
+        }
+        for (auto& h : latency) h.clear();
+        for (auto& c : chunks) {
+            if (ProfileAbilityChunk* chunk = c.load(std::memory_order_acquire)) {
+                for (uint32_t i = 0; i < ProfileAbilityChunk::SIZE; i++) {
+                    chunk->uses[i].store(0, std::memory_order_relaxed);
+                    chunk->totalNs[i].store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+};
+
+// ========== MERGED REPORT ==========
+
+struct ProfiledAbility {
+    uint32_t id;
+    std::string name;
+    uint64_t uses;
+    uint64_t totalNs;
+};
+
+struct ProfileReport {
+    uint64_t commands[(int)ProfiledCommand::COUNT];
+    uint64_t conditions[(int)ProfiledCondition::COUNT][2];
+    LatencyHistogram latency[(int)ProfiledLatency::COUNT];
+    std::vector<ProfiledAbility> abilities;     // abilities that were used, most total time first
+    unsigned threads;                           // live thread profiles merged
+
+    ProfileReport() : threads(0) {
+        std::fill(commands, commands + (int)ProfiledCommand::COUNT, 0);
+        for (auto& c : conditions) c[0] = c[1] = 0;
+    }
+
+    void writeCsv(std::ostream& out) const {
+        char line[512];
+        out << "kind,name,count,true,false,total_ns,mean_ns,p50_ns,p99_ns,max_ns\n";
+        for (int c = 0; c < (int)ProfiledCommand::COUNT; c++) {
+            snprintf(line, sizeof line, "command,%s,%llu,,,,,,,\n", profiledName((ProfiledCommand)c),
+                     (unsigned long long)commands[c]);
+            out << line;
+        }
+        for (int c = 0; c < (int)ProfiledCondition::COUNT; c++) {
+            snprintf(line, sizeof line, "condition,%s,%llu,%llu,%llu,,,,,\n", profiledName((ProfiledCondition)c),
+                     (unsigned long long)(conditions[c][0] + conditions[c][1]),
+                     (unsigned long long)conditions[c][1], (unsigned long long)conditions[c][0]);
+            out << line;
+        }
+        for (const ProfiledAbility& a : abilities) {
+            snprintf(line, sizeof line, "ability,%s,%llu,,,%llu,%.1f,,,\n", csvField(a.name).c_str(),
+                     (unsigned long long)a.uses, (unsigned long long)a.totalNs,
+                     a.uses ? (double)a.totalNs / a.uses : 0.0);
+            out << line;
+        }
+        for (int l = 0; l < (int)ProfiledLatency::COUNT; l++) {
+            const LatencyHistogram& h = latency[l];
+            snprintf(line, sizeof line, "latency,%s,%llu,,,%llu,%.1f,%llu,%llu,%llu\n",
+                     profiledName((ProfiledLatency)l), (unsigned long long)h.count,
+                     (unsigned long long)h.totalNs, h.meanNs(), (unsigned long long)h.quantileNs(0.5),
+                     (unsigned long long)h.quantileNs(0.99), (unsigned long long)h.maxNs);
+            out << line;
+            for (int b = 0; b < LatencyHistogram::BUCKETS; b++) {
+                if (!h.buckets[b]) continue;
+                snprintf(line, sizeof line, "bucket,%s<=%llu,%llu,,,,,,,\n", profiledName((ProfiledLatency)l),
+                         (unsigned long long)LatencyHistogram::upperBound(b), (unsigned long long)h.buckets[b]);
+                out << line;
+            }
+        }
+    }
+
+    void writeJson(std::ostream& out) const {
+        char line[512];
+        out << "{\n  \"threads\": " << threads << ",\n  \"commands\": {";
+        for (int c = 0; c < (int)ProfiledCommand::COUNT; c++) {
+            snprintf(line, sizeof line, "%s\"%s\": %llu", c ? ", " : "", profiledName((ProfiledCommand)c),
+                     (unsigned long long)commands[c]);
+            out << line;
+        }
+        out << "},\n  \"conditions\": {";
+        for (int c = 0; c < (int)ProfiledCondition::COUNT; c++) {
+            snprintf(line, sizeof line, "%s\"%s\": {\"true\": %llu, \"false\": %llu}", c ? ", " : "",
+                     profiledName((ProfiledCondition)c), (unsigned long long)conditions[c][1],
+                     (unsigned long long)conditions[c][0]);
+            out << line;
+        }
+        out << "},\n  \"latency\": {\n";
+        for (int l = 0; l < (int)ProfiledLatency::COUNT; l++) {
+            const LatencyHistogram& h = latency[l];
+            snprintf(line, sizeof line, "    \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"mean_ns\": %.1f, "
+                     "\"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, \"buckets\": [",
+                     profiledName((ProfiledLatency)l), (unsigned long long)h.count, (unsigned long long)h.totalNs,
+                     h.meanNs(), (unsigned long long)h.quantileNs(0.5), (unsigned long long)h.quantileNs(0.99),
+                     (unsigned long long)h.maxNs);
+            out << line;
+            bool first = true;
+            for (int b = 0; b < LatencyHistogram::BUCKETS; b++) {
+                if (!h.buckets[b]) continue;
+                snprintf(line, sizeof line, "%s{\"le_ns\": %llu, \"count\": %llu}", first ? "" : ", ",
+                         (unsigned long long)LatencyHistogram::upperBound(b), (unsigned long long)h.buckets[b]);
+                out << line;
+                first = false;
+            }
+            out << "]}" << (l + 1 < (int)ProfiledLatency::COUNT ? ",\n" : "\n");
+        }
+        out << "  },\n  \"abilities\": [\n";
+        for (size_t i = 0; i < abilities.size(); i++) {
+            const ProfiledAbility& a = abilities[i];
+            out << "    {\"name\": \"" << jsonString(a.name) << "\"";
+            snprintf(line, sizeof line, ", \"uses\": %llu, \"total_ns\": %llu, \"mean_ns\": %.1f}%s\n",
+                     (unsigned long long)a.uses, (unsigned long long)a.totalNs,
+                     a.uses ? (double)a.totalNs / a.uses : 0.0, i + 1 < abilities.size() ? "," : "");
+            out << line;
+        }
+        out << "  ]\n}\n";
+    }
+
+private:
+    static std::string csvField(const std::string& s) {
+        if (s.find_first_of(",\"\n") == std::string::npos) return s;
+        std::string quoted = "\"";
+        for (char c : s) {
+            if (c == '"') quoted += '"';
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+    static std::string jsonString(const std::string& s) {
+        std::string escaped;
+        for (char c : s) {
+            if (c == '"' || c == '\\') escaped += '\\';
+            if ((unsigned char)c < 0x20) continue;
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+// ========== REGISTRY ==========
+
+class ProfileRegistry {
+    std::mutex lock;
+    std::vector<std::unique_ptr<ThreadProfile>> slots;
+    std::vector<ThreadProfile*> freeSlots;
+    std::unique_ptr<ThreadProfile> retired;     // counts of threads that exited
+    std::vector<std::string> abilityNames;      // by profile id
+
+    static void add(ProfileReport& r, std::vector<uint64_t>& uses, std::vector<uint64_t>& ns,
+                    const ThreadProfile& p) {
+        for (int c = 0; c < (int)ProfiledCommand::COUNT; c++) r.commands[c] += p.commands[c].load(std::memory_order_relaxed);
+        for (int c = 0; c < (int)ProfiledCondition::COUNT; c++) {
+            r.conditions[c][0] += p.conditions[c][0].load(std::memory_order_relaxed);
+            r.conditions[c][1] += p.conditions[c][1].load(std::memory_order_relaxed);
+        }
+        for (int l = 0; l < (int)ProfiledLatency::COUNT; l++) p.latency[l].addTo(r.latency[l]);
+        for (uint32_t k = 0; k < ThreadProfile::MAX_CHUNKS; k++) {
+            const ProfileAbilityChunk* chunk = p.chunks[k].load(std::memory_order_acquire);
+            if (!chunk) continue;
+            for (uint32_t i = 0; i < ProfileAbilityChunk::SIZE; i++) {
+                uint32_t id = k * ProfileAbilityChunk::SIZE + i;
+                if (id >= uses.size()) break;
+                uses[id] += chunk->uses[i].load(std::memory_order_relaxed);
+                ns[id] += chunk->totalNs[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    static void fold(ThreadProfile& into, const ThreadProfile& from) {
+        for (int c = 0; c < (int)ProfiledCommand::COUNT; c++) profileBump(into.commands[c], from.commands[c].load());
+        for (int c = 0; c < (int)ProfiledCondition::COUNT; c++) {
+            profileBump(into.conditions[c][0], from.conditions[c][0].load());
+            profileBump(into.conditions[c][1], from.conditions[c][1].load());
+        }
+        for (int l = 0; l < (int)ProfiledLatency::COUNT; l++) {
+            ThreadHistogram& h = into.latency[l];
+            const ThreadHistogram& f = from.latency[l];
+            for (int b = 0; b < LatencyHistogram::BUCKETS; b++) profileBump(h.buckets[b], f.buckets[b].load());
+            profileBump(h.count, f.count.load());
+            profileBump(h.totalNs, f.totalNs.load());
+            h.maxNs.store(std::max(h.maxNs.load(), f.maxNs.load()));
+        }
+        for (uint32_t k = 0; k < ThreadProfile::MAX_CHUNKS; k++) {
+            const ProfileAbilityChunk* chunk = from.chunks[k].load();
+            if (!chunk) continue;
+            ProfileAbilityChunk* target = into.chunks[k].load();
+            if (!target) {
+                target = new ProfileAbilityChunk();
+                into.chunks[k].store(target);
+            }
+            for (uint32_t i = 0; i < ProfileAbilityChunk::SIZE; i++) {
+                profileBump(target->uses[i], chunk->uses[i].load());
+                profileBump(target->totalNs[i], chunk->totalNs[i].load());
+            }
+        }
+    }
+
+public:
+    ProfileRegistry() : retired(new ThreadProfile()) {}
+
+    uint32_t registerAbility(const std::string& name) {
+        std::lock_guard<std::mutex> guard(lock);
+        abilityNames.push_back(name);
+        return (uint32_t)abilityNames.size() - 1;
+    }
+
+    ThreadProfile* acquire() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!freeSlots.empty()) {
+            ThreadProfile* p = freeSlots.back();
+            freeSlots.pop_back();
+            return p;
+        }
+        slots.emplace_back(new ThreadProfile());
+        return slots.back().get();
+    }
+
+    void release(ThreadProfile* p) {
+        std::lock_guard<std::mutex> guard(lock);
+        fold(*retired, *p);
+        p->clear();
+        freeSlots.push_back(p);
+    }
+
+    ProfileReport report() {
+        std::lock_guard<std::mutex> guard(lock);
+        ProfileReport r;
+        std::vector<uint64_t> uses(abilityNames.size(), 0), ns(abilityNames.size(), 0);
+        add(r, uses, ns, *retired);
+        for (auto& slot : slots) {
+            if (std::find(freeSlots.begin(), freeSlots.end(), slot.get()) != freeSlots.end()) continue;
+            add(r, uses, ns, *slot);
+            r.threads++;
+        }
+        for (uint32_t id = 0; id < uses.size(); id++) {
+            if (!uses[id]) continue;
+            ProfiledAbility a = {id, abilityNames[id], uses[id], ns[id]};
+            r.abilities.push_back(a);
+        }
+        std::sort(r.abilities.begin(), r.abilities.end(), [](const ProfiledAbility& a, const ProfiledAbility& b) {
+            return a.totalNs != b.totalNs ? a.totalNs > b.totalNs : a.id < b.id;
+        });
+        return r;
+    }
+
+    // Counters written while this runs may survive it
+    void reset() {
+        std::lock_guard<std::mutex> guard(lock);
+        retired->clear();
+        for (auto& slot : slots) slot->clear();
+    }
+};
+
+inline ProfileRegistry& profileRegistry() {
+    static ProfileRegistry* registry = new ProfileRegistry();     // outlives exiting threads
+    return *registry;
+}
+
+// The calling thread's counters; released to the registry when it exits
+inline ThreadProfile& threadProfile() {
+    struct Holder {
+        ThreadProfile* profile;
+        Holder() : profile(profileRegistry().acquire()) {}
+        ~Holder() { profileRegistry().release(profile); }
+    };
+    static thread_local Holder holder;
+    return *holder.profile;
+}
+
+// Merged counters of every thread so far
+inline ProfileReport profileReport() { return profileRegistry().report(); }
+inline void profileReset() { profileRegistry().reset(); }
+
+// ========== HOOKS ==========
+
+inline void profileCommand(ProfiledCommand c) {
+    profileBump(threadProfile().commands[(int)c]);
+}
+
+inline bool profileCondition(ProfiledCondition c, bool outcome) {
+    profileBump(threadProfile().conditions[(int)c][outcome]);
+    return outcome;
+}
+
+inline uint64_t profileNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Adds the time until the end of the scope to a latency histogram
+class ProfileTimer {
+    ProfiledLatency kind;
+    uint64_t start;
+public:
+    explicit ProfileTimer(ProfiledLatency k) : kind(k), start(profileNow()) {}
+    ~ProfileTimer() { threadProfile().latency[(int)kind].add(profileNow() - start); }
+};
+
+// Ability::use: the use count and time of the ability, and the histogram
+class ProfileAbilityTimer {
+    uint32_t id;
+    uint64_t start;
+public:
+    explicit ProfileAbilityTimer(uint32_t abilityId) : id(abilityId), start(profileNow()) {}
+    ~ProfileAbilityTimer() {
+        uint64_t ns = profileNow() - start;
+        ThreadProfile& p = threadProfile();
+        p.latency[(int)ProfiledLatency::ABILITY_USE].add(ns);
+        p.ability(id, ns);
+    }
+};
+
+#endif // PROFILE_H
@@ -0,0 +1,367 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "Engine.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <typeinfo>
+
+// ========== REPLAYS ==========
+//
+// A replay log is the 8-byte header "TKRPLY" + version, followed by one
+// record per duel:
+//
+//   u64     ruleset hash (rulesetHash of the World it was played in)
+//   varint  World ids of player 1 and player 2
+//   varint  round limit
+//   varint  byte length of the choice stream, then every choice zigzag
+//           encoded as a varint, in the order the policies were asked
+//   u64     final state hash (finalStateHash)
+//
+// u64 fields are little-endian. A random duel takes about 30 bytes.
+// Replaying a record needs nothing but the World: the choices are fed back
+// to the DuelEngine and the state it ends in is compared to the recorded one.
+
+const char REPLAY_MAGIC[6] = {'T', 'K', 'R', 'P', 'L', 'Y'};
+const uint16_t REPLAY_VERSION = 1;
+const size_t REPLAY_HEADER_SIZE = 8;
+
+// 64-bit mixing hash over the fields fed to it
+class StateHasher {
+    uint64_t h;
+public:
+    StateHasher() : h(0x6A09E667F3BCC909ULL) {}
+
+    void add(uint64_t v) {
+        h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+        h = (h ^ (h >> 31)) * 0xBF58476D1CE4E5B9ULL;
+    }
+    void add(double v) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof bits);
+        add(bits);
+    }
+    void add(const std::string& s) {
+        add((uint64_t)s.size());
+        for (unsigned char c : s) add((uint64_t)c);
+    }
+
+    uint64_t value() const { return h; }
+};
+
+inline void hashValueSource(StateHasher& h, const ValueSource& src) {
+    h.add((uint64_t)src.kind);
+    h.add((uint64_t)src.isAttacker);
+    h.add(src.constant);
+}
+
+// Structure and constants of a compiled ability, including the programs of
+// the effects it schedules. Opaque nodes (EXECUTE, EVALUATE) only
+// contribute their C++ type.
+inline void hashProgram(StateHasher& h, const Program& program) {
+    h.add((uint64_t)program.code.size());
+    for (const Instruction& in : program.code) {
+        h.add((uint64_t)in.op);
+        h.add((uint64_t)in.onDefender);
+        h.add((uint64_t)(int64_t)in.target);
+        h.add((uint64_t)(int64_t)in.count);
+        h.add(in.amount);
+        if (in.op == OpCode::FOR_ROUNDS || in.op == OpCode::AFTER_ROUNDS || in.op == OpCode::EXECUTE) {
+            const Command& cmd = *program.commands[in.index];
+            const CompiledCommand* compiled = dynamic_cast<const CompiledCommand*>(&cmd);
+            if (compiled) hashProgram(h, compiled->program);
+            else h.add(std::string(typeid(cmd).name()));
+        }
+    }
+    h.add((uint64_t)program.conditionCode.size());
+    for (const CondInstruction& c : program.conditionCode) {
+        h.add((uint64_t)c.op);
+        h.add((uint64_t)c.cmp);
+        h.add((uint64_t)c.value);
+        h.add((uint64_t)(int64_t)c.target);
+        hashValueSource(h, c.lhs);
+        hashValueSource(h, c.rhs);
+        if (c.op == CondOp::SYMBOL_COMPARE) h.add(symbolText(c.symbol));
+        if (c.op == CondOp::EVALUATE) h.add(std::string(typeid(*program.conditions[c.index]).name()));
+    }
+}
+
+// Everything a duel in `world` depends on: fighters in id order with their
+// abilities, and the type rules between their archetypes. Two worlds with
+// the same hash replay each other's logs.
+inline uint64_t rulesetHash(const World& world) {
+    StateHasher h;
+    std::vector<uint8_t> types;
+    h.add((uint64_t)world.fighterCount());
+    for (FighterId id = 0; id < world.fighterCount(); id++) {
+        const Fighter& f = world.fighter(id);
+        h.add(f.name);
+        h.add(f.type);
+        h.add(f.maxHP);
+        h.add((uint64_t)f.abilities.size());
+        for (const auto& ability : f.abilities) {
+            h.add(ability->name);
+            hashProgram(h, ability->program.empty() ? AbilityCompiler::compile(ability->action) : ability->program);
+        }
+        if (std::find(types.begin(), types.end(), f.archetype) == types.end()) types.push_back(f.archetype);
+    }
+    std::sort(types.begin(), types.end());
+    const ArchetypeTable& table = archetypes();
+    for (uint8_t a : types) {
+        h.add(table.healFraction(a));
+        for (uint8_t d : types) {
+            for (int parity = 0; parity < 2; parity++) {
+                const DamageModifier& m = table.modifier(a, d, parity);
+                h.add(m.attack);
+                h.add(m.defense);
+            }
+        }
+    }
+    return h.value();
+}
+
+// State the engine's last duel ended in
+inline uint64_t finalStateHash(const DuelEngine& engine, const DuelResult& r) {
+    StateHasher h;
+    h.add((uint64_t)r.winner);
+    h.add((uint64_t)r.rounds);
+    for (int player = 1; player <= 2; player++) {
+        const Fighter& f = engine.fighter(player);
+        h.add(f.currentHP);
+        h.add((uint64_t)f.inRing);
+        h.add((uint64_t)f.delayedCommands.turn());
+        h.add((uint64_t)f.delayedCommands.size());
+        h.add((uint64_t)f.recurringCommands.turn());
+        h.add((uint64_t)f.recurringCommands.size());
+    }
+    return h.value();
+}
+
+// ---------- Encoding ----------
+
+inline void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+inline void putU64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; i++) out.push_back((char)(v >> (8 * i)));
+}
+
+inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+// Reads a varint at p, not past end; nullptr if it is truncated or too long
+inline const uint8_t* getVarint(const uint8_t* p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return p;
+    }
+    return nullptr;
+}
+
+inline uint64_t getU64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// Buffers records and writes them to `out` in large blocks
+class ReplayWriter {
+public:
+    explicit ReplayWriter(std::ostream& o, size_t flushAt = 1 << 16) : out(o), threshold(flushAt), count(0) {
+        buffer.append(REPLAY_MAGIC, sizeof REPLAY_MAGIC);
+        buffer.push_back((char)(REPLAY_VERSION & 0xFF));
+        buffer.push_back((char)(REPLAY_VERSION >> 8));
+    }
+    ~ReplayWriter() { flush(); }
+
+    void add(uint64_t ruleset, FighterId fighter1, FighterId fighter2, int maxRounds,
+             const std::vector<int>& choices, uint64_t finalHash) {
+        putU64(buffer, ruleset);
+        putVarint(buffer, fighter1);
+        putVarint(buffer, fighter2);
+        putVarint(buffer, (uint64_t)maxRounds);
+        stream.clear();
+        for (int c : choices) putVarint(stream, zigzag(c));
+        putVarint(buffer, stream.size());
+        buffer += stream;
+        putU64(buffer, finalHash);
+        count++;
+        if (buffer.size() >= threshold) flush();
+    }
+
+    void flush() {
+        if (buffer.empty()) return;
+        out.write(buffer.data(), (std::streamsize)buffer.size());
+        buffer.clear();
+    }
+
+    long records() const { return count; }
+
+private:
+    std::ostream& out;
+    size_t threshold;
+    std::string buffer;
+    std::string stream;
+    long count;
+};
+
+// Plays duels between fighters of a World and logs them. The ruleset hash
+// is taken once, so the world must not change while recording.
+class ReplayRecorder {
+public:
+    ReplayRecorder(const World& w, ReplayWriter& out, int maxRounds = 1000)
+        : world(w), writer(out), engine(maxRounds), ruleset(rulesetHash(w)) {
+        engine.setChoiceLog(&choices);
+    }
+
+    DuelResult run(FighterId fighter1, FighterId fighter2, AbilityPolicy& p1, AbilityPolicy& p2) {
+        choices.clear();
+        DuelResult r = engine.run(world.fighter(fighter1), world.fighter(fighter2), p1, p2);
+        writer.add(ruleset, fighter1, fighter2, engine.roundLimit(), choices, finalStateHash(engine, r));
+        return r;
+    }
+
+private:
+    const World& world;
+    ReplayWriter& writer;
+    DuelEngine engine;
+    uint64_t ruleset;
+    std::vector<int> choices;
+};
+
+// ---------- Reading ----------
+
+struct ReplayRecord {
+    uint64_t ruleset;
+    FighterId fighter1;
+    FighterId fighter2;
+    int maxRounds;
+    const uint8_t* choices;     // varint stream, points into the log
+    const uint8_t* choicesEnd;
+    uint64_t finalHash;
+};
+
+// Walks the records of a log held in memory, without copying
+class ReplayReader {
+public:
+    ReplayReader(const uint8_t* data, size_t size) : begin(data), pos(data), end(data + size) {
+        if (size < REPLAY_HEADER_SIZE || std::memcmp(data, REPLAY_MAGIC, sizeof REPLAY_MAGIC) != 0) {
+            throw std::runtime_error("Not a replay log");
+        }
+        if ((uint16_t)(data[6] | data[7] << 8) != REPLAY_VERSION) {
+            throw std::runtime_error("Unsupported replay log version");
+        }
+        pos += REPLAY_HEADER_SIZE;
+    }
+    explicit ReplayReader(const MappedFile& file) : ReplayReader(file.data(), file.size()) {}
+
+    // False at the end of the log; throws on a truncated record
+    bool next(ReplayRecord& r) {
+        if (pos == end) return false;
+        uint64_t fighter1, fighter2, maxRounds, length;
+        const uint8_t* p = pos;
+        if (end - p < 8) corrupt();
+        r.ruleset = getU64(p);
+        p += 8;
+        if (!(p = getVarint(p, end, fighter1)) || !(p = getVarint(p, end, fighter2)) ||
+            !(p = getVarint(p, end, maxRounds)) || !(p = getVarint(p, end, length))) corrupt();
+        if ((uint64_t)(end - p) < length || (uint64_t)(end - p) - length < 8) corrupt();
+        r.fighter1 = (FighterId)fighter1;
+        r.fighter2 = (FighterId)fighter2;
+        r.maxRounds = (int)maxRounds;
+        r.choices = p;
+        r.choicesEnd = p + length;
+        r.finalHash = getU64(r.choicesEnd);
+        pos = r.choicesEnd + 8;
+        return true;
+    }
+
+    // Byte offset of the next record, for splitting a log between threads
+    size_t offset() const { return (size_t)(pos - begin); }
+    void seek(size_t offset) {
+        pos = begin + std::min(std::max(offset, REPLAY_HEADER_SIZE), (size_t)(end - begin));
+    }
+
+private:
+    const uint8_t* begin;
+    const uint8_t* pos;
+    const uint8_t* end;
+
+    static void corrupt() { throw std::runtime_error("Truncated replay record"); }
+};
+
+enum class ReplayStatus {
+    OK,             // same final state
+    MISMATCH,       // different final state, or a different number of choices
+    WRONG_RULESET,  // recorded in a world with another ruleset hash
+    BAD_RECORD      // fighter ids out of range or unreadable choices
+};
+
+// Re-simulates records on a World with the engine's event sink off
+class Replayer {
+public:
+    explicit Replayer(const World& w)
+        : world(w), ruleset(rulesetHash(w)), cursor(), player1(cursor), player2(cursor) {}
+
+    ReplayStatus replay(const ReplayRecord& r, DuelResult* result = nullptr) {
+        if (r.ruleset != ruleset) return ReplayStatus::WRONG_RULESET;
+        if (r.fighter1 >= world.fighterCount() || r.fighter2 >= world.fighterCount()) {
+            return ReplayStatus::BAD_RECORD;
+        }
+        cursor.pos = r.choices;
+        cursor.end = r.choicesEnd;
+        cursor.failed = false;
+        engine.setMaxRounds(r.maxRounds);
+        DuelResult d = engine.run(world.fighter(r.fighter1), world.fighter(r.fighter2), player1, player2);
+        if (result) *result = d;
+        if (cursor.failed) return cursor.pos ? ReplayStatus::MISMATCH : ReplayStatus::BAD_RECORD;
+        if (cursor.pos != cursor.end) return ReplayStatus::MISMATCH;
+        return finalStateHash(engine, d) == r.finalHash ? ReplayStatus::OK : ReplayStatus::MISMATCH;
+    }
+
+private:
+    // Both players read the same stream: choices were logged in turn order
+    struct Cursor {
+        const uint8_t* pos;
+        const uint8_t* end;
+        bool failed;    // ran out of choices (pos set) or hit a bad varint (pos null)
+    };
+
+    class ReplayPolicy : public AbilityPolicy {
+        Cursor& cursor;
+    public:
+        explicit ReplayPolicy(Cursor& c) : cursor(c) {}
+
+        int choose(Fighter*, Fighter*, const AbilityList&, int) override {
+            if (cursor.failed || cursor.pos == cursor.end) {
+                cursor.failed = true;
+                return -1;
+            }
+            uint64_t v;
+            cursor.pos = getVarint(cursor.pos, cursor.end, v);
+            if (!cursor.pos) {
+                cursor.failed = true;
+                return -1;
+            }
+            return (int)unzigzag(v);
+        }
+    };
+
+    const World& world;
+    uint64_t ruleset;
+    DuelEngine engine;
+    Cursor cursor;
+    ReplayPolicy player1;
+    ReplayPolicy player2;
+};
+
+#endif // REPLAY_H
@@ -0,0 +1,984 @@
+#ifndef RULESET_H
+#define RULESET_H
+
+#include "Tekken.h"
+#include "MappedFile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+// ========== RULESET FILES ==========
+//
+// A roster in text, with everything the DSL macros can build (see
+// roster.tkr). One statement per line; expressions may continue onto the
+// next lines while a bracket is open. '#' starts a comment.
+//
+//   type <Type> [heal <fraction>]                   defineArchetype
+//   matchup <Attacker> <Defender> <odd> [<even>]    setTypeMatchup
+//   ability <Name> = <command>                      createAbility
+//   fighter <Name> <Type> <hp> [: <Ability>, ...]   createFighter + teachAbility
+//   teach <Fighter> <Ability>, ...                  teachAbility
+//
+//   command: DAMAGE_DEFENDER(n)  DAMAGE_ATTACKER(n)  HEAL_DEFENDER(n)  HEAL_ATTACKER(n)
+//            TAG_DEFENDER_OUT  TAG_DEFENDER_IN  TAG_ATTACKER_OUT  TAG_ATTACKER_IN
+//            FOR_ROUNDS(n, command)  AFTER_ROUNDS(n, command)
+//            IF_THEN(condition, command)  IF_THEN_ELSE(condition, command, command)
+//            SHOW("text" | GET_HP(side) | GET_TYPE(side) | GET_NAME(side), ...)
+//            { command; command ... }                          (CompositeCommand)
+//   condition: AND(c, c, ...)  OR(c, c, ...)  NOT(c)  IS_OUT_OF_RING(side)  true  false
+//            <number | GET_HP(side)> <op> <number | GET_HP(side)>   op: == != < <= > >=
+//            <GET_TYPE(side) | GET_NAME(side)> <== | !=> "text"
+//   side: ATTACKER | DEFENDER
+//
+// Names are identifiers (letters, digits, '_', '-') or quoted strings.
+// Abilities may be taught before they are defined. Errors throw
+// std::runtime_error with the file and line.
+
+struct RulesetShowPart {
+    enum Kind : uint8_t { TEXT, HP, TYPE, NAME };
+    Kind kind;
+    bool isAttacker;
+    std::string text;
+};
+
+// The same ShowCommand the ShowBuilder code would make
+inline std::shared_ptr<Command> buildShow(const std::vector<RulesetShowPart>& parts) {
+    ShowBuilder show;
+    for (const RulesetShowPart& part : parts) {
+        switch (part.kind) {
+            case RulesetShowPart::TEXT: show << part.text; break;
+            case RulesetShowPart::HP: show << GET_HP(part.isAttacker); break;
+            case RulesetShowPart::TYPE: show << GET_TYPE(part.isAttacker); break;
+            case RulesetShowPart::NAME: show << GET_NAME(part.isAttacker); break;
+        }
+    }
+    return show.build();
+}
+
+// A parsed ruleset file, not yet in any World
+class Ruleset {
+public:
+    struct TypeRule {
+        bool matchup;           // false: type definition
+        std::string attacker;   // the type, for a definition
+        std::string defender;
+        double odd;             // even-round heal, for a definition
+        double even;
+    };
+    struct Lesson {
+        std::string ability;
+        int line;
+    };
+    struct FighterDef {
+        std::string name;
+        std::string type;
+        double hp;
+        std::vector<Lesson> lessons;
+    };
+    struct AbilityDef {
+        std::string name;
+        std::shared_ptr<Command> action;
+    };
+
+    std::vector<TypeRule> typeRules;
+    std::vector<AbilityDef> abilities;
+    std::vector<FighterDef> fighters;
+    std::map<const Command*, std::vector<RulesetShowPart>> shows;     // parts of each SHOW node
+
+    static Ruleset parse(const std::string& text, const std::string& source = "ruleset");
+    static Ruleset parseFile(const std::string& path);
+
+    // Type rules first, then abilities, fighters and lessons in file order
+    void apply(World& world) const;
+
+    // Compiled form for loadRulesetCache; sourceHash identifies the text
+    void writeCache(std::ostream& out, uint64_t sourceHash) const;
+};
+
+// Hash of a ruleset text, stored in its cache. Eight bytes per step: it
+// runs on every startup.
+inline uint64_t rulesetSourceHash(const std::string& text) {
+    uint64_t h = 0xCBF29CE484222325ULL ^ text.size();
+    size_t i = 0;
+    for (; i + 8 <= text.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, text.data() + i, sizeof word);
+        h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    for (; i < text.size(); i++) {
+        h = (h ^ (unsigned char)text[i]) * 0x100000001B3ULL;
+    }
+    return h ^ (h >> 32);
+}
+
+inline std::string readRulesetText(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Cannot open '" + path + "'");
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// ---------- Parser ----------
+
+struct RulesetToken {
+    enum Kind { NAME, NUMBER, STRING, SYMBOL, NEWLINE, END };
+    Kind kind;
+    std::string text;
+    double number;
+    int line;
+};
+
+class RulesetParser {
+public:
+    RulesetParser(const std::string& text, const std::string& sourceName, Ruleset& result)
+        : source(sourceName), out(result), pos(0) {
+        tokenize(text);
+    }
+
+    void parse() {
+        while (peek().kind != RulesetToken::END) {
+            if (peek().kind == RulesetToken::NEWLINE) {
+                pos++;
+                continue;
+            }
+            statement();
+            if (peek().kind != RulesetToken::END) expect(RulesetToken::NEWLINE, "end of line");
+        }
+        for (const Ruleset::FighterDef& f : out.fighters) {
+            for (const Ruleset::Lesson& lesson : f.lessons) {
+                if (!abilityNames.count(lesson.ability)) {
+                    fail(lesson.line, "unknown ability '" + lesson.ability + "'");
+                }
+            }
+        }
+    }
+
+private:
+    std::string source;
+    Ruleset& out;
+    std::vector<RulesetToken> tokens;
+    size_t pos;
+    std::set<std::string> abilityNames;
+    std::map<std::string, size_t> fighterIndex;
+
+    [[noreturn]] void fail(int line, const std::string& message) const {
+        throw std::runtime_error(source + ":" + std::to_string(line) + ": " + message);
+    }
+    [[noreturn]] void fail(const std::string& message) const { fail(peek().line, message); }
+
+    // Newlines only end statements outside brackets
+    void tokenize(const std::string& text) {
+        int line = 1, depth = 0;
+        size_t i = 0, n = text.size();
+        auto push = [&](RulesetToken::Kind kind, const std::string& s, double number) {
+            RulesetToken t = {kind, s, number, line};
+            tokens.push_back(t);
+        };
+        while (i < n) {
+            char c = text[i];
+            if (c == '\n') {
+                if (depth == 0) push(RulesetToken::NEWLINE, "", 0);
+                line++;
+                i++;
+            } else if (c == ' ' || c == '\t' || c == '\r') {
+                i++;
+            } else if (c == '#') {
+                while (i < n && text[i] != '\n') i++;
+            } else if (c == '"') {
+                std::string s;
+                for (i++; i < n && text[i] != '"'; i++) {
+                    if (text[i] == '\n') fail(line, "unterminated string");
+                    if (text[i] == '\\' && i + 1 < n) i++;
+                    s += text[i];
+                }
+                if (i == n) fail(line, "unterminated string");
+                i++;
+                push(RulesetToken::STRING, s, 0);
+            } else if (isdigit((unsigned char)c) || ((c == '-' || c == '+' || c == '.') && i + 1 < n &&
+                                                     (isdigit((unsigned char)text[i + 1]) || text[i + 1] == '.'))) {
+                const char* start = text.c_str() + i;
+                char* end;
+                double v = strtod(start, &end);
+                if (end == start) fail(line, "bad number");
+                push(RulesetToken::NUMBER, std::string(start, (const char*)end), v);
+                i += end - start;
+            } else if (isalpha((unsigned char)c) || c == '_') {
+                size_t start = i;
+                while (i < n && (isalnum((unsigned char)text[i]) || text[i] == '_' || text[i] == '-')) i++;
+                push(RulesetToken::NAME, text.substr(start, i - start), 0);
+            } else {
+                static const char* const symbols[] = {"==", "!=", "<=", ">=", "<", ">", "(", ")", "{", "}",
+                                                      ",", ";", ":", "="};
+                const char* match = nullptr;
+                for (const char* s : symbols) {
+                    if (text.compare(i, strlen(s), s) == 0) {
+                        match = s;
+                        break;
+                    }
+                }
+                if (!match) fail(line, std::string("unexpected character '") + c + "'");
+                if (*match == '(' || *match == '{') depth++;
+                if ((*match == ')' || *match == '}') && depth > 0) depth--;
+                push(RulesetToken::SYMBOL, match, 0);
+                i += strlen(match);
+            }
+        }
+        push(RulesetToken::END, "", 0);
+    }
+
+    const RulesetToken& peek() const { return tokens[pos]; }
+    const RulesetToken& next() { return tokens[pos++]; }
+
+    static std::string describe(const RulesetToken& t) {
+        switch (t.kind) {
+            case RulesetToken::NEWLINE: return "end of line";
+            case RulesetToken::END: return "end of file";
+            case RulesetToken::STRING: return "\"" + t.text + "\"";
+            default: return "'" + t.text + "'";
+        }
+    }
+
+    void expect(RulesetToken::Kind kind, const char* what) {
+        if (peek().kind != kind) fail(std::string("expected ") + what + ", found " + describe(peek()));
+        pos++;
+    }
+    bool accept(const char* symbol) {
+        if (peek().kind == RulesetToken::SYMBOL && peek().text == symbol) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+    void expect(const char* symbol) {
+        if (!accept(symbol)) fail(std::string("expected '") + symbol + "', found " + describe(peek()));
+    }
+    bool acceptWord(const char* word) {
+        if (peek().kind == RulesetToken::NAME && peek().text == word) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    std::string name(const char* what) {
+        if (peek().kind != RulesetToken::NAME && peek().kind != RulesetToken::STRING) {
+            fail(std::string("expected ") + what + ", found " + describe(peek()));
+        }
+        return next().text;
+    }
+    double number() {
+        if (peek().kind != RulesetToken::NUMBER) fail("expected a number, found " + describe(peek()));
+        return next().number;
+    }
+    int rounds() {
+        double v = number();
+        if (v != (int)v) fail(tokens[pos - 1].line, "round count must be a whole number");
+        return (int)v;
+    }
+    bool side() {
+        if (acceptWord("ATTACKER")) return ATTACKER;
+        if (acceptWord("DEFENDER")) return DEFENDER;
+        fail("expected ATTACKER or DEFENDER, found " + describe(peek()));
+    }
+    bool sideArgument() {
+        expect("(");
+        bool s = side();
+        expect(")");
+        return s;
+    }
+
+    void statement() {
+        int line = peek().line;
+        std::string keyword = name("a statement");
+        if (keyword == "type") {
+            Ruleset::TypeRule rule = {false, name("a type"), "", 0.0, 0.0};
+            if (acceptWord("heal")) rule.odd = number();
+            out.typeRules.push_back(rule);
+        } else if (keyword == "matchup") {
+            Ruleset::TypeRule rule = {true, name("an attacker type"), name("a defender type"), 0.0, 0.0};
+            rule.odd = number();
+            rule.even = peek().kind == RulesetToken::NUMBER ? number() : rule.odd;
+            out.typeRules.push_back(rule);
+        } else if (keyword == "ability") {
+            Ruleset::AbilityDef def;
+            def.name = name("an ability name");
+            if (!abilityNames.insert(def.name).second) fail(line, "ability '" + def.name + "' is defined twice");
+            expect("=");
+            def.action = command();
+            out.abilities.push_back(def);
+        } else if (keyword == "fighter") {
+            Ruleset::FighterDef def;
+            def.name = name("a fighter name");
+            if (fighterIndex.count(def.name)) fail(line, "fighter '" + def.name + "' is defined twice");
+            def.type = name("a type");
+            def.hp = number();
+            fighterIndex[def.name] = out.fighters.size();
+            out.fighters.push_back(def);
+            if (accept(":")) lessons(out.fighters.back());
+        } else if (keyword == "teach") {
+            std::string fighter = name("a fighter name");
+            auto it = fighterIndex.find(fighter);
+            if (it == fighterIndex.end()) fail(line, "unknown fighter '" + fighter + "'");
+            lessons(out.fighters[it->second]);
+        } else {
+            fail(line, "unknown statement '" + keyword + "'");
+        }
+    }
+
+    void lessons(Ruleset::FighterDef& fighter) {
+        do {
+            int line = peek().line;
+            Ruleset::Lesson lesson = {name("an ability name"), line};
+            fighter.lessons.push_back(lesson);
+        } while (accept(","));
+    }
+
+    std::shared_ptr<Command> command() {
+        if (accept("{")) {
+            auto composite = std::make_shared<CompositeCommand>();
+            while (!accept("}")) {
+                if (accept(";") || accept(",")) continue;
+                composite->add(command());
+            }
+            return composite;
+        }
+        int line = peek().line;
+        std::string word = name("a command");
+        if (word == "DAMAGE_DEFENDER" || word == "DAMAGE_ATTACKER" ||
+            word == "HEAL_DEFENDER" || word == "HEAL_ATTACKER") {
+            expect("(");
+            double amount = number();
+            expect(")");
+            if (word == "DAMAGE_DEFENDER") return DAMAGE_DEFENDER(amount);
+            if (word == "DAMAGE_ATTACKER") return DAMAGE_ATTACKER(amount);
+            if (word == "HEAL_DEFENDER") return HEAL_DEFENDER(amount);
+            return HEAL_ATTACKER(amount);
+        }
+        if (word == "TAG_DEFENDER_OUT") return TAG_DEFENDER_OUT;
+        if (word == "TAG_DEFENDER_IN") return TAG_DEFENDER_IN;
+        if (word == "TAG_ATTACKER_OUT") return TAG_ATTACKER_OUT;
+        if (word == "TAG_ATTACKER_IN") return TAG_ATTACKER_IN;
+        if (word == "FOR_ROUNDS" || word == "AFTER_ROUNDS") {
+            expect("(");
+            int n = rounds();
+            expect(",");
+            std::shared_ptr<Command> body = command();
+            expect(")");
+            if (word == "FOR_ROUNDS") return FOR_ROUNDS(n, body);
+            return AFTER_ROUNDS(n, body);
+        }
+        if (word == "IF_THEN" || word == "IF_THEN_ELSE") {
+            expect("(");
+            std::shared_ptr<ConditionExpr> cond = condition();
+            expect(",");
+            std::shared_ptr<Command> thenCmd = command();
+            std::shared_ptr<Command> elseCmd;
+            if (word == "IF_THEN_ELSE") {
+                expect(",");
+                elseCmd = command();
+            }
+            expect(")");
+            return elseCmd ? IF_THEN_ELSE(cond, thenCmd, elseCmd) : IF_THEN(cond, thenCmd);
+        }
+        if (word == "SHOW") {
+            std::vector<RulesetShowPart> parts;
+            expect("(");
+            do {
+                RulesetShowPart part = {RulesetShowPart::TEXT, false, ""};
+                if (peek().kind == RulesetToken::STRING) {
+                    part.text = next().text;
+                } else {
+                    std::string value = name("text or a value");
+                    if (value == "GET_HP") part.kind = RulesetShowPart::HP;
+                    else if (value == "GET_TYPE") part.kind = RulesetShowPart::TYPE;
+                    else if (value == "GET_NAME") part.kind = RulesetShowPart::NAME;
+                    else fail(tokens[pos - 1].line, "SHOW takes text, GET_HP, GET_TYPE or GET_NAME");
+                    part.isAttacker = sideArgument();
+                }
+                parts.push_back(part);
+            } while (accept(","));
+            expect(")");
+            std::shared_ptr<Command> show = buildShow(parts);
+            out.shows[show.get()] = parts;
+            return show;
+        }
+        fail(line, "unknown command '" + word + "'");
+    }
+
+    std::shared_ptr<ConditionExpr> condition() {
+        int line = peek().line;
+        if (peek().kind == RulesetToken::NUMBER) return numericComparison(NumericValue(number()));
+        std::string word = name("a condition");
+        if (word == "AND" || word == "OR") {
+            std::vector<std::shared_ptr<ConditionExpr>> operands;
+            expect("(");
+            do operands.push_back(condition()); while (accept(","));
+            expect(")");
+            if (word == "AND") {
+                auto expr = std::make_shared<AndExpr>();
+                for (auto& c : operands) expr->add(c);
+                return expr;
+            }
+            auto expr = std::make_shared<OrExpr>();
+            for (auto& c : operands) expr->add(c);
+            return expr;
+        }
+        if (word == "NOT") {
+            expect("(");
+            std::shared_ptr<ConditionExpr> c = condition();
+            expect(")");
+            return NOT(c);
+        }
+        if (word == "true" || word == "false") return BoolValue(word == "true").toCondition();
+        if (word == "IS_OUT_OF_RING") return IS_OUT_OF_RING(sideArgument()).toCondition();
+        if (word == "GET_HP") return numericComparison(GET_HP(sideArgument()));
+        if (word == "GET_TYPE" || word == "GET_NAME") {
+            StringValue value = word == "GET_TYPE" ? GET_TYPE(sideArgument()) : GET_NAME(sideArgument());
+            if (accept("==")) return value == name("a name");
+            if (accept("!=")) return value != name("a name");
+            fail("expected '==' or '!=', found " + describe(peek()));
+        }
+        fail(line, "unknown condition '" + word + "'");
+    }
+
+    NumericValue numericValue() {
+        if (peek().kind == RulesetToken::NUMBER) return NumericValue(number());
+        if (acceptWord("GET_HP")) return GET_HP(sideArgument());
+        fail("expected a number or GET_HP, found " + describe(peek()));
+    }
+
+    std::shared_ptr<ConditionExpr> numericComparison(const NumericValue& lhs) {
+        if (accept("==")) return lhs == numericValue();
+        if (accept("!=")) return lhs != numericValue();
+        if (accept("<=")) return lhs <= numericValue();
+        if (accept(">=")) return lhs >= numericValue();
+        if (accept("<")) return lhs < numericValue();
+        if (accept(">")) return lhs > numericValue();
+        fail("expected a comparison, found " + describe(peek()));
+    }
+};
+
+inline Ruleset Ruleset::parse(const std::string& text, const std::string& source) {
+    Ruleset ruleset;
+    RulesetParser(text, source, ruleset).parse();
+    return ruleset;
+}
+
+inline Ruleset Ruleset::parseFile(const std::string& path) {
+    return parse(readRulesetText(path), path);
+}
+
+inline void Ruleset::apply(World& world) const {
+    for (const TypeRule& rule : typeRules) {
+        if (rule.matchup) setTypeMatchup(rule.attacker, rule.defender, rule.odd, rule.even);
+        else defineArchetype(rule.attacker, rule.odd);
+    }
+    for (const AbilityDef& a : abilities) world.createAbility(a.name, a.action);
+    for (const FighterDef& f : fighters) world.createFighter(f.name, f.type, f.hp);
+    for (const FighterDef& f : fighters) {
+        for (const Lesson& lesson : f.lessons) world.teach(f.name, lesson.ability);
+    }
+}
+
+// ---------- Binary cache ----------
+//
+// The compiled ruleset as flat tables: the bytecode of every program in two
+// arrays of Instruction/CondInstruction, in this build's struct layout, so
+// loaded abilities run straight from the mapping. Loading makes the World
+// objects (fighters, abilities, one CompiledCommand per scheduled effect and
+// the SHOW nodes) and interns the symbols of type/name comparisons, which
+// are patched into the copy-on-write mapping. Nothing is parsed and the
+// command trees are never built.
+
+const char RULESET_CACHE_MAGIC[8] = {'T', 'K', 'R', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t RULESET_CACHE_VERSION = 1;
+const uint32_t RULESET_CACHE_BYTE_ORDER = 0x01020304;
+
+enum RulesetCacheTable : uint32_t {
+    CACHE_CHARS, CACHE_STRINGS, CACHE_TYPE_RULES, CACHE_CODE, CACHE_CONDITIONS, CACHE_SYMBOLS,
+    CACHE_COMMANDS, CACHE_PROGRAMS, CACHE_SHOW_PARTS, CACHE_SHOWS, CACHE_ABILITIES, CACHE_FIGHTERS,
+    CACHE_LESSONS, CACHE_TABLE_COUNT
+};
+
+struct CachedTable {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct CachedHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t instructionSize;
+    uint32_t conditionSize;
+    uint64_t sourceHash;
+    uint64_t fileSize;
+    CachedTable tables[CACHE_TABLE_COUNT];
+};
+
+struct CachedString { uint32_t offset, length; };
+struct CachedTypeRule { uint32_t matchup, attacker, defender, pad; double odd, even; };
+struct CachedSymbol { uint32_t condition, text; };      // conditions[condition].symbol = internSymbol(text)
+struct CachedCommand { enum : uint32_t { PROGRAM, SHOW }; uint32_t kind, ref; };
+struct CachedProgram { uint32_t code, codeCount, conditions, conditionCount, commands, commandCount; };
+struct CachedShowPart { uint32_t kind, isAttacker, text; };
+struct CachedShow { uint32_t parts, partCount; };
+struct CachedAbility { uint32_t name, program; };
+struct CachedFighter { uint32_t name, type; double hp; uint32_t lessons, lessonCount; };
+
+class RulesetCacheWriter {
+public:
+    explicit RulesetCacheWriter(const Ruleset& r) : ruleset(r) {}
+
+    void write(std::ostream& out, uint64_t sourceHash) {
+        for (const Ruleset::TypeRule& rule : ruleset.typeRules) {
+            CachedTypeRule t = {rule.matchup, string(rule.attacker), string(rule.defender), 0, rule.odd, rule.even};
+            typeRules.push_back(t);
+        }
+        std::map<std::string, uint32_t> abilityIndex;
+        for (const Ruleset::AbilityDef& a : ruleset.abilities) {
+            abilityIndex[a.name] = (uint32_t)abilities.size();
+            CachedAbility c = {string(a.name), addProgram(AbilityCompiler::compile(optimizeAbility(a.name, a.action)))};
+            abilities.push_back(c);
+        }
+        for (const Ruleset::FighterDef& f : ruleset.fighters) {
+            CachedFighter c = {string(f.name), string(f.type), f.hp, (uint32_t)lessons.size(), (uint32_t)f.lessons.size()};
+            for (const Ruleset::Lesson& lesson : f.lessons) lessons.push_back(abilityIndex.at(lesson.ability));
+            fighters.push_back(c);
+        }
+
+        CachedHeader header;
+        std::memset(&header, 0, sizeof header);
+        std::memcpy(header.magic, RULESET_CACHE_MAGIC, sizeof header.magic);
+        header.version = RULESET_CACHE_VERSION;
+        header.byteOrder = RULESET_CACHE_BYTE_ORDER;
+        header.instructionSize = sizeof(Instruction);
+        header.conditionSize = sizeof(CondInstruction);
+        header.sourceHash = sourceHash;
+
+        std::string file(sizeof header, '\0');
+        table(file, header, CACHE_CHARS, chars);
+        table(file, header, CACHE_STRINGS, strings);
+        table(file, header, CACHE_TYPE_RULES, typeRules);
+        table(file, header, CACHE_CODE, code);
+        table(file, header, CACHE_CONDITIONS, conditions);
+        table(file, header, CACHE_SYMBOLS, symbols);
+        table(file, header, CACHE_COMMANDS, commands);
+        table(file, header, CACHE_PROGRAMS, programs);
+        table(file, header, CACHE_SHOW_PARTS, showParts);
+        table(file, header, CACHE_SHOWS, shows);
+        table(file, header, CACHE_ABILITIES, abilities);
+        table(file, header, CACHE_FIGHTERS, fighters);
+        table(file, header, CACHE_LESSONS, lessons);
+        header.fileSize = file.size();
+        std::memcpy(&file[0], &header, sizeof header);
+        out.write(file.data(), (std::streamsize)file.size());
+    }
+
+private:
+    const Ruleset& ruleset;
+    std::vector<char> chars;
+    std::vector<CachedString> strings;
+    std::map<std::string, uint32_t> stringIndex;
+    std::vector<CachedTypeRule> typeRules;
+    std::vector<Instruction> code;
+    std::vector<CondInstruction> conditions;
+    std::vector<CachedSymbol> symbols;
+    std::vector<CachedCommand> commands;
+    std::vector<CachedProgram> programs;
+    std::vector<CachedShowPart> showParts;
+    std::vector<CachedShow> shows;
+    std::vector<CachedAbility> abilities;
+    std::vector<CachedFighter> fighters;
+    std::vector<uint32_t> lessons;
+
+    uint32_t string(const std::string& s) {
+        auto it = stringIndex.find(s);
+        if (it != stringIndex.end()) return it->second;
+        CachedString c = {(uint32_t)chars.size(), (uint32_t)s.size()};
+        chars.insert(chars.end(), s.begin(), s.end());
+        strings.push_back(c);
+        return stringIndex[s] = (uint32_t)strings.size() - 1;
+    }
+
+    // Copies field by field so that padding bytes are zero and the file is
+    // the same on every run
+    static Instruction clean(const Instruction& in) {
+        Instruction c;
+        std::memset(&c, 0, sizeof c);
+        c.op = in.op;
+        c.onDefender = in.onDefender;
+        c.index = in.index;
+        c.target = in.target;
+        c.count = in.count;
+        c.amount = in.amount;
+        return c;
+    }
+    static CondInstruction clean(const CondInstruction& in) {
+        CondInstruction c;
+        std::memset(&c, 0, sizeof c);
+        c.op = in.op;
+        c.cmp = in.cmp;
+        c.value = in.value;
+        c.index = in.index;
+        c.target = in.target;
+        c.lhs.kind = in.lhs.kind;
+        c.lhs.isAttacker = in.lhs.isAttacker;
+        c.lhs.constant = in.lhs.constant;
+        c.rhs.kind = in.rhs.kind;
+        c.rhs.isAttacker = in.rhs.isAttacker;
+        c.rhs.constant = in.rhs.constant;
+        return c;
+    }
+
+    // Nested programs come after the program that schedules them
+    uint32_t addProgram(const Program& program) {
+        uint32_t id = (uint32_t)programs.size();
+        programs.emplace_back();
+        CachedProgram p = {(uint32_t)code.size(), (uint32_t)program.code.size(),
+                           (uint32_t)conditions.size(), (uint32_t)program.conditionCode.size(), 0, 0};
+        for (const Instruction& in : program.code) code.push_back(clean(in));
+        for (size_t i = 0; i < program.conditionCode.size(); i++) {
+            const CondInstruction& in = program.conditionCode[i];
+            if (in.op == CondOp::EVALUATE) throw std::invalid_argument("Ruleset cache: lambda conditions are not supported");
+            if (in.op == CondOp::SYMBOL_COMPARE) {
+                CachedSymbol s = {p.conditions + (uint32_t)i, string(symbolText(in.symbol))};
+                symbols.push_back(s);
+            }
+            conditions.push_back(clean(in));
+        }
+        std::vector<CachedCommand> local;
+        for (const auto& cmd : program.commands) {
+            CachedCommand c;
+            if (auto compiled = dynamic_cast<const CompiledCommand*>(cmd.get())) {
+                c.kind = CachedCommand::PROGRAM;
+                c.ref = addProgram(compiled->program);
+            } else {
+                auto it = ruleset.shows.find(cmd.get());
+                if (it == ruleset.shows.end()) throw std::invalid_argument("Ruleset cache: user-defined commands are not supported");
+                c.kind = CachedCommand::SHOW;
+                c.ref = addShow(it->second);
+            }
+            local.push_back(c);
+        }
+        p.commands = (uint32_t)commands.size();
+        p.commandCount = (uint32_t)local.size();
+        commands.insert(commands.end(), local.begin(), local.end());
+        programs[id] = p;
+        return id;
+    }
+
+    uint32_t addShow(const std::vector<RulesetShowPart>& parts) {
+        CachedShow show = {(uint32_t)showParts.size(), (uint32_t)parts.size()};
+        for (const RulesetShowPart& part : parts) {
+            CachedShowPart c = {part.kind, part.isAttacker, string(part.text)};
+            showParts.push_back(c);
+        }
+        shows.push_back(show);
+        return (uint32_t)shows.size() - 1;
+    }
+
+    template <typename T>
+    static void table(std::string& file, CachedHeader& header, RulesetCacheTable id, const std::vector<T>& rows) {
+        file.resize((file.size() + 7) & ~(size_t)7, '\0');
+        header.tables[id].offset = file.size();
+        header.tables[id].count = rows.size();
+        if (!rows.empty()) file.append((const char*)rows.data(), rows.size() * sizeof(T));
+    }
+};
+
+inline void Ruleset::writeCache(std::ostream& out, uint64_t sourceHash) const {
+    RulesetCacheWriter(*this).write(out, sourceHash);
+}
+
+class RulesetCacheLoader {
+public:
+    RulesetCacheLoader(const std::string& cachePath, uint64_t expectedSource)
+        : path(cachePath), file(std::make_shared<MappedFile>(cachePath, MappedFile::COPY_ON_WRITE)) {
+        if (file->size() < sizeof(CachedHeader)) invalid("too short");
+        std::memcpy(&header, file->data(), sizeof header);
+        if (std::memcmp(header.magic, RULESET_CACHE_MAGIC, sizeof header.magic) != 0) invalid("not a ruleset cache");
+        if (header.version != RULESET_CACHE_VERSION || header.byteOrder != RULESET_CACHE_BYTE_ORDER ||
+            header.instructionSize != sizeof(Instruction) || header.conditionSize != sizeof(CondInstruction)) {
+            invalid("written by another version or platform");
+        }
+        if (header.fileSize != file->size()) invalid("truncated");
+        if (expectedSource && header.sourceHash != expectedSource) invalid("out of date");
+    }
+
+    // Checks every table first, so that a bad cache leaves the world untouched
+    void load(World& world) {
+        validate();
+        const char* chars = table<char>(CACHE_CHARS);
+        const CachedString* strings = table<CachedString>(CACHE_STRINGS);
+        auto text = [&](uint32_t i) { return std::string(chars + strings[i].offset, strings[i].length); };
+
+        const CachedTypeRule* typeRules = table<CachedTypeRule>(CACHE_TYPE_RULES);
+        for (size_t i = 0; i < count(CACHE_TYPE_RULES); i++) {
+            const CachedTypeRule& rule = typeRules[i];
+            if (rule.matchup) setTypeMatchup(text(rule.attacker), text(rule.defender), rule.odd, rule.even);
+            else defineArchetype(text(rule.attacker), rule.odd);
+        }
+
+        // Symbols of this process, patched into the private pages
+        CondInstruction* conditions = mutableTable<CondInstruction>(CACHE_CONDITIONS);
+        const CachedSymbol* symbols = table<CachedSymbol>(CACHE_SYMBOLS);
+        for (size_t i = 0; i < count(CACHE_SYMBOLS); i++) {
+            conditions[symbols[i].condition].symbol = internSymbol(text(symbols[i].text));
+        }
+
+        const CachedShowPart* parts = table<CachedShowPart>(CACHE_SHOW_PARTS);
+        const CachedShow* showTable = table<CachedShow>(CACHE_SHOWS);
+        std::vector<std::shared_ptr<Command>> shows;
+        for (size_t i = 0; i < count(CACHE_SHOWS); i++) {
+            std::vector<RulesetShowPart> list;
+            for (uint32_t p = showTable[i].parts; p < showTable[i].parts + showTable[i].partCount; p++) {
+                RulesetShowPart part = {(RulesetShowPart::Kind)parts[p].kind, parts[p].isAttacker != 0,
+                                        parts[p].kind == RulesetShowPart::TEXT ? text(parts[p].text) : std::string()};
+                list.push_back(part);
+            }
+            shows.push_back(buildShow(list));
+        }
+
+        // Programs only point to later ones, so building them back to front
+        // finds every scheduled effect made. Those get a CompiledCommand; the
+        // rest start abilities.
+        const CachedProgram* programs = table<CachedProgram>(CACHE_PROGRAMS);
+        const CachedCommand* commands = table<CachedCommand>(CACHE_COMMANDS);
+        const Instruction* code = table<Instruction>(CACHE_CODE);
+        std::vector<bool> scheduled(count(CACHE_PROGRAMS), false);
+        for (size_t c = 0; c < count(CACHE_COMMANDS); c++) {
+            if (commands[c].kind == CachedCommand::PROGRAM) scheduled[commands[c].ref] = true;
+        }
+        std::vector<Program> views(count(CACHE_PROGRAMS));
+        std::vector<std::shared_ptr<Command>> effects(count(CACHE_PROGRAMS));
+        std::shared_ptr<const void> owner = file;
+        for (size_t p = count(CACHE_PROGRAMS); p-- > 0;) {
+            const CachedProgram& cp = programs[p];
+            Program& program = views[p];
+            program.code = CodeBuffer<Instruction>::borrow(code + cp.code, cp.codeCount, owner);
+            program.conditionCode = CodeBuffer<CondInstruction>::borrow(conditions + cp.conditions,
+                                                                        cp.conditionCount, owner);
+            program.commands.reserve(cp.commandCount);
+            for (uint32_t c = cp.commands; c < cp.commands + cp.commandCount; c++) {
+                program.commands.push_back(commands[c].kind == CachedCommand::PROGRAM ? effects[commands[c].ref]
+                                                                                      : shows[commands[c].ref]);
+            }
+            if (scheduled[p]) {
+                auto effect = std::make_shared<CompiledCommand>();
+                effect->program = std::move(program);
+                effects[p] = effect;
+            }
+        }
+
+        const CachedAbility* abilities = table<CachedAbility>(CACHE_ABILITIES);
+        std::vector<AbilityId> abilityIds;
+        for (size_t i = 0; i < count(CACHE_ABILITIES); i++) {
+            std::string name = text(abilities[i].name);
+            world.createAbility(name, std::move(views[abilities[i].program]));
+            abilityIds.push_back(world.abilityId(name));
+        }
+
+        const CachedFighter* fighters = table<CachedFighter>(CACHE_FIGHTERS);
+        const uint32_t* lessons = table<uint32_t>(CACHE_LESSONS);
+        std::vector<FighterId> fighterIds;
+        for (size_t i = 0; i < count(CACHE_FIGHTERS); i++) {
+            std::string name = text(fighters[i].name);
+            world.createFighter(name, text(fighters[i].type), fighters[i].hp);
+            fighterIds.push_back(world.fighterId(name));
+        }
+        for (size_t i = 0; i < count(CACHE_FIGHTERS); i++) {
+            for (uint32_t l = fighters[i].lessons; l < fighters[i].lessons + fighters[i].lessonCount; l++) {
+                world.teach(fighterIds[i], abilityIds[lessons[l]]);
+            }
+        }
+    }
+
+private:
+    std::string path;
+    std::shared_ptr<MappedFile> file;
+    CachedHeader header;
+
+    [[noreturn]] void invalid(const std::string& why) const {
+        throw std::runtime_error("Ruleset cache '" + path + "': " + why);
+    }
+
+    size_t count(RulesetCacheTable id) const { return (size_t)header.tables[id].count; }
+
+    template <typename T>
+    const T* table(RulesetCacheTable id) const {
+        const CachedTable& t = header.tables[id];
+        if (t.offset % alignof(T) != 0 || t.offset > file->size() ||
+            t.count > (file->size() - t.offset) / sizeof(T)) {
+            invalid("bad table");
+        }
+        return reinterpret_cast<const T*>(file->data() + t.offset);
+    }
+    template <typename T>
+    T* mutableTable(RulesetCacheTable id) {
+        table<T>(id);
+        return reinterpret_cast<T*>(file->mutableData() + header.tables[id].offset);
+    }
+
+    // [first, first + n) inside a table
+    void checkRange(uint32_t first, uint32_t n, RulesetCacheTable id, const char* what) const {
+        if (first > count(id) || n > count(id) - first) invalid(std::string("bad ") + what);
+    }
+    void checkIndex(uint32_t i, RulesetCacheTable id, const char* what) const {
+        if (i >= count(id)) invalid(std::string("bad ") + what);
+    }
+
+    void validate() const {
+        const CachedString* strings = table<CachedString>(CACHE_STRINGS);
+        for (size_t i = 0; i < count(CACHE_STRINGS); i++) checkRange(strings[i].offset, strings[i].length, CACHE_CHARS, "string");
+        table<char>(CACHE_CHARS);
+
+        const CachedTypeRule* typeRules = table<CachedTypeRule>(CACHE_TYPE_RULES);
+        for (size_t i = 0; i < count(CACHE_TYPE_RULES); i++) {
+            checkIndex(typeRules[i].attacker, CACHE_STRINGS, "type rule");
+            checkIndex(typeRules[i].defender, CACHE_STRINGS, "type rule");
+        }
+        const CachedSymbol* symbols = table<CachedSymbol>(CACHE_SYMBOLS);
+        const CondInstruction* conditions = table<CondInstruction>(CACHE_CONDITIONS);
+        for (size_t i = 0; i < count(CACHE_SYMBOLS); i++) {
+            checkIndex(symbols[i].condition, CACHE_CONDITIONS, "symbol");
+            checkIndex(symbols[i].text, CACHE_STRINGS, "symbol");
+        }
+        const CachedShowPart* parts = table<CachedShowPart>(CACHE_SHOW_PARTS);
+        for (size_t i = 0; i < count(CACHE_SHOW_PARTS); i++) {
+            if (parts[i].kind > RulesetShowPart::NAME) invalid("bad show");
+            checkIndex(parts[i].text, CACHE_STRINGS, "show");
+        }
+        const CachedShow* shows = table<CachedShow>(CACHE_SHOWS);
+        for (size_t i = 0; i < count(CACHE_SHOWS); i++) checkRange(shows[i].parts, shows[i].partCount, CACHE_SHOW_PARTS, "show");
+
+        const CachedProgram* programs = table<CachedProgram>(CACHE_PROGRAMS);
+        const CachedCommand* commands = table<CachedCommand>(CACHE_COMMANDS);
+        for (size_t p = 0; p < count(CACHE_PROGRAMS); p++) checkProgram(p, programs[p], commands, conditions);
+
+        const CachedAbility* abilities = table<CachedAbility>(CACHE_ABILITIES);
+        for (size_t i = 0; i < count(CACHE_ABILITIES); i++) {
+            checkIndex(abilities[i].name, CACHE_STRINGS, "ability");
+            checkIndex(abilities[i].program, CACHE_PROGRAMS, "ability");
+        }
+        const CachedFighter* fighters = table<CachedFighter>(CACHE_FIGHTERS);
+        const uint32_t* lessons = table<uint32_t>(CACHE_LESSONS);
+        for (size_t i = 0; i < count(CACHE_FIGHTERS); i++) {
+            checkIndex(fighters[i].name, CACHE_STRINGS, "fighter");
+            checkIndex(fighters[i].type, CACHE_STRINGS, "fighter");
+            checkRange(fighters[i].lessons, fighters[i].lessonCount, CACHE_LESSONS, "fighter");
+        }
+        for (size_t i = 0; i < count(CACHE_LESSONS); i++) checkIndex(lessons[i], CACHE_ABILITIES, "lesson");
+    }
+
+    // Enum and bool fields of a mapped struct, read without trusting them
+    template <typename T>
+    static uint8_t byteOf(const T& field) {
+        static_assert(sizeof(T) == 1, "one-byte field");
+        return *reinterpret_cast<const uint8_t*>(&field);
+    }
+    static bool validSource(const ValueSource& src) {
+        return byteOf(src.kind) <= (uint8_t)ValueSource::NAME && byteOf(src.isAttacker) <= 1;
+    }
+
+    // Everything the interpreters index must stay inside the program
+    void checkProgram(size_t p, const CachedProgram& cp, const CachedCommand* commands,
+                      const CondInstruction* conditions) const {
+        checkRange(cp.code, cp.codeCount, CACHE_CODE, "program");
+        checkRange(cp.conditions, cp.conditionCount, CACHE_CONDITIONS, "program");
+        checkRange(cp.commands, cp.commandCount, CACHE_COMMANDS, "program");
+        if (cp.codeCount == 0) invalid("bad program");
+        for (uint32_t c = cp.commands; c < cp.commands + cp.commandCount; c++) {
+            // Nested programs come later, so scheduling can never loop
+            if (commands[c].kind == CachedCommand::PROGRAM) {
+                if (commands[c].ref <= p) invalid("bad command");
+                checkIndex(commands[c].ref, CACHE_PROGRAMS, "command");
+            } else if (commands[c].kind == CachedCommand::SHOW) {
+                checkIndex(commands[c].ref, CACHE_SHOWS, "command");
+            } else {
+                invalid("bad command");
+            }
+        }
+        const Instruction* code = table<Instruction>(CACHE_CODE) + cp.code;
+        for (uint32_t i = 0; i < cp.codeCount; i++) {
+            const Instruction& in = code[i];
+            bool last = i + 1 == cp.codeCount;
+            if (byteOf(in.op) > (uint8_t)OpCode::END || byteOf(in.onDefender) > 1 ||
+                (in.op == OpCode::END) != last) {
+                invalid("bad bytecode");
+            }
+            if ((in.op == OpCode::FOR_ROUNDS || in.op == OpCode::AFTER_ROUNDS || in.op == OpCode::EXECUTE) &&
+                ((uint32_t)in.index >= cp.commandCount ||
+                 (commands[cp.commands + in.index].kind == CachedCommand::PROGRAM) != (in.op != OpCode::EXECUTE))) {
+                invalid("bad bytecode");
+            }
+            if (in.op == OpCode::BRANCH_IF_FALSE && (uint32_t)in.index >= cp.conditionCount) invalid("bad bytecode");
+            if ((in.op == OpCode::BRANCH_IF_FALSE || in.op == OpCode::JUMP) &&
+                ((uint32_t)in.target <= i || (uint32_t)in.target >= cp.codeCount)) {
+                invalid("bad bytecode");
+            }
+        }
+        for (uint32_t i = 0; i < cp.conditionCount; i++) {
+            const CondInstruction& in = conditions[cp.conditions + i];
+            if (byteOf(in.op) > (uint8_t)CondOp::END || byteOf(in.cmp) > (uint8_t)CmpOp::INVALID ||
+                byteOf(in.value) > 1 || !validSource(in.lhs) || !validSource(in.rhs) ||
+                in.op == CondOp::EVALUATE) {
+                invalid("bad condition");
+            }
+            if ((in.op == CondOp::JUMP_IF_FALSE || in.op == CondOp::JUMP_IF_TRUE) &&
+                ((uint32_t)in.target <= i || (uint32_t)in.target >= cp.conditionCount)) {
+                invalid("bad condition");
+            }
+        }
+        if (cp.conditionCount && conditions[cp.conditions + cp.conditionCount - 1].op != CondOp::END) {
+            invalid("bad condition");
+        }
+    }
+};
+
+// Loads a cache written by Ruleset::writeCache into `world`. With a
+// sourceHash, a cache of any other text is rejected. Throws
+// std::runtime_error for a cache that does not fit this build.
+inline void loadRulesetCache(World& world, const std::string& path, uint64_t sourceHash = 0) {
+    RulesetCacheLoader(path, sourceHash).load(world);
+}
+
+// Parses a ruleset file into `world`
+inline void loadRulesetText(World& world, const std::string& path) {
+    Ruleset::parseFile(path).apply(world);
+}
+
+// A ruleset file with its cache (default: path + ".cache"). The cache is
+// used when it was built from the same text; otherwise the text is parsed
+// and the cache rewritten. Returns true if the cache was used.
+inline bool loadRuleset(World& world, const std::string& path, std::string cachePath = "") {
+    if (cachePath.empty()) cachePath = path + ".cache";
+    std::string text = readRulesetText(path);
+    // The cached programs also depend on how the optimizer was set up
+    uint64_t hash = rulesetSourceHash(text) ^ optimizerOptions().fingerprint() * 0x9E3779B97F4A7C15ULL;
+    try {
+        RulesetCacheLoader loader(cachePath, hash);
+        loader.load(world);
+        return true;
+    } catch (const std::runtime_error&) {
+        // Missing, stale or from another build: rebuild it
+    }
+    Ruleset ruleset = Ruleset::parse(text, path);
+    ruleset.apply(world);
+    std::string temp = cachePath + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary);
+        if (out) ruleset.writeCache(out, hash);
+        if (!out) return false;
+    }
+    std::rename(temp.c_str(), cachePath.c_str());
+    return false;
+}
+
+#endif // RULESET_H
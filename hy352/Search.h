@@ -0,0 +1,384 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "Match.h"
+#include <chrono>
+
+// ========== GAME TREE SEARCH ==========
+//
+// Iterative-deepening alpha-beta over Match states. One ply is one ability
+// choice; turns a fighter cannot act on are played by Match::play, so the
+// same side may choose twice in a row. Scores are from the point of view of
+// the side to choose: a won duel scores WIN minus the plies it takes, other
+// leaves score the difference in HP fraction.
+
+// Zobrist keys for MatchState: one random key per byte value of each HP
+// (tabulation over the bit pattern of the double), per ring flag, for the
+// side to choose and the round parity, and per pending effect from its
+// list slot, program and turns remaining.
+class ZobristKeys {
+    uint64_t hpKeys[2][8][256];
+    uint64_t ringKeys[2];
+    uint64_t moverKey;
+    uint64_t parityKey;
+    uint64_t effectKeys[2][2];  // side, delayed/recurring
+
+    static uint64_t splitmix(uint64_t& s) {
+        uint64_t z = (s += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t effectKey(uint64_t base, int slot, const MatchEffect& e, int32_t turn) {
+        uint64_t s = base ^ ((uint64_t)slot << 48 | (uint64_t)e.program << 32 | (uint32_t)(e.tick - turn));
+        return splitmix(s);
+    }
+
+public:
+    explicit ZobristKeys(uint64_t seed = 0x5EA2C4) {
+        for (auto& side : hpKeys)
+            for (auto& byte : side)
+                for (uint64_t& key : byte) key = splitmix(seed);
+        for (uint64_t& key : ringKeys) key = splitmix(seed);
+        moverKey = splitmix(seed);
+        parityKey = splitmix(seed);
+        for (auto& side : effectKeys)
+            for (uint64_t& key : side) key = splitmix(seed);
+    }
+
+    uint64_t key(const MatchState& s) const {
+        uint64_t h = (s.player1Turn ? moverKey : 0) ^ (s.round % 2 ? parityKey : 0);
+        for (int i = 0; i < 2; i++) {
+            const MatchSide& side = s.side[i];
+            uint64_t bits;
+            std::memcpy(&bits, &side.hp, sizeof(bits));
+            for (int b = 0; b < 8; b++) h ^= hpKeys[i][b][(bits >> (8 * b)) & 0xFF];
+            if (side.inRing) h ^= ringKeys[i];
+            for (int e = 0; e < side.delayedCount; e++) {
+                h ^= effectKey(effectKeys[i][0], e, side.delayed[e], side.delayedTurn);
+            }
+            for (int e = 0; e < side.recurringCount; e++) {
+                h ^= effectKey(effectKeys[i][1], e, side.recurring[e], side.recurringTurn);
+            }
+        }
+        return h;
+    }
+};
+
+// Fixed-size, always-replace-if-not-deeper table. Entries from earlier
+// searches (another age) are replaced first.
+class TranspositionTable {
+public:
+    enum Bound : uint8_t { NONE, EXACT, LOWER, UPPER };
+
+    struct Entry {
+        uint64_t key;
+        int32_t score;
+        int8_t depth;
+        uint8_t bound;
+        int8_t move;
+        uint8_t age;
+    };
+
+    explicit TranspositionTable(size_t entries = 1 << 18) : age(0) {
+        size_t size = 1;
+        while (size < entries) size <<= 1;
+        table.assign(size, Entry());
+    }
+
+    void clear() { std::fill(table.begin(), table.end(), Entry()); }
+    void nextSearch() { age++; }
+    size_t size() const { return table.size(); }
+
+    const Entry* probe(uint64_t key) const {
+        const Entry& e = table[key & (table.size() - 1)];
+        return e.bound != NONE && e.key == key ? &e : nullptr;
+    }
+
+    void store(uint64_t key, int depth, int score, Bound bound, int move) {
+        Entry& e = table[key & (table.size() - 1)];
+        if (e.bound != NONE && e.key != key && e.age == age && e.depth > depth) return;
+        e.key = key;
+        e.score = score;
+        e.depth = (int8_t)depth;
+        e.bound = bound;
+        e.move = (int8_t)move;
+        e.age = age;
+    }
+
+private:
+    std::vector<Entry> table;
+    uint8_t age;
+};
+
+struct SearchLimits {
+    double seconds;     // per move; the first iteration always completes
+    int maxDepth;       // plies
+
+    SearchLimits(double s = 0.01, int d = 64) : seconds(s), maxDepth(d) {}
+};
+
+struct SearchStats {
+    long nodes;         // states visited
+    long ttHits;        // probes that found the state
+    int depth;          // last completed iteration
+    int bestMove;
+    int score;
+    double seconds;
+
+    SearchStats() : nodes(0), ttHits(0), depth(0), bestMove(-1), score(0), seconds(0) {}
+
+    double nodesPerSecond() const { return seconds > 0 ? nodes / seconds : 0.0; }
+};
+
+class AlphaBetaSearch {
+public:
+    static const int WIN = 1000000;
+    static const int MAX_PLY = 127;
+    static const int MAX_MOVES = 64;
+
+    explicit AlphaBetaSearch(const Match& m, size_t ttEntries = 1 << 18)
+        : match(m), table(ttEntries) {
+        clearHistory();
+    }
+
+    // Forget everything learned from earlier searches
+    void clear() {
+        table.clear();
+        clearHistory();
+    }
+
+    // Best choice for the side to move at `root`; -1 if the duel is over
+    int bestMove(const MatchState& root, const SearchLimits& limits, SearchStats* stats = nullptr) {
+        SearchStats run;
+        start = std::chrono::steady_clock::now();
+        budget = limits.seconds;
+        mayStop = false;
+        stopped = false;
+        nodes = 0;
+        ttHits = 0;
+        table.nextSearch();
+
+        int moves = match.choices(root);
+        if (moves > 0) {
+            run.bestMove = 0;
+            int maxDepth = std::max(1, std::min(limits.maxDepth, MAX_PLY));
+            for (int depth = 1; depth <= maxDepth; depth++) {
+                horizonReached = false;
+                int best = -1;
+                int score = searchRoot(root, depth, run.bestMove, best);
+                if (stopped) break;
+                run.bestMove = best;
+                run.score = score;
+                run.depth = depth;
+                // Deeper iterations would see the same tree, or the result is forced
+                if (!horizonReached || std::abs(score) > WIN - MAX_PLY) break;
+                if (elapsed() > budget * 0.5) break;
+                mayStop = true;
+            }
+        }
+        run.nodes = nodes;
+        run.ttHits = ttHits;
+        run.seconds = elapsed();
+        if (stats) *stats = run;
+        return run.bestMove;
+    }
+
+private:
+    const Match& match;
+    ZobristKeys zobrist;
+    TranspositionTable table;
+    int history[2][MAX_MOVES];
+    int8_t killers[MAX_PLY + 1][2];
+    std::chrono::steady_clock::time_point start;
+    double budget;
+    bool mayStop;       // not during the first iteration
+    bool stopped;
+    bool horizonReached;
+    long nodes;
+    long ttHits;
+
+    void clearHistory() {
+        std::memset(history, 0, sizeof(history));
+        std::memset(killers, -1, sizeof(killers));
+    }
+
+    double elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Mate scores are stored relative to the node, not the root
+    static int toTable(int score, int ply) {
+        return score > WIN - MAX_PLY ? score + ply : score < -WIN + MAX_PLY ? score - ply : score;
+    }
+    static int fromTable(int score, int ply) {
+        return score > WIN - MAX_PLY ? score - ply : score < -WIN + MAX_PLY ? score + ply : score;
+    }
+
+    int evaluate(const MatchState& s) const {
+        int me = s.mover();
+        double fraction[2];
+        for (int i = 0; i < 2; i++) {
+            const Fighter& f = match.fighter(i);
+            fraction[i] = f.maxHP > 0 ? s.side[i].hp / f.maxHP : 0.0;
+        }
+        return (int)(10000.0 * (fraction[me] - fraction[1 - me]));
+    }
+
+    // TT move, then killers of this ply, then by history
+    int orderMoves(int mover, int count, int ttMove, int ply, int* order) const {
+        int score[MAX_MOVES];
+        for (int i = 0; i < count; i++) {
+            order[i] = i;
+            score[i] = i == ttMove ? INT32_MAX
+                     : i == killers[ply][0] ? INT32_MAX - 2
+                     : i == killers[ply][1] ? INT32_MAX - 3
+                     : history[mover][i];
+        }
+        for (int i = 1; i < count; i++) {
+            int move = order[i];
+            int j = i;
+            while (j > 0 && score[order[j - 1]] < score[move]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = move;
+        }
+        return count;
+    }
+
+    void rewardCutoff(int mover, int move, int depth, int ply) {
+        history[mover][move] += depth * depth;
+        if (killers[ply][0] != move) {
+            killers[ply][1] = killers[ply][0];
+            killers[ply][0] = (int8_t)move;
+        }
+    }
+
+    // Value of `child` for the side that chose at `parent`
+    int childValue(const MatchState& parent, const MatchState& child, int depth,
+                   int alpha, int beta, int ply) {
+        if (child.mover() == parent.mover() && !child.over) {
+            return negamax(child, depth, alpha, beta, ply);
+        }
+        if (child.over) {
+            int winner = match.result(child).winner;
+            return winner == 0 ? 0 : winner - 1 == parent.mover() ? WIN - ply : -WIN + ply;
+        }
+        return -negamax(child, depth, -beta, -alpha, ply);
+    }
+
+    int searchRoot(const MatchState& root, int depth, int previousBest, int& best) {
+        int count = std::min(match.choices(root), MAX_MOVES);
+        int order[MAX_MOVES];
+        orderMoves(root.mover(), count, previousBest, 0, order);
+        int alpha = -WIN - 1, beta = WIN + 1;
+        for (int i = 0; i < count; i++) {
+            MatchState child = root;
+            match.play(child, order[i]);
+            int value = childValue(root, child, depth - 1, alpha, beta, 1);
+            if (stopped) break;
+            if (value > alpha) {
+                alpha = value;
+                best = order[i];
+            }
+        }
+        if (!stopped) table.store(zobrist.key(root), depth, alpha, TranspositionTable::EXACT, best);
+        return alpha;
+    }
+
+    int negamax(const MatchState& s, int depth, int alpha, int beta, int ply) {
+        if ((++nodes & 1023) == 0 && mayStop && elapsed() > budget) stopped = true;
+        if (stopped) return 0;
+        if (depth <= 0 || ply >= MAX_PLY) {
+            horizonReached = true;
+            return evaluate(s);
+        }
+
+        uint64_t key = zobrist.key(s);
+        int ttMove = -1;
+        if (const TranspositionTable::Entry* e = table.probe(key)) {
+            ttHits++;
+            ttMove = e->move;
+            if (e->depth >= depth) {
+                int score = fromTable(e->score, ply);
+                if (e->bound == TranspositionTable::EXACT) return score;
+                if (e->bound == TranspositionTable::LOWER && score >= beta) return score;
+                if (e->bound == TranspositionTable::UPPER && score <= alpha) return score;
+            }
+        }
+
+        int mover = s.mover();
+        int count = std::min(match.choices(s), MAX_MOVES);
+        int order[MAX_MOVES];
+        orderMoves(mover, count, ttMove, ply, order);
+
+        int originalAlpha = alpha;
+        int best = -WIN - 1, bestMove = -1;
+        for (int i = 0; i < count; i++) {
+            MatchState child = s;
+            match.play(child, order[i]);
+            int value = childValue(s, child, depth - 1, alpha, beta, ply + 1);
+            if (stopped) return 0;
+            if (value > best) {
+                best = value;
+                bestMove = order[i];
+            }
+            if (value > alpha) alpha = value;
+            if (alpha >= beta) {
+                rewardCutoff(mover, order[i], depth, ply);
+                break;
+            }
+        }
+
+        TranspositionTable::Bound bound = best <= originalAlpha ? TranspositionTable::UPPER
+                                        : best >= beta ? TranspositionTable::LOWER
+                                        : TranspositionTable::EXACT;
+        table.store(key, depth, toTable(best, ply), bound, bestMove);
+        return best;
+    }
+};
+
+// MatchPolicy that plays the alpha-beta search's best move. The table is
+// kept across duels of the same matchup.
+class SearchPolicy : public MatchPolicy {
+public:
+    explicit SearchPolicy(int seat, const SearchLimits& l = SearchLimits(), size_t ttEntries = 1 << 18)
+        : MatchPolicy(seat), limits(l), tableSize(ttEntries), moves(0), depthSum(0) {}
+
+    void setLimits(const SearchLimits& l) { limits = l; }
+
+    // Last search, and totals over every move searched so far
+    const SearchStats& lastSearch() const { return last; }
+    const SearchStats& totals() const { return total; }
+    long movesSearched() const { return moves; }
+    double averageDepth() const { return moves ? (double)depthSum / moves : 0.0; }
+
+protected:
+    void setMatch(const Match* m) override {
+        search.reset(m ? new AlphaBetaSearch(*m, tableSize) : nullptr);
+    }
+
+    int decide(const Match&, const MatchState& s) override {
+        int choice = search->bestMove(s, limits, &last);
+        moves++;
+        depthSum += last.depth;
+        total.nodes += last.nodes;
+        total.ttHits += last.ttHits;
+        total.seconds += last.seconds;
+        total.depth = std::max(total.depth, last.depth);
+        return choice;
+    }
+
+private:
+    SearchLimits limits;
+    size_t tableSize;
+    std::unique_ptr<AlphaBetaSearch> search;
+    SearchStats last;
+    SearchStats total;
+    long moves;
+    long depthSum;
+};
+
+#endif // SEARCH_H
@@ -0,0 +1,607 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "Match.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <limits>
+#include <thread>
+
+// ========== EXACT MATCHUP SOLVER ==========
+//
+// Win probabilities and expected length of a matchup in which both sides
+// choose at random with fixed weights (uniform weights play like
+// RandomPolicy), computed over every position the duel can reach instead
+// of by sampling. A position is a MatchState without its round and turn
+// counters: both HPs, ring flags, round parity, whose turn it is and the
+// pending effects by turns remaining. Match plays the turns, so damage
+// and heal follow Fighter::takeDamage/heal and the archetype table.
+//
+// The positions are found breadth first and stored once each, as packed
+// keys behind an open-addressing hash table. Healing can lead back to a
+// position, so values are solved per strongly connected component,
+// successors first: a position off every cycle takes one step, positions
+// on cycles are swept (Gauss-Seidel) until no value moves. Components whose
+// successors are solved do not depend on each other and are evaluated in
+// parallel, as are the positions of one breadth-first level.
+//
+// The Match's round limit is not modelled (positions do not know their
+// round): a duel that can go on forever is a draw for the probability
+// that it does, reported as `endless`.
+
+struct SolverOptions {
+    std::vector<double> weights[2];     // relative chance of each ability of player 1/2; empty: uniform
+    unsigned threads;                   // 0: one per core
+    size_t maxStates;                   // std::length_error beyond this
+    double tolerance;                   // cycles: sweeps stop when no value moves more than this
+    long maxSweeps;                     // per component
+
+    SolverOptions()
+        : threads(0), maxStates((size_t)1 << 21), tolerance(1e-15), maxSweeps(1000000) {}
+};
+
+// Outcome from one position on
+struct SolverValue {
+    double win1;
+    double win2;
+    double draw;        // both fall on the same turn
+    double open;        // reaches a position that was not explored (see SolverOptions::maxStates)
+    double rounds;      // expected rounds still to be started; infinity unless open is 0 and the duel surely ends
+};
+
+struct SolverResult {
+    double win1;
+    double win2;
+    double draw;                // both fall on the same turn
+    double endless;             // the duel never ends (a draw for DuelEngine's round limit)
+    double open;                // outcome unknown: win1 and win2 are exact up to this much each
+    double expectedRounds;      // round in which the duel ends (DuelResult::rounds)
+    bool complete;              // every reachable position was explored (open is 0)
+    size_t states;              // reachable positions
+    size_t terminal;            // of which the duel is over
+    size_t cyclic;              // of which on a cycle
+    size_t transitions;
+    size_t components;
+    size_t levels;              // breadth-first levels expanded
+    size_t steps;               // components evaluated in this many parallel steps
+    long sweeps;                // Gauss-Seidel sweeps over all cycles
+    long unconverged;           // components that hit maxSweeps
+    size_t tableBytes;          // keys, hash table, edges and values
+    unsigned threads;
+    double exploreSeconds;
+    double solveSeconds;
+};
+
+class MatchSolver {
+public:
+    explicit MatchSolver(const Match& m, const SolverOptions& o = SolverOptions())
+        : match(m), options(o), threadCount(o.threads ? o.threads : std::max(1u, std::thread::hardware_concurrency())) {
+        for (int side = 0; side < 2; side++) {
+            int n = match.abilities(side);
+            std::vector<double> w = options.weights[side];
+            if (w.empty()) w.assign(n, 1.0);
+            if ((int)w.size() != n) {
+                throw std::invalid_argument("MatchSolver: player " + std::to_string(side + 1) + " has " +
+                                            std::to_string(n) + " abilities, " + std::to_string(w.size()) +
+                                            " weights given");
+            }
+            double total = 0;
+            for (double x : w) {
+                if (!(x >= 0)) throw std::invalid_argument("MatchSolver: negative weight");
+                total += x;
+            }
+            if (n > 0 && total <= 0) throw std::invalid_argument("MatchSolver: all weights are zero");
+            for (double x : w) chance[side].push_back(x / total);
+        }
+    }
+
+    MatchSolver(const MatchSolver&) = delete;
+    MatchSolver& operator=(const MatchSolver&) = delete;
+
+    SolverResult solve() { return solve(match.start()); }
+
+    // Explores everything reachable from root and solves it
+    SolverResult solve(const MatchState& root) {
+        clear();
+        SolverResult r;
+        std::memset(&r, 0, sizeof r);
+        r.threads = threadCount;
+        auto start = std::chrono::steady_clock::now();
+        explore(root);
+        auto explored = std::chrono::steady_clock::now();
+        evaluate(r);
+        auto solved = std::chrono::steady_clock::now();
+
+        const SolverValue& v = values[0];
+        r.win1 = v.win1;
+        r.win2 = v.win2;
+        r.draw = v.draw;
+        r.open = v.open;
+        r.endless = std::max(0.0, 1.0 - v.win1 - v.win2 - v.draw - v.open);
+        r.complete = openFrom == EMPTY;
+        r.levels = expandedLevels;
+        r.expectedRounds = root.round + v.rounds;
+        r.states = keyOffset.size();
+        r.transitions = edges.size();
+        r.tableBytes = keys.capacity() * sizeof(uint64_t) + keyOffset.capacity() * sizeof(uint32_t) +
+                       slots.capacity() * sizeof(Slot) + edges.capacity() * sizeof(Edge) +
+                       edgeStart.capacity() * sizeof(uint32_t) + values.capacity() * sizeof(SolverValue);
+        r.exploreSeconds = std::chrono::duration<double>(explored - start).count();
+        r.solveSeconds = std::chrono::duration<double>(solved - explored).count();
+        return r;
+    }
+
+    // Value of a position reached by the last solve() (same parity, same
+    // pending effects by turns remaining); std::out_of_range otherwise
+    SolverValue value(const MatchState& s) const {
+        std::vector<uint64_t> key;
+        encode(s, key);
+        uint32_t id = find(key.data(), (uint32_t)key.size(), hashKey(key.data(), key.size()));
+        if (id == EMPTY) throw std::out_of_range("MatchSolver: position not reached");
+        return values[id];
+    }
+
+private:
+    static const uint32_t EMPTY = 0xFFFFFFFFu;
+
+    // Key layout: hp of player 1 and 2 (bits), flags, then the pending
+    // effects two to a word, 16 bits of turns remaining and 16 of program
+    static const uint64_t ODD_ROUND = 1, PLAYER1_TURN = 2, OVER = 4, IN_RING1 = 8, IN_RING2 = 16;
+    static const int COUNT_SHIFT = 8;
+
+    struct Slot {
+        uint32_t tag;       // high half of the key hash
+        uint32_t id;
+    };
+
+    struct Edge {
+        uint32_t target;
+        uint16_t choice;
+        uint16_t rounds;    // round counter increase on the way
+    };
+
+    // A successor found by a worker, before it has an id
+    struct Found {
+        uint64_t hash;
+        uint32_t key;       // offset into the worker's key buffer
+        uint16_t choice;
+        uint16_t rounds;
+    };
+
+    struct Worker {
+        std::vector<uint64_t> keys;
+        std::vector<Found> found;
+    };
+
+    const Match& match;
+    SolverOptions options;
+    unsigned threadCount;
+    std::vector<double> chance[2];
+
+    std::vector<uint64_t> keys;         // packed keys, back to back
+    std::vector<uint32_t> keyOffset;    // by position id
+    std::vector<Slot> slots;
+    std::vector<uint32_t> edgeStart;    // edges of id: edgeStart[id] .. edgeStart[id + 1]
+    std::vector<Edge> edges;
+    std::vector<SolverValue> values;
+    uint32_t openFrom;                  // positions from here on were not expanded
+    size_t expandedLevels;              // breadth-first levels
+
+    void clear() {
+        keys.clear();
+        keyOffset.clear();
+        slots.assign(1024, Slot{0, EMPTY});
+        edgeStart.clear();
+        edges.clear();
+        values.clear();
+        openFrom = EMPTY;
+        expandedLevels = 0;
+    }
+
+    // ----- keys -----
+
+    static uint32_t keyLength(uint64_t flags) {
+        uint32_t effects = 0;
+        for (int i = 0; i < 4; i++) effects += (uint32_t)(flags >> (COUNT_SHIFT + 5 * i)) & 31;
+        return 3 + (effects + 1) / 2;
+    }
+
+    static void encode(const MatchState& s, std::vector<uint64_t>& out) {
+        if (s.over) {
+            // Every finished duel with the same winner is worth the same
+            double hp[2] = {s.side[0].hp, s.side[1].hp};
+            out.push_back(hp[0] > 0 ? 1 : hp[1] > 0 ? 2 : 0);
+            out.push_back(0);
+            out.push_back(uint64_t(OVER));
+            return;
+        }
+        uint64_t hp[2];
+        std::memcpy(&hp[0], &s.side[0].hp, sizeof(double));
+        std::memcpy(&hp[1], &s.side[1].hp, sizeof(double));
+        out.push_back(hp[0]);
+        out.push_back(hp[1]);
+        uint64_t flags = (s.round & 1 ? ODD_ROUND : 0) | (s.player1Turn ? PLAYER1_TURN : 0) |
+                         (s.side[0].inRing ? IN_RING1 : 0) | (s.side[1].inRing ? IN_RING2 : 0);
+        for (int i = 0; i < 2; i++) {
+            flags |= (uint64_t)s.side[i].delayedCount << (COUNT_SHIFT + 10 * i);
+            flags |= (uint64_t)s.side[i].recurringCount << (COUNT_SHIFT + 10 * i + 5);
+        }
+        out.push_back(flags);
+        uint64_t word = 0;
+        int half = 0;
+        auto add = [&](const MatchEffect& e, int32_t turn) {
+            int32_t remaining = e.tick - turn;
+            if (remaining < 0 || remaining > 0xFFFF) {
+                throw std::length_error("MatchSolver: effect scheduled too far ahead");
+            }
+            word |= (uint64_t)((uint32_t)remaining << 16 | e.program) << (32 * half);
+            if (++half == 2) {
+                out.push_back(word);
+                word = 0;
+                half = 0;
+            }
+        };
+        for (const MatchSide& side : s.side) {
+            for (int e = 0; e < side.delayedCount; e++) add(side.delayed[e], side.delayedTurn);
+            for (int e = 0; e < side.recurringCount; e++) add(side.recurring[e], side.recurringTurn);
+        }
+        if (half) out.push_back(word);
+    }
+
+    // Inverse of encode, with round 1 or 2 and the turn counters at 0
+    static void decode(const uint64_t* key, MatchState& s) {
+        std::memset(&s, 0, sizeof s);
+        uint64_t flags = key[2];
+        if (flags & OVER) {
+            s.over = 1;
+            s.side[0].hp = key[0] == 1 ? 1 : 0;
+            s.side[1].hp = key[0] == 2 ? 1 : 0;
+            return;
+        }
+        std::memcpy(&s.side[0].hp, &key[0], sizeof(double));
+        std::memcpy(&s.side[1].hp, &key[1], sizeof(double));
+        s.round = flags & ODD_ROUND ? 1 : 2;
+        s.player1Turn = (flags & PLAYER1_TURN) != 0;
+        s.side[0].inRing = (flags & IN_RING1) != 0;
+        s.side[1].inRing = (flags & IN_RING2) != 0;
+        int next = 0;
+        for (int i = 0; i < 2; i++) {
+            MatchSide& side = s.side[i];
+            side.delayedCount = (uint8_t)((flags >> (COUNT_SHIFT + 10 * i)) & 31);
+            side.recurringCount = (uint8_t)((flags >> (COUNT_SHIFT + 10 * i + 5)) & 31);
+            for (int e = 0; e < side.delayedCount; e++, next++) {
+                uint64_t w = key[3 + next / 2] >> (32 * (next % 2));
+                side.delayed[e].tick = (int32_t)((w >> 16) & 0xFFFF);
+                side.delayed[e].program = (uint16_t)(w & 0xFFFF);
+            }
+            for (int e = 0; e < side.recurringCount; e++, next++) {
+                uint64_t w = key[3 + next / 2] >> (32 * (next % 2));
+                side.recurring[e].tick = (int32_t)((w >> 16) & 0xFFFF);
+                side.recurring[e].program = (uint16_t)(w & 0xFFFF);
+            }
+        }
+    }
+
+    static uint64_t hashKey(const uint64_t* key, size_t n) {
+        uint64_t h = 0x84222325CBF29CE4ULL ^ n;
+        for (size_t i = 0; i < n; i++) {
+            h = (h ^ key[i]) * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 32;
+        }
+        h *= 0xBF58476D1CE4E5B9ULL;
+        return h ^ (h >> 29);
+    }
+
+    // ----- table -----
+
+    uint32_t find(const uint64_t* key, uint32_t n, uint64_t hash) const {
+        size_t mask = slots.size() - 1;
+        uint32_t tag = (uint32_t)(hash >> 32);
+        for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.id == EMPTY) return EMPTY;
+            if (slot.tag == tag && sameKey(slot.id, key, n)) return slot.id;
+        }
+    }
+
+    bool sameKey(uint32_t id, const uint64_t* key, uint32_t n) const {
+        const uint64_t* stored = keys.data() + keyOffset[id];
+        return keyLength(stored[2]) == n && std::memcmp(stored, key, n * sizeof(uint64_t)) == 0;
+    }
+
+    void place(uint32_t id, uint64_t hash) {
+        size_t mask = slots.size() - 1;
+        size_t i = (size_t)hash & mask;
+        while (slots[i].id != EMPTY) i = (i + 1) & mask;
+        slots[i].tag = (uint32_t)(hash >> 32);
+        slots[i].id = id;
+    }
+
+    // Id of the position, adding it if new
+    uint32_t insert(const uint64_t* key, uint32_t n, uint64_t hash) {
+        uint32_t id = find(key, n, hash);
+        if (id != EMPTY) return id;
+        id = (uint32_t)keyOffset.size();
+        keyOffset.push_back((uint32_t)keys.size());
+        keys.insert(keys.end(), key, key + n);
+        if ((keyOffset.size() + 1) * 2 > slots.size()) {
+            slots.assign(slots.size() * 2, Slot{0, EMPTY});
+            for (uint32_t k = 0; k < keyOffset.size(); k++) {
+                const uint64_t* stored = keys.data() + keyOffset[k];
+                place(k, hashKey(stored, keyLength(stored[2])));
+            }
+        } else {
+            place(id, hash);
+        }
+        return id;
+    }
+
+    // ----- parallel loops -----
+
+    // body(i, worker) for i in [0, count), split over the threads in small
+    // chunks; small loops run on the calling thread
+    template <typename F>
+    void forEach(size_t count, F body) {
+        const size_t chunk = 16;
+        unsigned workers = (unsigned)std::min<size_t>(threadCount, count / (4 * chunk));
+        if (workers <= 1) {
+            for (size_t i = 0; i < count; i++) body(i, 0u);
+            return;
+        }
+        std::atomic<size_t> next(0);
+        std::vector<std::exception_ptr> errors(workers);
+        auto work = [&](unsigned t) {
+            try {
+                for (size_t begin; (begin = next.fetch_add(chunk)) < count;) {
+                    for (size_t i = begin; i < std::min(count, begin + chunk); i++) body(i, t);
+                }
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < workers; t++) pool.emplace_back(work, t);
+        work(0);
+        for (auto& t : pool) t.join();
+        for (auto& e : errors) {
+            if (e) std::rethrow_exception(e);
+        }
+    }
+
+    // ----- exploration -----
+
+    void explore(const MatchState& root) {
+        std::vector<uint64_t> key;
+        encode(root, key);
+        insert(key.data(), (uint32_t)key.size(), hashKey(key.data(), key.size()));
+
+        std::vector<Worker> workers(threadCount);
+        std::vector<uint32_t> foundWorker, foundStart, foundCount;
+        int most = std::max(std::max(match.abilities(0), match.abilities(1)), 1);
+        for (uint32_t begin = 0, end = 1; begin < end; begin = end, end = (uint32_t)keyOffset.size()) {
+            size_t level = end - begin;
+            // Positions of the last level that fits stay open
+            if (end + level * most > options.maxStates) {
+                openFrom = begin;
+                break;
+            }
+            expandedLevels++;
+            foundWorker.assign(level, 0);
+            foundStart.assign(level, 0);
+            foundCount.assign(level, 0);
+            for (Worker& w : workers) {
+                w.keys.clear();
+                w.found.clear();
+            }
+            // Successors of one breadth-first level, in parallel
+            forEach(level, [&](size_t i, unsigned t) {
+                Worker& w = workers[t];
+                foundWorker[i] = t;
+                foundStart[i] = (uint32_t)w.found.size();
+                const uint64_t* own = keys.data() + keyOffset[begin + i];
+                if (own[2] & OVER) return;
+                MatchState s;
+                decode(own, s);
+                int side = s.mover();
+                for (int c = 0; c < match.choices(s); c++) {
+                    if (chance[side][c] <= 0) continue;
+                    MatchState next = s;
+                    match.play(next, c);
+                    Found f;
+                    f.key = (uint32_t)w.keys.size();
+                    encode(next, w.keys);
+                    f.hash = hashKey(w.keys.data() + f.key, w.keys.size() - f.key);
+                    f.choice = (uint16_t)c;
+                    f.rounds = (uint16_t)std::min(next.round - s.round, 0xFFFF);
+                    w.found.push_back(f);
+                }
+                foundCount[i] = (uint32_t)(w.found.size() - foundStart[i]);
+            });
+            // Ids in position order, so the result does not depend on the threads
+            for (size_t i = 0; i < level; i++) {
+                edgeStart.push_back((uint32_t)edges.size());
+                Worker& w = workers[foundWorker[i]];
+                for (uint32_t k = foundStart[i]; k < foundStart[i] + foundCount[i]; k++) {
+                    const Found& f = w.found[k];
+                    const uint64_t* key = w.keys.data() + f.key;
+                    Edge e = {insert(key, keyLength(key[2]), f.hash), f.choice, f.rounds};
+                    edges.push_back(e);
+                }
+            }
+        }
+        edgeStart.resize(keyOffset.size() + 1, (uint32_t)edges.size());
+    }
+
+    // ----- evaluation -----
+
+    bool terminal(uint32_t id) const { return (keys[keyOffset[id] + 2] & OVER) != 0; }
+
+    int moverOf(uint32_t id) const { return keys[keyOffset[id] + 2] & PLAYER1_TURN ? 0 : 1; }
+
+    // One step of the equations; returns the largest change
+    double update(uint32_t id, bool withRounds) {
+        SolverValue v = {0, 0, 0, 0, 0};
+        const std::vector<double>& p = chance[moverOf(id)];
+        for (uint32_t e = edgeStart[id]; e < edgeStart[id + 1]; e++) {
+            const Edge& edge = edges[e];
+            const SolverValue& next = values[edge.target];
+            double q = p[edge.choice];
+            v.win1 += q * next.win1;
+            v.win2 += q * next.win2;
+            v.draw += q * next.draw;
+            v.open += q * next.open;
+            v.rounds += q * (edge.rounds + next.rounds);
+        }
+        SolverValue& old = values[id];
+        double change = std::max(std::fabs(v.win1 - old.win1), std::fabs(v.win2 - old.win2));
+        change = std::max(change, std::max(std::fabs(v.draw - old.draw), std::fabs(v.open - old.open)));
+        if (withRounds) {
+            change = std::max(change, std::fabs(v.rounds - old.rounds) / std::max(1.0, v.rounds));
+        } else {
+            v.rounds = old.rounds;
+        }
+        old = v;
+        return change;
+    }
+
+    // Gauss-Seidel over one component: probabilities first, then the
+    // expected length if the component is left for sure
+    void sweep(const uint32_t* members, size_t count, long& sweeps, long& unconverged) {
+        for (int pass = 0; pass < 2; pass++) {
+            long n = 0;
+            double change;
+            do {
+                change = 0;
+                for (size_t i = 0; i < count; i++) change = std::max(change, update(members[i], pass == 1));
+                n++;
+            } while (change > options.tolerance && n < options.maxSweeps);
+            sweeps += n;
+            if (change > options.tolerance) unconverged++;
+            if (pass == 1) break;
+            double endless = 0;
+            for (size_t i = 0; i < count; i++) {
+                const SolverValue& v = values[members[i]];
+                endless = std::max(endless, 1.0 - v.win1 - v.win2 - v.draw - v.open);
+            }
+            if (endless > 1e-9) {
+                for (size_t i = 0; i < count; i++) values[members[i]].rounds = std::numeric_limits<double>::infinity();
+                break;
+            }
+        }
+    }
+
+    void evaluate(SolverResult& r) {
+        size_t n = keyOffset.size();
+        values.assign(n, SolverValue{0, 0, 0, 0, 0});
+        for (uint32_t id = 0; id < n; id++) {
+            if (!terminal(id)) {
+                if (id >= openFrom) {
+                    values[id].open = 1;
+                    values[id].rounds = std::numeric_limits<double>::infinity();
+                }
+                continue;
+            }
+            uint64_t winner = keys[keyOffset[id]];
+            values[id].win1 = winner == 1;
+            values[id].win2 = winner == 2;
+            values[id].draw = winner == 0;
+            r.terminal++;
+        }
+
+        // Components (Tarjan, without recursion), successors first
+        std::vector<uint32_t> index(n, EMPTY), low(n), component(n, EMPTY);
+        std::vector<uint32_t> stack, members, memberStart, frames;
+        std::vector<uint32_t> level;
+        uint32_t counter = 0;
+        for (uint32_t s = 0; s < n; s++) {
+            if (index[s] != EMPTY) continue;
+            frames.push_back(s);
+            frames.push_back(edgeStart[s]);
+            index[s] = low[s] = counter++;
+            stack.push_back(s);
+            while (!frames.empty()) {
+                uint32_t v = frames[frames.size() - 2];
+                uint32_t& e = frames.back();
+                if (e < edgeStart[v + 1]) {
+                    uint32_t w = edges[e++].target;
+                    if (index[w] == EMPTY) {
+                        index[w] = low[w] = counter++;
+                        stack.push_back(w);
+                        frames.push_back(w);
+                        frames.push_back(edgeStart[w]);
+                    } else if (component[w] == EMPTY) {
+                        low[v] = std::min(low[v], index[w]);
+                    }
+                    continue;
+                }
+                frames.resize(frames.size() - 2);
+                if (!frames.empty()) {
+                    uint32_t parent = frames[frames.size() - 2];
+                    low[parent] = std::min(low[parent], low[v]);
+                }
+                if (low[v] != index[v]) continue;
+                uint32_t c = (uint32_t)memberStart.size();
+                memberStart.push_back((uint32_t)members.size());
+                uint32_t depth = 0;
+                uint32_t w;
+                do {
+                    w = stack.back();
+                    stack.pop_back();
+                    component[w] = c;
+                    members.push_back(w);
+                } while (w != v);
+                for (uint32_t m = memberStart[c]; m < members.size(); m++) {
+                    for (uint32_t k = edgeStart[members[m]]; k < edgeStart[members[m] + 1]; k++) {
+                        uint32_t t = component[edges[k].target];
+                        if (t != c) depth = std::max(depth, level[t] + 1);
+                    }
+                }
+                level.push_back(depth);
+            }
+        }
+        memberStart.push_back((uint32_t)members.size());
+        size_t components = level.size();
+        r.components = components;
+
+        // Components by level: each level only reads the ones below it
+        uint32_t levels = 0;
+        for (uint32_t l : level) levels = std::max(levels, l + 1);
+        std::vector<uint32_t> byLevel(components), levelStart(levels + 1, 0);
+        for (uint32_t l : level) levelStart[l + 1]++;
+        for (uint32_t l = 0; l < levels; l++) levelStart[l + 1] += levelStart[l];
+        std::vector<uint32_t> fill(levelStart.begin(), levelStart.end() - 1);
+        for (uint32_t c = 0; c < components; c++) byLevel[fill[level[c]]++] = c;
+        r.steps = levels;
+
+        std::vector<long> sweeps(threadCount, 0), unconverged(threadCount, 0);
+        std::vector<size_t> cyclic(threadCount, 0);
+        for (uint32_t l = 0; l < levels; l++) {
+            forEach(levelStart[l + 1] - levelStart[l], [&](size_t i, unsigned t) {
+                uint32_t c = byLevel[levelStart[l] + i];
+                const uint32_t* first = members.data() + memberStart[c];
+                size_t count = memberStart[c + 1] - memberStart[c];
+                if (count == 1) {
+                    uint32_t id = first[0];
+                    if (terminal(id) || id >= openFrom) return;
+                    bool loop = false;
+                    for (uint32_t k = edgeStart[id]; k < edgeStart[id + 1]; k++) loop |= edges[k].target == id;
+                    if (!loop) {
+                        update(id, true);
+                        return;
+                    }
+                }
+                cyclic[t] += count;
+                sweep(first, count, sweeps[t], unconverged[t]);
+            });
+        }
+        for (unsigned t = 0; t < threadCount; t++) {
+            r.sweeps += sweeps[t];
+            r.unconverged += unconverged[t];
+            r.cyclic += cyclic[t];
+        }
+    }
+};
+
+#endif // SOLVER_H
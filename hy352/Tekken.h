@@ -9,14 +9,219 @@
 #include <functional>
 #include <algorithm>
 #include <cmath>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <typeinfo>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
 
 // Forward declarations
 class Fighter;
 class Ability;
+class Command;
+class ConditionExpr;
 
-// Global registries
-static std::map<std::string, std::shared_ptr<Fighter>> fighterRegistry;
-static std::map<std::string, std::shared_ptr<Ability>> abilityRegistry;
+class World;
+
+// ========== BATTLE EVENTS ==========
+//
+// Fighters and the duel loops report what happens to the EventSink of the
+// current thread. nullptr is the null sink: an event then costs one branch
+// at the call site, and defining TEKKEN_NO_EVENTS removes even that.
+// Buffered text and binary ring-buffer sinks are in Events.h.
+
+class EventSink {
+public:
+    virtual ~EventSink() = default;
+    virtual void roundStart(int /*round*/) {}
+    virtual void damage(const Fighter& /*target*/, double /*amount*/, int /*round*/) {}
+    virtual void heal(const Fighter& /*target*/, double /*amount*/) {}
+    virtual void tag(const Fighter& /*target*/, bool /*in*/) {}
+    virtual void show(const std::string& /*text*/) {}
+    virtual void knockOut(const Fighter& /*fighter*/, int /*round*/) {}
+};
+
+// For code that needs a sink object; selecting nullptr is cheaper.
+class NullEventSink : public EventSink {};
+
+// Default sink of the interactive game: ShowCommand text goes to std::cout.
+class ConsoleShowSink : public EventSink {
+public:
+    void show(const std::string& text) override { std::cout << text << '\n'; }
+};
+
+static ConsoleShowSink consoleShowSink;
+
+inline EventSink*& eventSink() {
+    static thread_local EventSink* sink = &consoleShowSink;
+    return sink;
+}
+
+#ifdef TEKKEN_NO_EVENTS
+#define TEKKEN_EVENT(call) do {} while (0)
+#else
+#define TEKKEN_EVENT(call) do { if (EventSink* sink_ = eventSink()) sink_->call; } while (0)
+#endif
+
+// Hot-path counters and latency histograms (Profile.h), compiled in by
+// defining TEKKEN_PROFILE. Without it the hooks expand to nothing and a
+// condition hook to the plain outcome.
+#ifdef TEKKEN_PROFILE
+#include "Profile.h"
+#define TEKKEN_PROFILE_COMMAND(kind) profileCommand(ProfiledCommand::kind)
+#define TEKKEN_PROFILE_CONDITION(kind, outcome) profileCondition(ProfiledCondition::kind, (outcome))
+#define TEKKEN_PROFILE_TIMER(kind) ProfileTimer profileTimer_(ProfiledLatency::kind)
+#define TEKKEN_PROFILE_ABILITY(id) ProfileAbilityTimer profileAbilityTimer_(id)
+#else
+#define TEKKEN_PROFILE_COMMAND(kind) do {} while (0)
+#define TEKKEN_PROFILE_CONDITION(kind, outcome) (outcome)
+#define TEKKEN_PROFILE_TIMER(kind) do {} while (0)
+#define TEKKEN_PROFILE_ABILITY(id) do {} while (0)
+#endif
+
+// Interns a string and returns its symbol id. Fighters intern their name and
+// type when constructed, so conditions compare ids instead of strings.
+struct SymbolTable {
+    std::mutex lock;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> texts;     // by id
+};
+
+inline SymbolTable& symbolTable() {
+    static SymbolTable table;
+    return table;
+}
+
+inline uint32_t internSymbol(const std::string& text) {
+    SymbolTable& table = symbolTable();
+    std::lock_guard<std::mutex> guard(table.lock);
+    auto it = table.ids.find(text);
+    if (it != table.ids.end()) return it->second;
+    uint32_t id = (uint32_t)table.texts.size();
+    table.ids.emplace(text, id);
+    table.texts.push_back(text);
+    return id;
+}
+
+// Text of an interned symbol; ids differ between processes, texts do not
+inline std::string symbolText(uint32_t id) {
+    SymbolTable& table = symbolTable();
+    std::lock_guard<std::mutex> guard(table.lock);
+    return id < table.texts.size() ? table.texts[id] : std::string();
+}
+
+// ========== ARCHETYPES ==========
+
+// Multipliers applied to a hit, in this order: amount * attack * defense.
+// Keeping the two factors apart reproduces the original bonus-then-resistance
+// rounding bit for bit.
+struct DamageModifier {
+    double attack;
+    double defense;
+};
+
+// Fighter types are mapped to a small archetype id when the fighter is
+// created. All type rules live in precomputed tables indexed by
+// (attacker, defender, round parity), so a hit costs one lookup.
+// New types start with the rules an unknown type always had (e.g. Rushdown
+// still hits them for +15%) and can be tuned with setTypeMatchup.
+class ArchetypeTable {
+public:
+    enum : uint8_t { NEUTRAL = 0, RUSHDOWN, EVASIVE, GRAPPLER, HEAVY };
+    static const int MAX_ARCHETYPES = 32;
+    
+    ArchetypeTable() : count(0) {
+        for (int i = 0; i < MAX_ARCHETYPES; i++) {
+            evenRoundHeal[i] = 0;
+        }
+        add("");
+        add("Rushdown");
+        add("Evasive");
+        add("Grappler", 0.05);
+        add("Heavy");
+    }
+    
+    // Returns the id of a type, registering it on first use.
+    uint8_t idOf(const std::string& type) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = ids.find(type);
+        return it != ids.end() ? it->second : add(type);
+    }
+    
+    uint8_t define(const std::string& type, double healFraction) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = ids.find(type);
+        uint8_t id = it != ids.end() ? it->second : add(type);
+        evenRoundHeal[id] = healFraction;
+        return id;
+    }
+    
+    const DamageModifier& modifier(uint8_t attacker, uint8_t defender, int round) const {
+        return damage[attacker][defender][round & 1];
+    }
+    
+    void setModifier(uint8_t attacker, uint8_t defender, int parity, DamageModifier m) {
+        damage[attacker][defender][parity & 1] = m;
+    }
+    
+    // Fraction of maxHP healed at the start of even rounds while in the ring
+    double healFraction(uint8_t id) const { return evenRoundHeal[id]; }
+    
+private:
+    std::mutex lock;
+    std::unordered_map<std::string, uint8_t> ids;
+    int count;
+    DamageModifier damage[MAX_ARCHETYPES][MAX_ARCHETYPES][2];
+    double evenRoundHeal[MAX_ARCHETYPES];
+    
+    // The built-in type rules, used to fill the row and column of a new type
+    static DamageModifier rule(uint8_t attacker, uint8_t defender, int parity) {
+        DamageModifier m = {1.0, 1.0};
+        
+        // Attacker type bonuses
+        if (attacker == RUSHDOWN) {
+            m.attack = defender == GRAPPLER ? 1.20 : 1.15;
+        } else if (attacker == EVASIVE) {
+            m.attack = 1.07;
+        } else if (attacker == GRAPPLER && parity == 1) {
+            m.attack = 1.07;
+        }
+        
+        // Defender type resistances
+        if (defender == HEAVY) {
+            m.defense = attacker == EVASIVE ? 0.70 : 0.80;
+        } else if (defender == EVASIVE) {
+            m.defense = 0.93;
+        }
+        return m;
+    }
+    
+    uint8_t add(const std::string& type, double healFraction = 0) {
+        if (count == MAX_ARCHETYPES) {
+            throw std::length_error("too many fighter types (max " +
+                                    std::to_string(MAX_ARCHETYPES) + ")");
+        }
+        uint8_t id = (uint8_t)count++;
+        ids[type] = id;
+        evenRoundHeal[id] = healFraction;
+        for (uint8_t other = 0; other <= id; other++) {
+            for (int parity = 0; parity < 2; parity++) {
+                damage[id][other][parity] = rule(id, other, parity);
+                damage[other][id][parity] = rule(other, id, parity);
+            }
+        }
+        return id;
+    }
+};
+
+inline ArchetypeTable& archetypes() {
+    static ArchetypeTable table;
+    return table;
+}
 
 // ========== COMMAND SYSTEM ==========
 
@@ -36,6 +241,7 @@ public:
     }
     
     void execute(Fighter* attacker, Fighter* defender, int round) override {
+        TEKKEN_PROFILE_COMMAND(COMPOSITE);
         for (auto& cmd : commands) {
             cmd->execute(attacker, defender, round);
         }
@@ -50,6 +256,198 @@ public:
     }
 };
 
+// ========== DUEL ARENA ==========
+//
+// Monotonic allocator for the state of one match. Allocation bumps a
+// pointer in the current block and nothing is freed on its own; reset()
+// hands every block back for the next match in one step. Blocks are kept,
+// so a warmed-up arena does not call the system allocator.
+
+class DuelArena {
+    struct Block {
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t current;     // block being filled
+    size_t used;        // bytes taken from blocks[current]
+    size_t nextSize;
+
+public:
+    explicit DuelArena(size_t firstBlock = 4096) : current(0), used(0), nextSize(firstBlock) {}
+    ~DuelArena() {
+        for (auto& b : blocks) ::operator delete(b.data);
+    }
+    DuelArena(const DuelArena&) = delete;
+    DuelArena& operator=(const DuelArena&) = delete;
+
+    void* allocate(size_t bytes, size_t align) {
+        for (;;) {
+            if (current < blocks.size()) {
+                size_t offset = (used + align - 1) & ~(align - 1);
+                if (offset + bytes <= blocks[current].size) {
+                    used = offset + bytes;
+                    return blocks[current].data + offset;
+                }
+                current++;
+                used = 0;
+            } else {
+                size_t size = std::max(nextSize, bytes + align);
+                nextSize = size * 2;
+                Block b = {static_cast<char*>(::operator new(size)), size};
+                blocks.push_back(b);
+            }
+        }
+    }
+
+    // Everything allocated so far becomes invalid.
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+
+    size_t capacity() const {
+        size_t total = 0;
+        for (auto& b : blocks) total += b.size;
+        return total;
+    }
+};
+
+// Standard allocator on top of a DuelArena; without an arena it uses the
+// heap. Copies of a container go to the heap, so a copied fighter never
+// points into another match's arena.
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    DuelArena* arena;
+
+    ArenaAllocator(DuelArena* a = nullptr) : arena(a) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        void* p = arena ? arena->allocate(n * sizeof(T), alignof(T)) : ::operator new(n * sizeof(T));
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) {
+        if (!arena) ::operator delete(p);
+    }
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+// ========== EFFECT SCHEDULING ==========
+//
+// Pending AFTER_ROUNDS/FOR_ROUNDS effects of one fighter. Instead of a
+// countdown per entry they store the owner's turn number (one tick per
+// process() call) on which they are due, so a turn only touches the
+// effects that actually run.
+
+struct ScheduledEffect {
+    int64_t tick;       // turn on which the effect fires (delayed) or runs for the last time (recurring)
+    uint64_t seq;       // scheduling order
+    std::shared_ptr<Command> cmd;
+};
+
+typedef std::vector<ScheduledEffect, ArenaAllocator<ScheduledEffect>> EffectVector;
+
+// Min-heap on (tick, seq): effects due on the same turn fire in the order
+// they were scheduled, and a turn with nothing due costs one comparison.
+class DelayedEffects {
+    EffectVector heap;
+    int64_t now;
+    uint64_t nextSeq;
+
+    static bool later(const ScheduledEffect& a, const ScheduledEffect& b) {
+        return a.tick != b.tick ? a.tick > b.tick : a.seq > b.seq;
+    }
+
+public:
+    DelayedEffects() : now(0), nextSeq(0) {}
+
+    // Fires on the owner's `rounds`-th turn from now (the next one if rounds <= 1)
+    void add(int rounds, std::shared_ptr<Command> cmd) {
+        ScheduledEffect e = {now + std::max(rounds, 1), nextSeq++, std::move(cmd)};
+        heap.push_back(std::move(e));
+        std::push_heap(heap.begin(), heap.end(), later);
+    }
+
+    // Starts the owner's next turn and fires what is due on it. Effects
+    // scheduled while firing are due on a later turn.
+    void process(Fighter* owner, Fighter* defender, int round) {
+        ++now;
+        while (!heap.empty() && heap.front().tick <= now) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            std::shared_ptr<Command> cmd = std::move(heap.back().cmd);
+            heap.pop_back();
+            cmd->execute(owner, defender, round);
+        }
+    }
+
+    // Owner turns processed so far, and the pending effects in heap order
+    int64_t turn() const { return now; }
+    const EffectVector& entries() const { return heap; }
+
+    void clear() { heap.clear(); now = 0; nextSeq = 0; }
+    // Drops pending effects and their storage; new ones go to `arena`
+    void useArena(DuelArena* arena) { heap = EffectVector(arena); now = 0; nextSeq = 0; }
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
+};
+
+// Runs every effect on each of the owner's turns, in scheduling order,
+// until its last tick. Entries are only compacted on turns where one expires.
+class RecurringEffects {
+    EffectVector list;
+    int64_t now;
+    int64_t firstExpiry;
+
+public:
+    RecurringEffects() : now(0), firstExpiry(INT64_MAX) {}
+
+    // Runs on the owner's next `rounds` turns (once if rounds <= 1)
+    void add(int rounds, std::shared_ptr<Command> cmd) {
+        ScheduledEffect e = {now + std::max(rounds, 1), 0, std::move(cmd)};
+        firstExpiry = std::min(firstExpiry, e.tick);
+        list.push_back(std::move(e));
+    }
+
+    // Entries are addressed by index because running an effect may
+    // schedule another one; those start on the next turn.
+    void process(Fighter* owner, Fighter* defender, int round) {
+        ++now;
+        size_t count = list.size();
+        for (size_t i = 0; i < count; i++) {
+            list[i].cmd->execute(owner, defender, round);
+        }
+        if (firstExpiry > now) return;
+
+        size_t kept = 0;
+        firstExpiry = INT64_MAX;
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i].tick <= now) continue;
+            firstExpiry = std::min(firstExpiry, list[i].tick);
+            if (kept != i) list[kept] = std::move(list[i]);
+            kept++;
+        }
+        list.erase(list.begin() + kept, list.end());
+    }
+
+    // Owner turns processed so far, and the pending effects in scheduling order
+    int64_t turn() const { return now; }
+    const EffectVector& entries() const { return list; }
+
+    void clear() { list.clear(); now = 0; firstExpiry = INT64_MAX; }
+    void useArena(DuelArena* arena) { list = EffectVector(arena); now = 0; firstExpiry = INT64_MAX; }
+    bool empty() const { return list.empty(); }
+    size_t size() const { return list.size(); }
+};
+
 // ========== FIGHTER CLASS ==========
 
 class Fighter {
@@ -59,53 +457,51 @@ public:
     double maxHP;
     double currentHP;
     bool inRing;
+    uint32_t nameId;    // internSymbol(name)
+    uint32_t typeId;    // internSymbol(type)
+    uint8_t archetype;  // archetypes().idOf(type)
     std::vector<std::shared_ptr<Ability>> abilities;
-    std::vector<std::pair<int, std::shared_ptr<Command>>> delayedCommands;
-    std::vector<std::pair<int, std::shared_ptr<Command>>> recurringCommands;
+    DelayedEffects delayedCommands;
+    RecurringEffects recurringCommands;
     
     Fighter(const std::string& n, const std::string& t, double hp)
-        : name(n), type(t), maxHP(hp), currentHP(hp), inRing(true) {}
+        : name(n), type(t), maxHP(hp), currentHP(hp), inRing(true),
+          nameId(internSymbol(n)), typeId(internSymbol(t)),
+          archetype(archetypes().idOf(t)) {}
     
     void takeDamage(double amount, Fighter* attacker, int round) {
         if (!inRing) return;
         
-        double finalDamage = amount;
-        
-        // Attacker type bonuses
-        if (attacker->type == "Rushdown") {
-            if (this->type == "Grappler") {
-                finalDamage *= 1.20;
-            } else {
-                finalDamage *= 1.15;
-            }
-        } else if (attacker->type == "Evasive") {
-            finalDamage *= 1.07;
-        } else if (attacker->type == "Grappler" && round % 2 == 1) {
-            finalDamage *= 1.07;
-        }
-        
-        // Defender type resistances
-        if (this->type == "Heavy") {
-            if (attacker->type == "Evasive") {
-                finalDamage *= 0.70;
-            } else {
-                finalDamage *= 0.80;
-            }
-        } else if (this->type == "Evasive") {
-            finalDamage *= 0.93;
-        }
+        // Attacker bonus and defender resistance for this pair of types
+        const DamageModifier& m = archetypes().modifier(attacker->archetype, archetype, round);
+        double finalDamage = amount * m.attack * m.defense;
         
         currentHP -= finalDamage;
         if (currentHP < 0) currentHP = 0;
+        TEKKEN_EVENT(damage(*this, finalDamage, round));
     }
     
     void heal(double amount) {
         currentHP += amount;
         if (currentHP > maxHP) currentHP = maxHP;
+        TEKKEN_EVENT(heal(*this, amount));
     }
     
-    void leaveRing() { inRing = false; }
-    void enterRing() { inRing = true; }
+    // Start-of-round heal of the fighter's type (Grappler: 5% on even rounds).
+    // Returns the amount, or 0 if the type does not heal.
+    double typeHealAmount() const {
+        double fraction = archetypes().healFraction(archetype);
+        return fraction > 0 && inRing ? maxHP * fraction : 0;
+    }
+    
+    void leaveRing() {
+        inRing = false;
+        TEKKEN_EVENT(tag(*this, false));
+    }
+    void enterRing() {
+        inRing = true;
+        TEKKEN_EVENT(tag(*this, true));
+    }
     bool isAlive() const { return currentHP > 0; }
     
     void addAbility(std::shared_ptr<Ability> ability) {
@@ -113,75 +509,221 @@ public:
     }
     
     void addDelayedCommand(int rounds, std::shared_ptr<Command> cmd) {
-        delayedCommands.push_back({rounds, cmd});
+        delayedCommands.add(rounds, std::move(cmd));
     }
     
     void addRecurringCommand(int rounds, std::shared_ptr<Command> cmd) {
-        recurringCommands.push_back({rounds, cmd});
+        recurringCommands.add(rounds, std::move(cmd));
     }
     
     void processDelayedCommands(Fighter* defender, int round) {
-        std::vector<std::pair<int, std::shared_ptr<Command>>> remaining;
-        for (auto& delayed : delayedCommands) {
-            delayed.first--;
-            if (delayed.first <= 0) {
-                delayed.second->execute(this, defender, round);
-            } else {
-                remaining.push_back(delayed);
-            }
-        }
-        delayedCommands = remaining;
+        delayedCommands.process(this, defender, round);
     }
     
     void processRecurringCommands(Fighter* defender, int round) {
-        std::vector<std::pair<int, std::shared_ptr<Command>>> remaining;
-        for (auto& recurring : recurringCommands) {
-            recurring.second->execute(this, defender, round);
-            recurring.first--;
-            if (recurring.first > 0) {
-                remaining.push_back(recurring);
-            }
-        }
-        recurringCommands = remaining;
+        recurringCommands.process(this, defender, round);
     }
     
+    // Brings the fighter back to full health with no pending effects.
+    // Keeps the capacity of the effect queues for reuse.
+    void reset() {
+        currentHP = maxHP;
+        inRing = true;
+        delayedCommands.clear();
+        recurringCommands.clear();
+    }
+    
+    // Like reset(), but the effect queues release their storage and
+    // allocate from `arena` (nullptr: the heap) until the next call.
+    // Call it before resetting the arena the queues used.
+    void reset(DuelArena* arena) {
+        currentHP = maxHP;
+        inRing = true;
+        delayedCommands.useArena(arena);
+        recurringCommands.useArena(arena);
+    }
+    
+public:
     void displayStatus() const {
         std::cout << "Name: " << name << "\n";
         std::cout << "HP: " << (int)currentHP << "\n";
         std::cout << "Type: " << type << "\n";
-        std::cout << std::endl;
+        std::cout << "\n";
     }
 };
 
+// ========== BYTECODE ==========
+
+// A command tree lowered into a flat instruction array (see AbilityCompiler).
+// Operands refer to the program's pools; branch targets are instruction indices.
+enum class OpCode : uint8_t {
+    DAMAGE,             // target->takeDamage(amount, attacker, round)
+    HEAL,               // target->heal(amount)
+    TAG_OUT,            // target->leaveRing()
+    TAG_IN,             // target->enterRing()
+    FOR_ROUNDS,         // attacker->addRecurringCommand(count, commands[index])
+    AFTER_ROUNDS,       // defender->addDelayedCommand(count, commands[index])
+    BRANCH_IF_FALSE,    // if (!tape at conditionCode[index]) jump to target
+    JUMP,               // jump to target
+    EXECUTE,            // commands[index]->execute(...) for nodes with no opcode
+    END
+};
+
+struct Instruction {
+    OpCode op;
+    bool onDefender;    // DAMAGE/HEAL/TAG: apply to the defender instead of the attacker
+    int32_t index;      // pool index
+    int32_t target;     // jump target
+    int32_t count;      // rounds for FOR_ROUNDS/AFTER_ROUNDS
+    double amount;      // DAMAGE/HEAL amount
+};
+
+// Condition expressions are lowered into a tape evaluated with a single
+// boolean register: leaves set it, AND/OR short-circuit by jumping to the
+// end of their operand list, NOT flips it.
+enum class CmpOp : uint8_t { EQ, NE, GT, GE, LT, LE, INVALID };
+
+inline CmpOp parseCmpOp(const std::string& op) {
+    if (op == "==") return CmpOp::EQ;
+    if (op == "!=") return CmpOp::NE;
+    if (op == ">") return CmpOp::GT;
+    if (op == ">=") return CmpOp::GE;
+    if (op == "<") return CmpOp::LT;
+    if (op == "<=") return CmpOp::LE;
+    return CmpOp::INVALID;
+}
+
+inline bool compareValues(CmpOp op, double lval, double rval) {
+    switch (op) {
+        case CmpOp::EQ: return std::abs(lval - rval) < 0.001;
+        case CmpOp::NE: return std::abs(lval - rval) >= 0.001;
+        case CmpOp::GT: return lval > rval;
+        case CmpOp::GE: return lval >= rval;
+        case CmpOp::LT: return lval < rval;
+        case CmpOp::LE: return lval <= rval;
+        default: return false;
+    }
+}
+
+// Where a DSL value comes from. Literals and the values built by GET_HP,
+// GET_TYPE, GET_NAME and IS_OUT_OF_RING record their source so that they
+// can be read straight from the fighter; anything else is a FUNCTION.
+struct ValueSource {
+    enum Kind : uint8_t { FUNCTION, CONSTANT, HP, OUT_OF_RING, TYPE, NAME };
+    Kind kind;
+    bool isAttacker;
+    double constant;
+    
+    static ValueSource of(Kind k, bool attacker = false, double c = 0) {
+        ValueSource src;
+        src.kind = k;
+        src.isAttacker = attacker;
+        src.constant = c;
+        return src;
+    }
+};
+
+enum class CondOp : uint8_t {
+    COMPARE,            // r = lhs <cmp> rhs
+    SYMBOL_COMPARE,     // r = (lhs symbol == symbol) for EQ, != for NE
+    EVALUATE,           // r = exprs[index]->evaluate(...) for opaque leaves
+    SET,                // r = value (empty AND/OR)
+    JUMP_IF_FALSE,      // AND: stop at the first false operand
+    JUMP_IF_TRUE,       // OR: stop at the first true operand
+    NOT,                // r = !r
+    END
+};
+
+struct CondInstruction {
+    CondOp op;
+    CmpOp cmp;
+    bool value;
+    int32_t index;
+    int32_t target;
+    uint32_t symbol;
+    ValueSource lhs;
+    ValueSource rhs;
+};
+
+// Bytecode array of a Program: built in place by the compiler, or a
+// read-only view of storage that `owner` keeps alive (e.g. a memory-mapped
+// ruleset cache, see Ruleset.h). Only owned arrays can be modified.
+template <typename T>
+class CodeBuffer {
+    std::vector<T> owned;
+    const T* view;
+    size_t viewSize;
+    std::shared_ptr<const void> owner;
+
+public:
+    CodeBuffer() : view(nullptr), viewSize(0) {}
+
+    static CodeBuffer borrow(const T* data, size_t size, std::shared_ptr<const void> owner) {
+        CodeBuffer buffer;
+        buffer.view = data;
+        buffer.viewSize = size;
+        buffer.owner = std::move(owner);
+        return buffer;
+    }
+
+    bool borrowed() const { return view != nullptr; }
+    const T* data() const { return view ? view : owned.data(); }
+    size_t size() const { return view ? viewSize : owned.size(); }
+    bool empty() const { return size() == 0; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+    const T& operator[](size_t i) const { return data()[i]; }
+
+    T& operator[](size_t i) { return owned[i]; }
+    T& back() { return owned.back(); }
+    void push_back(const T& value) { owned.push_back(value); }
+};
+
+struct Program {
+    CodeBuffer<Instruction> code;
+    CodeBuffer<CondInstruction> conditionCode;
+    std::vector<std::shared_ptr<ConditionExpr>> conditions;
+    std::vector<std::shared_ptr<Command>> commands;
+    
+    bool empty() const { return code.empty(); }
+};
+
 // ========== ABILITY CLASS ==========
 
 class Ability {
 public:
     std::string name;
     std::shared_ptr<Command> action;
+    Program program;
+#ifdef TEKKEN_PROFILE
+    uint32_t profileId;     // row of this ability in profileReport()
+    
+    Ability(const std::string& n) : name(n), profileId(profileRegistry().registerAbility(n)) {}
+#else
     
     Ability(const std::string& n) : name(n) {}
+#endif
     
-    void setAction(std::shared_ptr<Command> cmd) {
-        action = cmd;
-    }
+    // Compiles the action into bytecode. Changes made to the command tree
+    // afterwards are only picked up by calling setAction again.
+    void setAction(std::shared_ptr<Command> cmd);
     
-    void use(Fighter* attacker, Fighter* defender, int round) {
-        if (action) {
-            action->execute(attacker, defender, round);
-        }
-    }
+    void use(Fighter* attacker, Fighter* defender, int round);
 };
 
 // ========== SPECIFIC COMMANDS ==========
 
 class DamageCommand : public Command {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
     bool isDefender;
     double amount;
 public:
     DamageCommand(bool def, double a) : isDefender(def), amount(a) {}
     
     void execute(Fighter* attacker, Fighter* defender, int round) override {
+        TEKKEN_PROFILE_COMMAND(DAMAGE);
         Fighter* target = isDefender ? defender : attacker;
         target->takeDamage(amount, attacker, round);
     }
@@ -192,12 +734,16 @@ public:
 };
 
 class HealCommand : public Command {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
     bool isDefender;
     double amount;
 public:
     HealCommand(bool def, double a) : isDefender(def), amount(a) {}
     
     void execute(Fighter* attacker, Fighter* defender, int /*round*/) override {
+        TEKKEN_PROFILE_COMMAND(HEAL);
         Fighter* target = isDefender ? defender : attacker;
         target->heal(amount);
     }
@@ -215,6 +761,7 @@ public:
     TagCommand(bool def, bool o) : isDefender(def), out(o) {}
     
     void execute(Fighter* attacker, Fighter* defender, int /*round*/) override {
+        TEKKEN_PROFILE_COMMAND(TAG);
         Fighter* target = isDefender ? defender : attacker;
         if (out) {
             target->leaveRing();
@@ -229,12 +776,16 @@ public:
 };
 
 class ForRoundsCommand : public Command {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
     int rounds;
     std::shared_ptr<Command> cmd;
 public:
     ForRoundsCommand(int r, std::shared_ptr<Command> c) : rounds(r), cmd(c) {}
     
     void execute(Fighter* attacker, Fighter* /*defender*/, int /*round*/) override {
+        TEKKEN_PROFILE_COMMAND(FOR_ROUNDS);
         attacker->addRecurringCommand(rounds, cmd);
     }
     
@@ -244,25 +795,28 @@ public:
 };
 
 class AfterRoundsCommand : public Command {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
     int rounds;
     std::shared_ptr<Command> cmd;
+    std::shared_ptr<Command> scheduled;
 public:
-    AfterRoundsCommand(int r, std::shared_ptr<Command> c) : rounds(r), cmd(c) {}
-    
-    void execute(Fighter* /*attacker*/, Fighter* defender, int /*round*/) override {
+    AfterRoundsCommand(int r, std::shared_ptr<Command> c) : rounds(r), cmd(c), scheduled(c) {
         // If the command is TAG_DEFENDER_IN, convert it to TAG_ATTACKER_IN
         // so it brings the defender back in (since the delayed command will execute
         // with the defender as the attacker)
         auto tagCmd = std::dynamic_pointer_cast<TagCommand>(cmd);
         if (tagCmd && tagCmd->isDefender && !tagCmd->out) {
-            // Change to TAG_ATTACKER_IN
-            auto newCmd = std::make_shared<TagCommand>(false, false);
-            defender->addDelayedCommand(rounds, newCmd);
-        } else {
-            defender->addDelayedCommand(rounds, cmd);
+            scheduled = std::make_shared<TagCommand>(false, false);
         }
     }
     
+    void execute(Fighter* /*attacker*/, Fighter* defender, int /*round*/) override {
+        TEKKEN_PROFILE_COMMAND(AFTER_ROUNDS);
+        defender->addDelayedCommand(rounds, scheduled);
+    }
+    
     std::shared_ptr<Command> clone() const override {
         return std::make_shared<AfterRoundsCommand>(rounds, cmd->clone());
     }
@@ -277,58 +831,96 @@ public:
     virtual std::shared_ptr<ConditionExpr> clone() const = 0;
 };
 
+inline double readNumeric(const ValueSource& src, Fighter* attacker, Fighter* defender) {
+    Fighter* f = src.isAttacker ? attacker : defender;
+    switch (src.kind) {
+        case ValueSource::HP: return f->currentHP;
+        case ValueSource::OUT_OF_RING: return f->inRing ? 0.0 : 1.0;
+        default: return src.constant;
+    }
+}
+
+inline uint32_t readSymbol(const ValueSource& src, Fighter* attacker, Fighter* defender) {
+    Fighter* f = src.isAttacker ? attacker : defender;
+    return src.kind == ValueSource::TYPE ? f->typeId : f->nameId;
+}
+
 class ComparisonExpr : public ConditionExpr {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
     std::function<double(Fighter*, Fighter*)> left;
     std::function<double(Fighter*, Fighter*)> right;
-    std::string op;
+    ValueSource leftSource;
+    ValueSource rightSource;
+    CmpOp op;
 public:
     ComparisonExpr(std::function<double(Fighter*, Fighter*)> l,
                    std::function<double(Fighter*, Fighter*)> r,
                    const std::string& o)
-        : left(l), right(r), op(o) {}
+        : left(l), right(r),
+          leftSource(ValueSource::of(ValueSource::FUNCTION)),
+          rightSource(ValueSource::of(ValueSource::FUNCTION)),
+          op(parseCmpOp(o)) {}
+    
+    ComparisonExpr(std::function<double(Fighter*, Fighter*)> l, ValueSource ls,
+                   std::function<double(Fighter*, Fighter*)> r, ValueSource rs,
+                   CmpOp o)
+        : left(l), right(r), leftSource(ls), rightSource(rs), op(o) {}
     
     bool evaluate(Fighter* attacker, Fighter* defender) override {
-        double lval = left(attacker, defender);
-        double rval = right(attacker, defender);
-        
-        if (op == "==") return std::abs(lval - rval) < 0.001;
-        if (op == "!=") return std::abs(lval - rval) >= 0.001;
-        if (op == ">") return lval > rval;
-        if (op == ">=") return lval >= rval;
-        if (op == "<") return lval < rval;
-        if (op == "<=") return lval <= rval;
-        return false;
+        double lval = leftSource.kind == ValueSource::FUNCTION
+            ? left(attacker, defender) : readNumeric(leftSource, attacker, defender);
+        double rval = rightSource.kind == ValueSource::FUNCTION
+            ? right(attacker, defender) : readNumeric(rightSource, attacker, defender);
+        return TEKKEN_PROFILE_CONDITION(COMPARE, compareValues(op, lval, rval));
     }
     
     std::shared_ptr<ConditionExpr> clone() const override {
-        return std::make_shared<ComparisonExpr>(left, right, op);
+        return std::make_shared<ComparisonExpr>(left, leftSource, right, rightSource, op);
     }
 };
 
 class StringComparisonExpr : public ConditionExpr {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
     std::function<std::string(Fighter*, Fighter*)> left;
+    ValueSource leftSource;
     std::string right;
-    std::string op;
+    uint32_t rightSymbol;
+    CmpOp op;
 public:
     StringComparisonExpr(std::function<std::string(Fighter*, Fighter*)> l,
                          const std::string& r,
                          const std::string& o)
-        : left(l), right(r), op(o) {}
+        : left(l), leftSource(ValueSource::of(ValueSource::FUNCTION)),
+          right(r), rightSymbol(internSymbol(r)), op(parseCmpOp(o)) {}
+    
+    StringComparisonExpr(std::function<std::string(Fighter*, Fighter*)> l, ValueSource ls,
+                         const std::string& r, CmpOp o)
+        : left(l), leftSource(ls), right(r), rightSymbol(internSymbol(r)), op(o) {}
     
     bool evaluate(Fighter* attacker, Fighter* defender) override {
-        std::string lval = left(attacker, defender);
-        
-        if (op == "==") return lval == right;
-        if (op == "!=") return lval != right;
-        return false;
+        if (op != CmpOp::EQ && op != CmpOp::NE) return TEKKEN_PROFILE_CONDITION(STRING_COMPARE, false);
+        bool equal;
+        if (leftSource.kind == ValueSource::FUNCTION) {
+            equal = left(attacker, defender) == right;
+        } else {
+            equal = readSymbol(leftSource, attacker, defender) == rightSymbol;
+        }
+        return TEKKEN_PROFILE_CONDITION(STRING_COMPARE, op == CmpOp::EQ ? equal : !equal);
     }
     
     std::shared_ptr<ConditionExpr> clone() const override {
-        return std::make_shared<StringComparisonExpr>(left, right, op);
+        return std::make_shared<StringComparisonExpr>(left, leftSource, right, op);
     }
 };
 
 class AndExpr : public ConditionExpr {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
 public:
     std::vector<std::shared_ptr<ConditionExpr>> conditions;
     
@@ -344,9 +936,9 @@ public:
     
     bool evaluate(Fighter* attacker, Fighter* defender) override {
         for (auto& cond : conditions) {
-            if (!cond->evaluate(attacker, defender)) return false;
+            if (!cond->evaluate(attacker, defender)) return TEKKEN_PROFILE_CONDITION(AND, false);
         }
-        return true;
+        return TEKKEN_PROFILE_CONDITION(AND, true);
     }
     
     std::shared_ptr<ConditionExpr> clone() const override {
@@ -359,6 +951,9 @@ public:
 };
 
 class OrExpr : public ConditionExpr {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
 public:
     std::vector<std::shared_ptr<ConditionExpr>> conditions;
     
@@ -374,9 +969,9 @@ public:
     
     bool evaluate(Fighter* attacker, Fighter* defender) override {
         for (auto& cond : conditions) {
-            if (cond->evaluate(attacker, defender)) return true;
+            if (cond->evaluate(attacker, defender)) return TEKKEN_PROFILE_CONDITION(OR, true);
         }
-        return false;
+        return TEKKEN_PROFILE_CONDITION(OR, false);
     }
     
     std::shared_ptr<ConditionExpr> clone() const override {
@@ -389,12 +984,15 @@ public:
 };
 
 class NotExpr : public ConditionExpr {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
     std::shared_ptr<ConditionExpr> condition;
 public:
     NotExpr(std::shared_ptr<ConditionExpr> cond) : condition(cond) {}
     
     bool evaluate(Fighter* attacker, Fighter* defender) override {
-        return !condition->evaluate(attacker, defender);
+        return TEKKEN_PROFILE_CONDITION(NOT, !condition->evaluate(attacker, defender));
     }
     
     std::shared_ptr<ConditionExpr> clone() const override {
@@ -402,7 +1000,24 @@ public:
     }
 };
 
+// A condition the optimizer has decided (see AbilityOptimizer)
+class ConstantCondition : public ConditionExpr {
+public:
+    bool value;
+    
+    explicit ConstantCondition(bool v) : value(v) {}
+    
+    bool evaluate(Fighter* /*attacker*/, Fighter* /*defender*/) override { return value; }
+    
+    std::shared_ptr<ConditionExpr> clone() const override {
+        return std::make_shared<ConstantCondition>(value);
+    }
+};
+
 class IfCommand : public Command {
+    friend class AbilityCompiler;
+    friend class AbilityOptimizer;
+    friend class OptimizerVerifier;
     std::shared_ptr<ConditionExpr> condition;
     std::shared_ptr<Command> thenCmd;
     std::shared_ptr<Command> elseCmd;
@@ -413,7 +1028,8 @@ public:
         : condition(cond), thenCmd(then), elseCmd(els) {}
     
     void execute(Fighter* attacker, Fighter* defender, int round) override {
-        if (condition->evaluate(attacker, defender)) {
+        TEKKEN_PROFILE_COMMAND(IF);
+        if (TEKKEN_PROFILE_CONDITION(BRANCH, condition->evaluate(attacker, defender))) {
             if (thenCmd) thenCmd->execute(attacker, defender, round);
         } else {
             if (elseCmd) elseCmd->execute(attacker, defender, round);
@@ -439,10 +1055,19 @@ public:
     }
     
     void execute(Fighter* attacker, Fighter* defender, int /*round*/) override {
+        TEKKEN_PROFILE_COMMAND(SHOW);
+#ifndef TEKKEN_NO_EVENTS
+        EventSink* sink = eventSink();
+        if (!sink) return;
+        std::string text;
         for (auto& part : parts) {
-            std::cout << part(attacker, defender);
+            text += part(attacker, defender);
         }
-        std::cout << std::endl;
+        sink->show(text);
+#else
+        (void)attacker;
+        (void)defender;
+#endif
     }
     
     std::shared_ptr<Command> clone() const override {
@@ -452,65 +1077,918 @@ public:
     }
 };
 
-// ========== VALUE WRAPPERS ==========
+// ========== BYTECODE COMPILER ==========
 
-class NumericValue {
-    std::function<double(Fighter*, Fighter*)> value;
+// Evaluates the condition tape starting at conditionCode[start].
+inline bool runCondition(const Program& program, int32_t start, Fighter* attacker, Fighter* defender) {
+    const CondInstruction* code = program.conditionCode.data();
+    bool r = false;
+    for (const CondInstruction* in = code + start; in->op != CondOp::END; ++in) {
+        switch (in->op) {
+            case CondOp::COMPARE:
+                r = TEKKEN_PROFILE_CONDITION(COMPARE, compareValues(in->cmp, readNumeric(in->lhs, attacker, defender),
+                                                                             readNumeric(in->rhs, attacker, defender)));
+                break;
+            case CondOp::SYMBOL_COMPARE:
+                r = TEKKEN_PROFILE_CONDITION(STRING_COMPARE,
+                                             (readSymbol(in->lhs, attacker, defender) == in->symbol) == (in->cmp == CmpOp::EQ));
+                break;
+            case CondOp::EVALUATE:
+                r = program.conditions[in->index]->evaluate(attacker, defender);
+                break;
+            case CondOp::SET:
+                r = in->value;
+                break;
+            case CondOp::JUMP_IF_FALSE:
+                if (!r) in = code + in->target - 1;
+                break;
+            case CondOp::JUMP_IF_TRUE:
+                if (r) in = code + in->target - 1;
+                break;
+            case CondOp::NOT:
+                r = !r;
+                break;
+            case CondOp::END:
+                break;
+        }
+    }
+    return r;
+}
+
+inline void runProgram(const Program& program, Fighter* attacker, Fighter* defender, int round) {
+    const Instruction* code = program.code.data();
+    for (const Instruction* in = code; in->op != OpCode::END; ++in) {
+        Fighter* target = in->onDefender ? defender : attacker;
+        switch (in->op) {
+            case OpCode::DAMAGE:
+                TEKKEN_PROFILE_COMMAND(DAMAGE);
+                target->takeDamage(in->amount, attacker, round);
+                break;
+            case OpCode::HEAL:
+                TEKKEN_PROFILE_COMMAND(HEAL);
+                target->heal(in->amount);
+                break;
+            case OpCode::TAG_OUT:
+                TEKKEN_PROFILE_COMMAND(TAG);
+                target->leaveRing();
+                break;
+            case OpCode::TAG_IN:
+                TEKKEN_PROFILE_COMMAND(TAG);
+                target->enterRing();
+                break;
+            case OpCode::FOR_ROUNDS:
+                TEKKEN_PROFILE_COMMAND(FOR_ROUNDS);
+                attacker->addRecurringCommand(in->count, program.commands[in->index]);
+                break;
+            case OpCode::AFTER_ROUNDS:
+                TEKKEN_PROFILE_COMMAND(AFTER_ROUNDS);
+                defender->addDelayedCommand(in->count, program.commands[in->index]);
+                break;
+            case OpCode::BRANCH_IF_FALSE:
+                TEKKEN_PROFILE_COMMAND(IF);
+                // The loop increment steps onto the target
+                if (!TEKKEN_PROFILE_CONDITION(BRANCH, runCondition(program, in->index, attacker, defender))) {
+                    in = code + in->target - 1;
+                }
+                break;
+            case OpCode::JUMP:
+                in = code + in->target - 1;
+                break;
+            case OpCode::EXECUTE:
+                program.commands[in->index]->execute(attacker, defender, round);
+                break;
+            case OpCode::END:
+                break;
+        }
+    }
+}
+
+// Command scheduled by FOR_ROUNDS/AFTER_ROUNDS bytecode: the compiled form
+// of the scheduled subtree, so delayed and recurring effects also run
+// through the interpreter.
+class CompiledCommand : public Command {
 public:
-    NumericValue(double val) : value([val](Fighter*, Fighter*) { return val; }) {}
-    NumericValue(std::function<double(Fighter*, Fighter*)> val) : value(val) {}
+    std::shared_ptr<Command> source;
+    Program program;
     
-    std::function<double(Fighter*, Fighter*)> getValue() const { return value; }
+    void execute(Fighter* attacker, Fighter* defender, int round) override {
+        TEKKEN_PROFILE_COMMAND(COMPILED);
+        runProgram(program, attacker, defender, round);
+    }
     
-    std::shared_ptr<ConditionExpr> operator==(const NumericValue& other) const {
-        return std::make_shared<ComparisonExpr>(value, other.value, "==");
+    // Programs loaded from a ruleset cache have no command tree
+    std::shared_ptr<Command> clone() const override {
+        return source ? source->clone() : std::make_shared<CompiledCommand>(*this);
     }
-    std::shared_ptr<ConditionExpr> operator!=(const NumericValue& other) const {
-        return std::make_shared<ComparisonExpr>(value, other.value, "!=");
+};
+
+// Lowers a command tree into a Program. Composites are inlined, IF_THEN_ELSE
+// becomes a conditional branch around the two arms, and nodes without an
+// opcode (ShowCommand, user-defined commands) are called through EXECUTE.
+class AbilityCompiler {
+    Program& out;
+    
+    explicit AbilityCompiler(Program& p) : out(p) {}
+    
+    Instruction& emit(OpCode op, bool onDefender = false) {
+        Instruction in;
+        in.op = op;
+        in.onDefender = onDefender;
+        in.index = 0;
+        in.target = 0;
+        in.count = 0;
+        in.amount = 0;
+        out.code.push_back(in);
+        return out.code.back();
     }
-    std::shared_ptr<ConditionExpr> operator>(const NumericValue& other) const {
-        return std::make_shared<ComparisonExpr>(value, other.value, ">");
+    
+    int32_t addCommand(std::shared_ptr<Command> cmd) {
+        out.commands.push_back(cmd);
+        return (int32_t)out.commands.size() - 1;
+    }
+    
+    CondInstruction& emitCondition(CondOp op) {
+        CondInstruction in;
+        in.op = op;
+        in.cmp = CmpOp::INVALID;
+        in.value = false;
+        in.index = 0;
+        in.target = 0;
+        in.symbol = 0;
+        in.lhs = ValueSource::of(ValueSource::CONSTANT);
+        in.rhs = ValueSource::of(ValueSource::CONSTANT);
+        out.conditionCode.push_back(in);
+        return out.conditionCode.back();
+    }
+    
+    // Leaves whose values come from opaque functions are called through
+    // EVALUATE; everything else reads the fighters directly.
+    void lowerCondition(const std::shared_ptr<ConditionExpr>& node) {
+        ConditionExpr* cond = node.get();
+        if (auto c = dynamic_cast<ComparisonExpr*>(cond)) {
+            if (c->leftSource.kind != ValueSource::FUNCTION &&
+                c->rightSource.kind != ValueSource::FUNCTION) {
+                CondInstruction& in = emitCondition(CondOp::COMPARE);
+                in.cmp = c->op;
+                in.lhs = c->leftSource;
+                in.rhs = c->rightSource;
+                return;
+            }
+        } else if (auto c = dynamic_cast<StringComparisonExpr*>(cond)) {
+            if (c->leftSource.kind == ValueSource::TYPE || c->leftSource.kind == ValueSource::NAME) {
+                if (c->op == CmpOp::EQ || c->op == CmpOp::NE) {
+                    CondInstruction& in = emitCondition(CondOp::SYMBOL_COMPARE);
+                    in.cmp = c->op;
+                    in.lhs = c->leftSource;
+                    in.symbol = c->rightSymbol;
+                } else {
+                    emitCondition(CondOp::SET).value = false;
+                }
+                return;
+            }
+        } else if (auto c = dynamic_cast<AndExpr*>(cond)) {
+            lowerJunction(c->conditions, CondOp::JUMP_IF_FALSE, true);
+            return;
+        } else if (auto c = dynamic_cast<OrExpr*>(cond)) {
+            lowerJunction(c->conditions, CondOp::JUMP_IF_TRUE, false);
+            return;
+        } else if (auto c = dynamic_cast<NotExpr*>(cond)) {
+            lowerCondition(c->condition);
+            emitCondition(CondOp::NOT);
+            return;
+        } else if (auto c = dynamic_cast<ConstantCondition*>(cond)) {
+            emitCondition(CondOp::SET).value = c->value;
+            return;
+        }
+        out.conditions.push_back(node);
+        emitCondition(CondOp::EVALUATE).index = (int32_t)out.conditions.size() - 1;
+    }
+    
+    void lowerJunction(const std::vector<std::shared_ptr<ConditionExpr>>& operands,
+                       CondOp shortCircuit, bool emptyValue) {
+        if (operands.empty()) {
+            emitCondition(CondOp::SET).value = emptyValue;
+            return;
+        }
+        std::vector<size_t> jumps;
+        for (size_t i = 0; i < operands.size(); i++) {
+            lowerCondition(operands[i]);
+            if (i + 1 < operands.size()) {
+                jumps.push_back(out.conditionCode.size());
+                emitCondition(shortCircuit);
+            }
+        }
+        for (size_t jump : jumps) {
+            out.conditionCode[jump].target = (int32_t)out.conditionCode.size();
+        }
+    }
+    
+    void lower(const std::shared_ptr<Command>& node) {
+        if (!node) return;
+        Command* cmd = node.get();
+        if (auto c = dynamic_cast<CompositeCommand*>(cmd)) {
+            for (auto& child : c->commands) lower(child);
+        } else if (auto c = dynamic_cast<DamageCommand*>(cmd)) {
+            emit(OpCode::DAMAGE, c->isDefender).amount = c->amount;
+        } else if (auto c = dynamic_cast<HealCommand*>(cmd)) {
+            emit(OpCode::HEAL, c->isDefender).amount = c->amount;
+        } else if (auto c = dynamic_cast<TagCommand*>(cmd)) {
+            emit(c->out ? OpCode::TAG_OUT : OpCode::TAG_IN, c->isDefender);
+        } else if (auto c = dynamic_cast<ForRoundsCommand*>(cmd)) {
+            int32_t index = addCommand(compileCommand(c->cmd));
+            Instruction& in = emit(OpCode::FOR_ROUNDS);
+            in.index = index;
+            in.count = c->rounds;
+        } else if (auto c = dynamic_cast<AfterRoundsCommand*>(cmd)) {
+            int32_t index = addCommand(compileCommand(c->scheduled));
+            Instruction& in = emit(OpCode::AFTER_ROUNDS);
+            in.index = index;
+            in.count = c->rounds;
+        } else if (auto c = dynamic_cast<IfCommand*>(cmd)) {
+            int32_t tape = (int32_t)out.conditionCode.size();
+            lowerCondition(c->condition);
+            emitCondition(CondOp::END);
+            size_t branch = out.code.size();
+            emit(OpCode::BRANCH_IF_FALSE).index = tape;
+            lower(c->thenCmd);
+            if (c->elseCmd) {
+                size_t jump = out.code.size();
+                emit(OpCode::JUMP);
+                out.code[branch].target = (int32_t)out.code.size();
+                lower(c->elseCmd);
+                out.code[jump].target = (int32_t)out.code.size();
+            } else {
+                out.code[branch].target = (int32_t)out.code.size();
+            }
+        } else {
+            emit(OpCode::EXECUTE).index = addCommand(node);
+        }
+    }
+    
+public:
+    static Program compile(const std::shared_ptr<Command>& root) {
+        Program program;
+        AbilityCompiler compiler(program);
+        compiler.lower(root);
+        compiler.emit(OpCode::END);
+        return program;
+    }
+    
+    static std::shared_ptr<Command> compileCommand(const std::shared_ptr<Command>& root) {
+        auto cmd = std::make_shared<CompiledCommand>();
+        cmd->source = root;
+        cmd->program = compile(root);
+        return cmd;
+    }
+};
+
+// ========== ABILITY OPTIMIZER ==========
+//
+// Rewrites an ability's command tree before it is compiled (Ability::setAction).
+// Every default rewrite leaves both fighters in a bit-identical state:
+//  - nested composites are flattened, a composite of one command becomes
+//    that command and empty ones disappear;
+//  - comparisons of constants, NOT/AND/OR with constant operands and
+//    string comparisons that can only be false are folded; NOT(NOT(c)) is c;
+//  - an IF with a constant condition becomes one of its arms, an IF with
+//    identical arms and a side-effect-free condition becomes the arm, and
+//    IF(NOT(c), a, b) becomes IF(c, b, a);
+//  - a condition that was already decided on the way to a node is replaced
+//    by its value: inside IF(c, ...), and after c in AND/OR. Type and name
+//    checks stay decided for the whole ability, HP and ring checks only
+//    until the next command runs;
+//  - of consecutive TAGs of one fighter only the last is kept.
+// Adding up adjacent DAMAGE/HEAL of one fighter rounds differently
+// (h - a*m - b*m is not h - (a+b)*m), so it is only done with mergeHits.
+// Bodies of FOR_ROUNDS/AFTER_ROUNDS run later and are optimized on their
+// own. Conditions with lambdas and user-defined nodes are left alone.
+// Dropped TAGs (and merged hits) no longer report their events.
+
+struct OptimizerOptions {
+    bool enabled;       // setAction optimizes the tree
+    bool mergeHits;     // sum adjacent DAMAGE/HEAL of one fighter (not bit-identical)
+    bool verify;        // setAction checks every rewrite with verifyOptimization
+    
+    OptimizerOptions() : enabled(true), mergeHits(false),
+#ifdef TEKKEN_VERIFY_OPTIMIZER
+          verify(true) {}
+#else
+          verify(false) {}
+#endif
+    
+    // Settings that change the compiled programs (see loadRuleset)
+    uint64_t fingerprint() const { return (enabled ? 1 : 0) | (enabled && mergeHits ? 2 : 0); }
+};
+
+inline OptimizerOptions& optimizerOptions() {
+    static OptimizerOptions options;
+    return options;
+}
+
+class AbilityOptimizer {
+    struct Fact {
+        std::shared_ptr<ConditionExpr> condition;
+        bool value;
+        bool invariant;     // reads only types, names and constants
+    };
+    typedef std::vector<Fact> Facts;
+    
+    const OptimizerOptions& options;
+    
+    explicit AbilityOptimizer(const OptimizerOptions& o) : options(o) {}
+    
+    static std::shared_ptr<ConditionExpr> constant(bool value) {
+        return std::make_shared<ConstantCondition>(value);
+    }
+    static const ConstantCondition* asConstant(const std::shared_ptr<ConditionExpr>& c) {
+        return dynamic_cast<const ConstantCondition*>(c.get());
+    }
+    
+    static bool sameBits(double a, double b) { return std::memcmp(&a, &b, sizeof a) == 0; }
+    
+    static bool sameSource(const ValueSource& a, const ValueSource& b) {
+        if (a.kind != b.kind || a.kind == ValueSource::FUNCTION) return false;
+        if (a.kind == ValueSource::CONSTANT) return sameBits(a.constant, b.constant);
+        return a.isAttacker == b.isAttacker;
+    }
+    
+    static void dropVolatile(Facts& facts) {
+        facts.erase(std::remove_if(facts.begin(), facts.end(), [](const Fact& f) { return !f.invariant; }),
+                    facts.end());
+    }
+    
+    std::shared_ptr<ConditionExpr> condition(const std::shared_ptr<ConditionExpr>& node, Facts& facts) const {
+        ConditionExpr* cond = node.get();
+        if (!cond) return node;
+        if (pure(cond)) {
+            for (const Fact& f : facts) {
+                if (sameCondition(f.condition.get(), cond)) return constant(f.value);
+            }
+        }
+        if (auto c = dynamic_cast<ComparisonExpr*>(cond)) {
+            if (c->leftSource.kind == ValueSource::CONSTANT && c->rightSource.kind == ValueSource::CONSTANT) {
+                return constant(compareValues(c->op, c->leftSource.constant, c->rightSource.constant));
+            }
+        } else if (auto c = dynamic_cast<StringComparisonExpr*>(cond)) {
+            if (c->op != CmpOp::EQ && c->op != CmpOp::NE) return constant(false);
+        } else if (auto c = dynamic_cast<NotExpr*>(cond)) {
+            std::shared_ptr<ConditionExpr> inner = condition(c->condition, facts);
+            if (const ConstantCondition* k = asConstant(inner)) return constant(!k->value);
+            if (auto twice = dynamic_cast<NotExpr*>(inner.get())) return twice->condition;
+            return inner == c->condition ? node : std::make_shared<NotExpr>(inner);
+        } else if (auto c = dynamic_cast<AndExpr*>(cond)) {
+            return junction(node, c->conditions, false, facts);
+        } else if (auto c = dynamic_cast<OrExpr*>(cond)) {
+            return junction(node, c->conditions, true, facts);
+        }
+        return node;
+    }
+    
+    // AND (stop = false) or OR (stop = true): operands equal to !stop are
+    // dropped, and later operands may assume the earlier ones were !stop
+    std::shared_ptr<ConditionExpr> junction(const std::shared_ptr<ConditionExpr>& node,
+                                            const std::vector<std::shared_ptr<ConditionExpr>>& operands,
+                                            bool stop, Facts& facts) const {
+        std::vector<std::shared_ptr<ConditionExpr>> kept;
+        bool changed = false, keptPure = true;
+        size_t mark = facts.size();
+        for (auto& operand : operands) {
+            std::shared_ptr<ConditionExpr> c = condition(operand, facts);
+            changed |= c != operand;
+            if (const ConstantCondition* k = asConstant(c)) {
+                if (k->value != stop) {
+                    changed = true;
+                    continue;
+                }
+                if (keptPure) {
+                    facts.erase(facts.begin() + mark, facts.end());
+                    return constant(stop);
+                }
+                // The operands before it still run
+                changed |= kept.size() + 1 < operands.size();
+                kept.push_back(c);
+                break;
+            }
+            kept.push_back(c);
+            if (pure(c.get())) {
+                Fact f = {c, !stop, invariant(c.get())};
+                facts.push_back(f);
+            } else {
+                keptPure = false;
+            }
+        }
+        facts.erase(facts.begin() + mark, facts.end());
+        if (kept.empty()) return constant(!stop);
+        if (kept.size() == 1) return kept[0];
+        if (!changed) return node;
+        if (stop) {
+            auto expr = std::make_shared<OrExpr>();
+            expr->conditions = kept;
+            return expr;
+        }
+        auto expr = std::make_shared<AndExpr>();
+        expr->conditions = kept;
+        return expr;
+    }
+    
+    // nullptr: the node does nothing
+    std::shared_ptr<Command> command(const std::shared_ptr<Command>& node, Facts& facts) const {
+        Command* cmd = node.get();
+        if (!cmd) return node;
+        if (auto c = dynamic_cast<CompositeCommand*>(cmd)) {
+            return sequence(node, c->commands, facts);
+        } else if (auto c = dynamic_cast<ForRoundsCommand*>(cmd)) {
+            Facts none;
+            std::shared_ptr<Command> body = command(c->cmd, none);
+            if (body == c->cmd) return node;
+            return std::make_shared<ForRoundsCommand>(c->rounds, body ? body : std::make_shared<CompositeCommand>());
+        } else if (auto c = dynamic_cast<AfterRoundsCommand*>(cmd)) {
+            Facts none;
+            std::shared_ptr<Command> body = command(c->scheduled, none);
+            if (body == c->scheduled) return node;
+            // The original keeps clone() as it was; what fires is the
+            // optimized body, without converting a TAG that is now on its own
+            auto after = std::make_shared<AfterRoundsCommand>(c->rounds, c->cmd);
+            after->scheduled = body ? body : std::make_shared<CompositeCommand>();
+            return after;
+        } else if (auto c = dynamic_cast<IfCommand*>(cmd)) {
+            return branch(node, *c, facts);
+        }
+        return node;
+    }
+    
+    std::shared_ptr<Command> branch(const std::shared_ptr<Command>& node, const IfCommand& c, Facts& facts) const {
+        std::shared_ptr<ConditionExpr> cond = condition(c.condition, facts);
+        if (const ConstantCondition* k = asConstant(cond)) {
+            return command(k->value ? c.thenCmd : c.elseCmd, facts);
+        }
+        bool isPure = pure(cond.get());
+        std::shared_ptr<Command> arms[2];
+        for (int taken = 0; taken < 2; taken++) {
+            Facts known = facts;
+            if (isPure) {
+                Fact f = {cond, taken == 0, invariant(cond.get())};
+                known.push_back(f);
+            }
+            arms[taken] = command(taken == 0 ? c.thenCmd : c.elseCmd, known);
+        }
+        if (isPure && (!arms[0] || !arms[1] ? arms[0] == arms[1] : sameCommand(arms[0].get(), arms[1].get()))) {
+            return arms[0];
+        }
+        if (arms[1]) {
+            if (auto negated = dynamic_cast<NotExpr*>(cond.get())) {
+                return std::make_shared<IfCommand>(negated->condition, arms[1], arms[0]);
+            }
+        }
+        if (cond == c.condition && arms[0] == c.thenCmd && arms[1] == c.elseCmd) return node;
+        return std::make_shared<IfCommand>(cond, arms[0], arms[1]);
+    }
+    
+    std::shared_ptr<Command> sequence(const std::shared_ptr<Command>& node,
+                                      const std::vector<std::shared_ptr<Command>>& children, Facts& facts) const {
+        std::vector<std::shared_ptr<Command>> out;
+        bool changed = false;
+        for (auto& child : children) {
+            std::shared_ptr<Command> c = command(child, facts);
+            changed |= c != child;
+            if (!c) continue;
+            dropVolatile(facts);
+            if (auto nested = dynamic_cast<CompositeCommand*>(c.get())) {
+                changed = true;
+                for (auto& grandchild : nested->commands) append(out, grandchild, changed);
+            } else {
+                append(out, c, changed);
+            }
+        }
+        if (out.empty()) return nullptr;
+        if (out.size() == 1) return out[0];
+        if (!changed) return node;
+        auto composite = std::make_shared<CompositeCommand>();
+        composite->commands = out;
+        return composite;
+    }
+    
+    // Appends c, combining it with the previous command where that is exact
+    // (or allowed by mergeHits)
+    void append(std::vector<std::shared_ptr<Command>>& out, const std::shared_ptr<Command>& c, bool& changed) const {
+        Command* last = out.empty() ? nullptr : out.back().get();
+        if (auto tag = dynamic_cast<TagCommand*>(c.get())) {
+            auto previous = dynamic_cast<TagCommand*>(last);
+            if (previous && previous->isDefender == tag->isDefender) {
+                out.back() = c;
+                changed = true;
+                return;
+            }
+        }
+        if (options.mergeHits) {
+            auto damage = dynamic_cast<DamageCommand*>(c.get());
+            auto previousDamage = dynamic_cast<DamageCommand*>(last);
+            if (damage && previousDamage && damage->isDefender == previousDamage->isDefender) {
+                out.back() = std::make_shared<DamageCommand>(damage->isDefender, previousDamage->amount + damage->amount);
+                changed = true;
+                return;
+            }
+            auto heal = dynamic_cast<HealCommand*>(c.get());
+            auto previousHeal = dynamic_cast<HealCommand*>(last);
+            if (heal && previousHeal && heal->isDefender == previousHeal->isDefender) {
+                out.back() = std::make_shared<HealCommand>(heal->isDefender, previousHeal->amount + heal->amount);
+                changed = true;
+                return;
+            }
+        }
+        out.push_back(c);
+    }
+    
+public:
+    // Evaluating the condition calls no user code (so skipping it is safe)
+    static bool pure(const ConditionExpr* cond) {
+        if (auto c = dynamic_cast<const ComparisonExpr*>(cond)) {
+            return c->leftSource.kind != ValueSource::FUNCTION && c->rightSource.kind != ValueSource::FUNCTION;
+        } else if (auto c = dynamic_cast<const StringComparisonExpr*>(cond)) {
+            return c->leftSource.kind != ValueSource::FUNCTION || (c->op != CmpOp::EQ && c->op != CmpOp::NE);
+        } else if (auto c = dynamic_cast<const AndExpr*>(cond)) {
+            for (auto& operand : c->conditions) if (!pure(operand.get())) return false;
+            return true;
+        } else if (auto c = dynamic_cast<const OrExpr*>(cond)) {
+            for (auto& operand : c->conditions) if (!pure(operand.get())) return false;
+            return true;
+        } else if (auto c = dynamic_cast<const NotExpr*>(cond)) {
+            return pure(c->condition.get());
+        }
+        return dynamic_cast<const ConstantCondition*>(cond) != nullptr;
+    }
+    
+    // The value cannot change while an ability runs
+    static bool invariant(const ConditionExpr* cond) {
+        if (auto c = dynamic_cast<const ComparisonExpr*>(cond)) {
+            return c->leftSource.kind == ValueSource::CONSTANT && c->rightSource.kind == ValueSource::CONSTANT;
+        } else if (auto c = dynamic_cast<const StringComparisonExpr*>(cond)) {
+            return c->leftSource.kind == ValueSource::TYPE || c->leftSource.kind == ValueSource::NAME;
+        } else if (auto c = dynamic_cast<const AndExpr*>(cond)) {
+            for (auto& operand : c->conditions) if (!invariant(operand.get())) return false;
+            return true;
+        } else if (auto c = dynamic_cast<const OrExpr*>(cond)) {
+            for (auto& operand : c->conditions) if (!invariant(operand.get())) return false;
+            return true;
+        } else if (auto c = dynamic_cast<const NotExpr*>(cond)) {
+            return invariant(c->condition.get());
+        }
+        return dynamic_cast<const ConstantCondition*>(cond) != nullptr;
+    }
+    
+    // Structural equality; lambdas and unknown nodes only equal themselves
+    static bool sameCondition(const ConditionExpr* a, const ConditionExpr* b) {
+        if (a == b) return true;
+        if (!a || !b || typeid(*a) != typeid(*b)) return false;
+        if (auto x = dynamic_cast<const ComparisonExpr*>(a)) {
+            auto y = static_cast<const ComparisonExpr*>(b);
+            return x->op == y->op && sameSource(x->leftSource, y->leftSource) && sameSource(x->rightSource, y->rightSource);
+        } else if (auto x = dynamic_cast<const StringComparisonExpr*>(a)) {
+            auto y = static_cast<const StringComparisonExpr*>(b);
+            return x->op == y->op && sameSource(x->leftSource, y->leftSource) && x->rightSymbol == y->rightSymbol;
+        } else if (auto x = dynamic_cast<const AndExpr*>(a)) {
+            return sameOperands(x->conditions, static_cast<const AndExpr*>(b)->conditions);
+        } else if (auto x = dynamic_cast<const OrExpr*>(a)) {
+            return sameOperands(x->conditions, static_cast<const OrExpr*>(b)->conditions);
+        } else if (auto x = dynamic_cast<const NotExpr*>(a)) {
+            return sameCondition(x->condition.get(), static_cast<const NotExpr*>(b)->condition.get());
+        } else if (auto x = dynamic_cast<const ConstantCondition*>(a)) {
+            return x->value == static_cast<const ConstantCondition*>(b)->value;
+        }
+        return false;
+    }
+    
+    static bool sameOperands(const std::vector<std::shared_ptr<ConditionExpr>>& a,
+                             const std::vector<std::shared_ptr<ConditionExpr>>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) if (!sameCondition(a[i].get(), b[i].get())) return false;
+        return true;
+    }
+    
+    static bool sameCommand(const Command* a, const Command* b) {
+        if (a == b) return true;
+        if (!a || !b || typeid(*a) != typeid(*b)) return false;
+        if (auto x = dynamic_cast<const DamageCommand*>(a)) {
+            auto y = static_cast<const DamageCommand*>(b);
+            return x->isDefender == y->isDefender && sameBits(x->amount, y->amount);
+        } else if (auto x = dynamic_cast<const HealCommand*>(a)) {
+            auto y = static_cast<const HealCommand*>(b);
+            return x->isDefender == y->isDefender && sameBits(x->amount, y->amount);
+        } else if (auto x = dynamic_cast<const TagCommand*>(a)) {
+            auto y = static_cast<const TagCommand*>(b);
+            return x->isDefender == y->isDefender && x->out == y->out;
+        } else if (auto x = dynamic_cast<const ForRoundsCommand*>(a)) {
+            auto y = static_cast<const ForRoundsCommand*>(b);
+            return x->rounds == y->rounds && sameCommand(x->cmd.get(), y->cmd.get());
+        } else if (auto x = dynamic_cast<const AfterRoundsCommand*>(a)) {
+            auto y = static_cast<const AfterRoundsCommand*>(b);
+            return x->rounds == y->rounds && sameCommand(x->scheduled.get(), y->scheduled.get());
+        } else if (auto x = dynamic_cast<const IfCommand*>(a)) {
+            auto y = static_cast<const IfCommand*>(b);
+            return sameCondition(x->condition.get(), y->condition.get()) &&
+                   sameCommand(x->thenCmd.get(), y->thenCmd.get()) && sameCommand(x->elseCmd.get(), y->elseCmd.get());
+        } else if (auto x = dynamic_cast<const CompositeCommand*>(a)) {
+            auto y = static_cast<const CompositeCommand*>(b);
+            if (x->commands.size() != y->commands.size()) return false;
+            for (size_t i = 0; i < x->commands.size(); i++) {
+                if (!sameCommand(x->commands[i].get(), y->commands[i].get())) return false;
+            }
+            return true;
+        }
+        return false;
+    }
+    
+    // Commands and conditions in a tree (FOR_ROUNDS/AFTER_ROUNDS bodies included)
+    static size_t nodeCount(const Command* cmd) {
+        if (auto c = dynamic_cast<const CompositeCommand*>(cmd)) {
+            size_t n = 1;
+            for (auto& child : c->commands) n += nodeCount(child.get());
+            return n;
+        } else if (auto c = dynamic_cast<const ForRoundsCommand*>(cmd)) {
+            return 1 + nodeCount(c->cmd.get());
+        } else if (auto c = dynamic_cast<const AfterRoundsCommand*>(cmd)) {
+            return 1 + nodeCount(c->scheduled.get());
+        } else if (auto c = dynamic_cast<const IfCommand*>(cmd)) {
+            return 1 + nodeCount(c->condition.get()) + nodeCount(c->thenCmd.get()) + nodeCount(c->elseCmd.get());
+        }
+        return cmd ? 1 : 0;
+    }
+    
+    static size_t nodeCount(const ConditionExpr* cond) {
+        if (auto c = dynamic_cast<const AndExpr*>(cond)) {
+            size_t n = 1;
+            for (auto& operand : c->conditions) n += nodeCount(operand.get());
+            return n;
+        } else if (auto c = dynamic_cast<const OrExpr*>(cond)) {
+            size_t n = 1;
+            for (auto& operand : c->conditions) n += nodeCount(operand.get());
+            return n;
+        } else if (auto c = dynamic_cast<const NotExpr*>(cond)) {
+            return 1 + nodeCount(c->condition.get());
+        }
+        return cond ? 1 : 0;
     }
-    std::shared_ptr<ConditionExpr> operator>=(const NumericValue& other) const {
-        return std::make_shared<ComparisonExpr>(value, other.value, ">=");
+    
+    // A new tree (sharing the unchanged subtrees of root); root is not modified
+    static std::shared_ptr<Command> optimize(const std::shared_ptr<Command>& root,
+                                             const OptimizerOptions& options = optimizerOptions()) {
+        if (!root) return root;
+        Facts facts;
+        std::shared_ptr<Command> result = AbilityOptimizer(options).command(root, facts);
+        return result ? result : std::make_shared<CompositeCommand>();
+    }
+};
+
+// ========== OPTIMIZER VERIFICATION ==========
+
+struct OptimizerCheck {
+    bool identical;
+    long probes;
+    std::string mismatch;   // the first difference found
+};
+
+// Runs the original tree and the optimized one (as a tree and as bytecode)
+// from the same generated positions and compares both fighters bit for
+// bit after the ability and after each of the following `turns` turns of
+// pending effects. Positions cover the fighter types, the HP thresholds
+// and the names/types the conditions test, both ring states and both
+// round parities.
+class OptimizerVerifier {
+    std::vector<double> thresholds;
+    std::vector<uint32_t> symbols;
+    
+    void collect(const ConditionExpr* cond) {
+        if (auto c = dynamic_cast<const ComparisonExpr*>(cond)) {
+            if (c->leftSource.kind == ValueSource::CONSTANT) thresholds.push_back(c->leftSource.constant);
+            if (c->rightSource.kind == ValueSource::CONSTANT) thresholds.push_back(c->rightSource.constant);
+        } else if (auto c = dynamic_cast<const StringComparisonExpr*>(cond)) {
+            symbols.push_back(c->rightSymbol);
+        } else if (auto c = dynamic_cast<const AndExpr*>(cond)) {
+            for (auto& operand : c->conditions) collect(operand.get());
+        } else if (auto c = dynamic_cast<const OrExpr*>(cond)) {
+            for (auto& operand : c->conditions) collect(operand.get());
+        } else if (auto c = dynamic_cast<const NotExpr*>(cond)) {
+            collect(c->condition.get());
+        }
     }
-    std::shared_ptr<ConditionExpr> operator<(const NumericValue& other) const {
-        return std::make_shared<ComparisonExpr>(value, other.value, "<");
+    
+    void collect(const Command* cmd) {
+        if (auto c = dynamic_cast<const CompositeCommand*>(cmd)) {
+            for (auto& child : c->commands) collect(child.get());
+        } else if (auto c = dynamic_cast<const ForRoundsCommand*>(cmd)) {
+            collect(c->cmd.get());
+        } else if (auto c = dynamic_cast<const AfterRoundsCommand*>(cmd)) {
+            collect(c->scheduled.get());
+        } else if (auto c = dynamic_cast<const IfCommand*>(cmd)) {
+            collect(c->condition.get());
+            collect(c->thenCmd.get());
+            collect(c->elseCmd.get());
+        }
     }
-    std::shared_ptr<ConditionExpr> operator<=(const NumericValue& other) const {
-        return std::make_shared<ComparisonExpr>(value, other.value, "<=");
+    
+    static uint64_t next(uint64_t& state) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    
+    void randomize(Fighter& f, uint64_t& rng) const {
+        static const char* const types[] = {"", "Rushdown", "Evasive", "Grappler", "Heavy"};
+        int archetype = (int)(next(rng) % 5);
+        f.archetype = (uint8_t)archetype;
+        f.type = types[archetype];
+        f.typeId = internSymbol(f.type);
+        f.name = "Probe";
+        f.nameId = internSymbol(f.name);
+        // Names and types the conditions look for
+        if (!symbols.empty() && next(rng) % 2) {
+            f.typeId = symbols[next(rng) % symbols.size()];
+            f.type = symbolText(f.typeId);
+        }
+        if (!symbols.empty() && next(rng) % 2) {
+            f.nameId = symbols[next(rng) % symbols.size()];
+            f.name = symbolText(f.nameId);
+        }
+        static const double maxHPs[] = {80, 100, 150, 1000};
+        f.maxHP = maxHPs[next(rng) % 4];
+        // Around a threshold (inside and outside the 0.001 of ==), or anywhere
+        static const double offsets[] = {-1, -0.001, -0.0005, 0, 0.0005, 0.001, 1, 0.37};
+        if (!thresholds.empty() && next(rng) % 2) {
+            f.currentHP = thresholds[next(rng) % thresholds.size()] + offsets[next(rng) % 8];
+        } else {
+            f.currentHP = f.maxHP * (double)(next(rng) % 10007) / 10007.0;
+        }
+        f.currentHP = std::max(0.0, std::min(f.currentHP, f.maxHP));
+        f.inRing = next(rng) % 4 != 0;
+    }
+    
+    static bool sameFighter(const Fighter& a, const Fighter& b) {
+        return std::memcmp(&a.currentHP, &b.currentHP, sizeof(double)) == 0 && a.inRing == b.inRing &&
+               a.delayedCommands.size() == b.delayedCommands.size() &&
+               a.recurringCommands.size() == b.recurringCommands.size();
+    }
+    
+    static std::string describe(const Fighter& f) {
+        char text[96];
+        snprintf(text, sizeof text, "HP %.17g%s, %zu delayed, %zu recurring", f.currentHP, f.inRing ? "" : " (out)",
+                 f.delayedCommands.size(), f.recurringCommands.size());
+        return text;
+    }
+    
+public:
+    OptimizerCheck check(const std::shared_ptr<Command>& original, const std::shared_ptr<Command>& optimized,
+                         long probes = 512, int turns = 8) {
+        thresholds.clear();
+        symbols.clear();
+        collect(original.get());
+        Program program = AbilityCompiler::compile(optimized);
+        
+        // ShowCommand text is not part of the result
+        EventSink* savedSink = eventSink();
+        eventSink() = nullptr;
+        OptimizerCheck result = {true, 0, ""};
+        uint64_t rng = 0x0715;
+        Fighter attacker("", "", 0), defender("", "", 0);
+        for (long p = 0; p < probes && result.identical; p++, result.probes++) {
+            randomize(attacker, rng);
+            randomize(defender, rng);
+            int round = 1 + (int)(next(rng) % 4);
+            // 0: original tree, 1: optimized tree, 2: optimized bytecode
+            Fighter a[3] = {attacker, attacker, attacker};
+            Fighter d[3] = {defender, defender, defender};
+            original->execute(&a[0], &d[0], round);
+            optimized->execute(&a[1], &d[1], round);
+            runProgram(program, &a[2], &d[2], round);
+            for (int t = 0; t <= turns && result.identical; t++) {
+                if (t > 0) {
+                    for (int k = 0; k < 3; k++) {
+                        Fighter& mover = t % 2 ? d[k] : a[k];
+                        Fighter& other = t % 2 ? a[k] : d[k];
+                        mover.processDelayedCommands(&other, round + t / 2);
+                        mover.processRecurringCommands(&other, round + t / 2);
+                    }
+                }
+                for (int k = 1; k < 3 && result.identical; k++) {
+                    if (sameFighter(a[0], a[k]) && sameFighter(d[0], d[k])) continue;
+                    result.identical = false;
+                    bool attackerDiffers = !sameFighter(a[0], a[k]);
+                    result.mismatch = std::string(k == 1 ? "optimized tree" : "optimized bytecode") + ", probe " +
+                        std::to_string(p) + (t ? ", after effect turn " + std::to_string(t) : ", after the ability") +
+                        ": " + (attackerDiffers ? "attacker " : "defender ") +
+                        describe(attackerDiffers ? a[k] : d[k]) + " instead of " +
+                        describe(attackerDiffers ? a[0] : d[0]);
+                }
+            }
+        }
+        eventSink() = savedSink;
+        return result;
     }
 };
 
+inline OptimizerCheck verifyOptimization(const std::shared_ptr<Command>& original,
+                                         const std::shared_ptr<Command>& optimized, long probes = 512) {
+    return OptimizerVerifier().check(original, optimized, probes);
+}
+
+// The tree an ability runs: cmd as the optimizer options say
+inline std::shared_ptr<Command> optimizeAbility(const std::string& name, const std::shared_ptr<Command>& cmd) {
+    const OptimizerOptions& options = optimizerOptions();
+    if (!cmd || !options.enabled) return cmd;
+    std::shared_ptr<Command> optimized = AbilityOptimizer::optimize(cmd, options);
+    if (options.verify && optimized != cmd) {
+        OptimizerCheck check = verifyOptimization(cmd, optimized);
+        if (!check.identical) {
+            throw std::logic_error("optimizer changed the result of ability '" + name + "': " + check.mismatch);
+        }
+    }
+    return optimized;
+}
+
+// Define TEKKEN_NO_BYTECODE to run abilities by walking the command tree.
+inline void Ability::setAction(std::shared_ptr<Command> cmd) {
+    action = optimizeAbility(name, cmd);
+#ifndef TEKKEN_NO_BYTECODE
+    program = action ? AbilityCompiler::compile(action) : Program();
+#endif
+}
+
+inline void Ability::use(Fighter* attacker, Fighter* defender, int round) {
+    TEKKEN_PROFILE_ABILITY(profileId);
+    if (!program.empty()) {
+        runProgram(program, attacker, defender, round);
+    } else if (action) {
+        action->execute(attacker, defender, round);
+    }
+}
+
+// ========== VALUE WRAPPERS ==========
+
+class NumericValue {
+    std::function<double(Fighter*, Fighter*)> value;
+    ValueSource source;
+    
+    std::shared_ptr<ConditionExpr> compare(const NumericValue& other, CmpOp op) const {
+        return std::make_shared<ComparisonExpr>(value, source, other.value, other.source, op);
+    }
+public:
+    NumericValue(double val)
+        : value([val](Fighter*, Fighter*) { return val; }),
+          source(ValueSource::of(ValueSource::CONSTANT, false, val)) {}
+    NumericValue(std::function<double(Fighter*, Fighter*)> val,
+                 ValueSource src = ValueSource::of(ValueSource::FUNCTION))
+        : value(val), source(src) {}
+    
+    std::function<double(Fighter*, Fighter*)> getValue() const { return value; }
+    ValueSource getSource() const { return source; }
+    
+    std::shared_ptr<ConditionExpr> operator==(const NumericValue& other) const { return compare(other, CmpOp::EQ); }
+    std::shared_ptr<ConditionExpr> operator!=(const NumericValue& other) const { return compare(other, CmpOp::NE); }
+    std::shared_ptr<ConditionExpr> operator>(const NumericValue& other) const { return compare(other, CmpOp::GT); }
+    std::shared_ptr<ConditionExpr> operator>=(const NumericValue& other) const { return compare(other, CmpOp::GE); }
+    std::shared_ptr<ConditionExpr> operator<(const NumericValue& other) const { return compare(other, CmpOp::LT); }
+    std::shared_ptr<ConditionExpr> operator<=(const NumericValue& other) const { return compare(other, CmpOp::LE); }
+};
+
 class StringValue {
     std::function<std::string(Fighter*, Fighter*)> value;
+    ValueSource source;
 public:
     StringValue(const std::string& val) 
-        : value([val](Fighter*, Fighter*) { return val; }) {}
-    StringValue(std::function<std::string(Fighter*, Fighter*)> val) : value(val) {}
+        : value([val](Fighter*, Fighter*) { return val; }),
+          source(ValueSource::of(ValueSource::FUNCTION)) {}
+    StringValue(std::function<std::string(Fighter*, Fighter*)> val,
+                ValueSource src = ValueSource::of(ValueSource::FUNCTION))
+        : value(val), source(src) {}
     
     std::function<std::string(Fighter*, Fighter*)> getValue() const { return value; }
+    ValueSource getSource() const { return source; }
     
     std::shared_ptr<ConditionExpr> operator==(const std::string& other) const {
-        return std::make_shared<StringComparisonExpr>(value, other, "==");
+        return std::make_shared<StringComparisonExpr>(value, source, other, CmpOp::EQ);
     }
     std::shared_ptr<ConditionExpr> operator!=(const std::string& other) const {
-        return std::make_shared<StringComparisonExpr>(value, other, "!=");
+        return std::make_shared<StringComparisonExpr>(value, source, other, CmpOp::NE);
     }
 };
 
 class BoolValue {
     std::function<bool(Fighter*, Fighter*)> value;
+    ValueSource source;
 public:
-    BoolValue(bool val) : value([val](Fighter*, Fighter*) { return val; }) {}
-    BoolValue(std::function<bool(Fighter*, Fighter*)> val) : value(val) {}
+    BoolValue(bool val)
+        : value([val](Fighter*, Fighter*) { return val; }),
+          source(ValueSource::of(ValueSource::CONSTANT, false, val ? 1.0 : 0.0)) {}
+    BoolValue(std::function<bool(Fighter*, Fighter*)> val,
+              ValueSource src = ValueSource::of(ValueSource::FUNCTION))
+        : value(val), source(src) {}
     
     std::shared_ptr<ConditionExpr> toCondition() const {
         auto func = value;
         return std::make_shared<ComparisonExpr>(
-            [func](Fighter* a, Fighter* d) { return func(a, d) ? 1.0 : 0.0; },
-            [](Fighter*, Fighter*) { return 1.0; },
-            "=="
+            [func](Fighter* a, Fighter* d) { return func(a, d) ? 1.0 : 0.0; }, source,
+            [](Fighter*, Fighter*) { return 1.0; }, ValueSource::of(ValueSource::CONSTANT, false, 1.0),
+            CmpOp::EQ
         );
     }
 };
@@ -550,16 +2028,181 @@ public:
     }
 };
 
+// ========== WORLD ==========
+//
+// Owns one ruleset: fighters and abilities with dense ids, in order of
+// creation, and a hash index from name to id. Several worlds can live in
+// one process; createFighter/createAbility/teachAbility use defaultWorld().
+// Type matchups (archetypes()) are shared by all worlds.
+
+typedef uint32_t FighterId;
+typedef uint32_t AbilityId;
+static const uint32_t NO_ID = UINT32_MAX;
+
+// Append-only storage in chunks of 64 objects. Objects never move, so
+// references and ids stay valid while the store grows.
+template <typename T>
+class ChunkedStore {
+    static const size_t CHUNK = 64;
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    size_t count;
+
+public:
+    ChunkedStore() : count(0) {}
+    ~ChunkedStore() {
+        for (size_t i = 0; i < count; i++) (*this)[i].~T();
+    }
+    ChunkedStore(const ChunkedStore&) = delete;
+    ChunkedStore& operator=(const ChunkedStore&) = delete;
+
+    template <typename... Args>
+    T& emplace(Args&&... args) {
+        if (count == chunks.size() * CHUNK) chunks.emplace_back(new Slot[CHUNK]);
+        T* object = new (&chunks.back()[count % CHUNK]) T(std::forward<Args>(args)...);
+        count++;
+        return *object;
+    }
+
+    T& operator[](size_t i) { return *reinterpret_cast<T*>(&chunks[i / CHUNK][i % CHUNK]); }
+    size_t size() const { return count; }
+};
+
+class World {
+public:
+    World()
+        : fighterStore(std::make_shared<ChunkedStore<Fighter>>()),
+          abilityStore(std::make_shared<ChunkedStore<Ability>>()) {}
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    // A name that is taken gets the new object under the same id; holders
+    // of the old one keep it, and it is stored until the world goes away.
+    std::shared_ptr<Fighter> createFighter(const std::string& name, const std::string& type, double hp);
+    std::shared_ptr<Ability> createAbility(const std::string& name, std::shared_ptr<Command> action);
+    // An ability that is only bytecode, with no command tree (see Ruleset.h)
+    std::shared_ptr<Ability> createAbility(const std::string& name, Program program);
+
+    bool teach(FighterId fighter, AbilityId ability);
+    bool teach(const std::string& fighterName, const std::string& abilityName) {
+        return teach(fighterId(fighterName), abilityId(abilityName));
+    }
+
+    FighterId fighterId(const std::string& name) const { return lookup(fighterIndex, name); }
+    AbilityId abilityId(const std::string& name) const { return lookup(abilityIndex, name); }
+    size_t fighterCount() const { return fighters.size(); }
+    size_t abilityCount() const { return abilities.size(); }
+
+    Fighter& fighter(FighterId id) const { return *fighters[id]; }
+    Ability& ability(AbilityId id) const { return *abilities[id]; }
+    // Shared handles; they keep the world's storage alive
+    const std::shared_ptr<Fighter>& fighterHandle(FighterId id) const { return fighters[id]; }
+    const std::shared_ptr<Ability>& abilityHandle(AbilityId id) const { return abilities[id]; }
+
+    // nullptr if there is no such name
+    Fighter* findFighter(const std::string& name) const {
+        FighterId id = fighterId(name);
+        return id == NO_ID ? nullptr : fighters[id].get();
+    }
+    Ability* findAbility(const std::string& name) const {
+        AbilityId id = abilityId(name);
+        return id == NO_ID ? nullptr : abilities[id].get();
+    }
+
+    // Ids in name order, the order menus and tournaments list them in
+    std::vector<FighterId> fightersByName() const { return byName(fighters); }
+    std::vector<AbilityId> abilitiesByName() const { return byName(abilities); }
+
+private:
+    // Separate stores: fighters hold handles to abilities, never the reverse
+    std::shared_ptr<ChunkedStore<Fighter>> fighterStore;
+    std::shared_ptr<ChunkedStore<Ability>> abilityStore;
+    std::vector<std::shared_ptr<Fighter>> fighters;     // by id
+    std::vector<std::shared_ptr<Ability>> abilities;
+    std::unordered_map<std::string, uint32_t> fighterIndex;
+    std::unordered_map<std::string, uint32_t> abilityIndex;
+
+    static uint32_t lookup(const std::unordered_map<std::string, uint32_t>& index, const std::string& name) {
+        auto it = index.find(name);
+        return it == index.end() ? NO_ID : it->second;
+    }
+
+    template <typename T>
+    static void put(std::unordered_map<std::string, uint32_t>& index,
+                    std::vector<std::shared_ptr<T>>& table, const std::string& name,
+                    std::shared_ptr<T> handle) {
+        auto it = index.find(name);
+        if (it != index.end()) {
+            table[it->second] = std::move(handle);
+        } else {
+            index.emplace(name, (uint32_t)table.size());
+            table.push_back(std::move(handle));
+        }
+    }
+
+    template <typename T>
+    static std::vector<uint32_t> byName(const std::vector<std::shared_ptr<T>>& table) {
+        std::vector<uint32_t> ids(table.size());
+        for (uint32_t i = 0; i < ids.size(); i++) ids[i] = i;
+        std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) { return table[a]->name < table[b]->name; });
+        return ids;
+    }
+};
+
+inline std::shared_ptr<Fighter> World::createFighter(const std::string& name, const std::string& type, double hp) {
+    Fighter& f = fighterStore->emplace(name, type, hp);
+    std::shared_ptr<Fighter> handle(fighterStore, &f);
+    put(fighterIndex, fighters, name, handle);
+    return handle;
+}
+
+inline std::shared_ptr<Ability> World::createAbility(const std::string& name, std::shared_ptr<Command> action) {
+    Ability& a = abilityStore->emplace(name);
+    a.setAction(action);
+    std::shared_ptr<Ability> handle(abilityStore, &a);
+    put(abilityIndex, abilities, name, handle);
+    return handle;
+}
+
+inline std::shared_ptr<Ability> World::createAbility(const std::string& name, Program program) {
+    Ability& a = abilityStore->emplace(name);
+    a.program = std::move(program);
+    std::shared_ptr<Ability> handle(abilityStore, &a);
+    put(abilityIndex, abilities, name, handle);
+    return handle;
+}
+
+inline bool World::teach(FighterId fighter, AbilityId ability) {
+    if (fighter >= fighters.size() || ability >= abilities.size()) return false;
+    fighters[fighter]->addAbility(abilities[ability]);
+    return true;
+}
+
+inline World& defaultWorld() {
+    static World world;
+    return world;
+}
+
 // ========== BATTLE SYSTEM ==========
 
-inline void runDuel() {
-    std::cout << "=== Available Fighters ===" << std::endl;
+// Ability choice of a computer-controlled player in runDuel: a 0-based
+// index, anything out of range passes the turn. Engine.h's
+// setComputerPlayer installs an AbilityPolicy here.
+typedef std::function<int(Fighter* self, Fighter* opponent, int round)> ComputerPlayer;
+
+inline ComputerPlayer& computerPlayer(int player) {
+    static ComputerPlayer players[2];
+    return players[player == 1 ? 0 : 1];
+}
+
+inline void runDuel(World& world = defaultWorld()) {
+    std::cout << "=== Available Fighters ===\n";
     int idx = 1;
-    std::vector<std::string> fighterNames;
-    for (const auto& pair : fighterRegistry) {
-        std::cout << idx++ << ". " << pair.first << " (" << pair.second->type 
-                  << ", HP: " << pair.second->maxHP << ")" << std::endl;
-        fighterNames.push_back(pair.first);
+    std::vector<FighterId> fighterNames = world.fightersByName();
+    for (FighterId id : fighterNames) {
+        const Fighter& f = world.fighter(id);
+        std::cout << idx++ << ". " << f.name << " (" << f.type 
+                  << ", HP: " << f.maxHP << ")\n";
     }
     
     std::cout << "\nPlayer 1, select your fighter (1-" << fighterNames.size() << "): ";
@@ -571,11 +2214,17 @@ inline void runDuel() {
     std::cin >> choice2;
     
     // Create fresh copies of fighters for battle
-    auto origFighter1 = fighterRegistry[fighterNames[choice1-1]];
-    auto origFighter2 = fighterRegistry[fighterNames[choice2-1]];
-    
-    auto fighter1 = std::make_shared<Fighter>(origFighter1->name, origFighter1->type, origFighter1->maxHP);
-    auto fighter2 = std::make_shared<Fighter>(origFighter2->name, origFighter2->type, origFighter2->maxHP);
+    auto origFighter1 = world.fighterHandle(fighterNames[choice1-1]);
+    auto origFighter2 = world.fighterHandle(fighterNames[choice2-1]);
+    
+    // The match fighters and their pending effects live in one arena,
+    // released together when the duel ends
+    DuelArena arena;
+    ArenaAllocator<Fighter> alloc(&arena);
+    auto fighter1 = std::allocate_shared<Fighter>(alloc, origFighter1->name, origFighter1->type, origFighter1->maxHP);
+    auto fighter2 = std::allocate_shared<Fighter>(alloc, origFighter2->name, origFighter2->type, origFighter2->maxHP);
+    fighter1->reset(&arena);
+    fighter2->reset(&arena);
     
     // Copy abilities
     for (auto& ability : origFighter1->abilities) {
@@ -585,28 +2234,33 @@ inline void runDuel() {
         fighter2->addAbility(ability);
     }
     
-    std::cout << "\n=== BATTLE START ===" << std::endl;
-    std::cout << fighter1->name << " VS " << fighter2->name << std::endl << std::endl;
+    std::cout << "\n=== BATTLE START ===\n";
+    std::cout << fighter1->name << " VS " << fighter2->name << "\n\n";
     
     int round = 1;
     bool player1Turn = true;
     
+    int announced = 0;
     while (fighter1->isAlive() && fighter2->isAlive()) {
-        std::cout << "=== Round " << round << " ===" << std::endl;
+        if (round != announced) {
+            TEKKEN_EVENT(roundStart(round));
+            announced = round;
+        }
+        std::cout << "=== Round " << round << " ===\n";
         
         // Grappler healing on even rounds
         if (round % 2 == 0) {
-            if (fighter1->type == "Grappler" && fighter1->inRing) {
-                double healAmount = fighter1->maxHP * 0.05;
+            double healAmount = fighter1->typeHealAmount();
+            if (healAmount > 0) {
                 fighter1->heal(healAmount);
-                std::cout << fighter1->name << " (Grappler) heals " << (int)healAmount 
-                         << " HP at start of round!" << std::endl;
+                std::cout << fighter1->name << " (" << fighter1->type << ") heals " << (int)healAmount 
+                         << " HP at start of round!\n";
             }
-            if (fighter2->type == "Grappler" && fighter2->inRing) {
-                double healAmount = fighter2->maxHP * 0.05;
+            healAmount = fighter2->typeHealAmount();
+            if (healAmount > 0) {
                 fighter2->heal(healAmount);
-                std::cout << fighter2->name << " (Grappler) heals " << (int)healAmount 
-                         << " HP at start of round!" << std::endl;
+                std::cout << fighter2->name << " (" << fighter2->type << ") heals " << (int)healAmount 
+                         << " HP at start of round!\n";
             }
         }
         
@@ -618,24 +2272,30 @@ inline void runDuel() {
         attacker->processRecurringCommands(defender, round);
         
         if (!attacker->inRing) {
-            std::cout << attacker->name << " is out of the ring and cannot attack!" << std::endl;
+            std::cout << attacker->name << " is out of the ring and cannot attack!\n";
         } else if (attacker->abilities.empty()) {
-            std::cout << attacker->name << " has no abilities!" << std::endl;
+            std::cout << attacker->name << " has no abilities!\n";
         } else {
-            std::cout << (player1Turn ? "Player 1" : "Player 2") << " (" << attacker->name << "), select ability:" << std::endl;
+            std::cout << (player1Turn ? "Player 1" : "Player 2") << " (" << attacker->name << "), select ability:\n";
             for (size_t i = 0; i < attacker->abilities.size(); i++) {
-                std::cout << (i+1) << ". " << attacker->abilities[i]->name << std::endl;
+                std::cout << (i+1) << ". " << attacker->abilities[i]->name << "\n";
             }
             
             int abilityChoice;
-            std::cin >> abilityChoice;
+            const ComputerPlayer& computer = computerPlayer(player1Turn ? 1 : 2);
+            if (computer) {
+                abilityChoice = computer(attacker, defender, round) + 1;
+                std::cout << "> " << abilityChoice << "\n";
+            } else {
+                std::cin >> abilityChoice;
+            }
             
             if (abilityChoice >= 1 && abilityChoice <= (int)attacker->abilities.size()) {
                 attacker->abilities[abilityChoice-1]->use(attacker, defender, round);
             }
         }
         
-        std::cout << std::endl;
+        std::cout << "\n";
         fighter1->displayStatus();
         fighter2->displayStatus();
         
@@ -643,58 +2303,77 @@ inline void runDuel() {
         if (player1Turn) round++;
     }
     
-    std::cout << "=== BATTLE END ===" << std::endl;
+    if (!fighter1->isAlive()) TEKKEN_EVENT(knockOut(*fighter1, round));
+    if (!fighter2->isAlive()) TEKKEN_EVENT(knockOut(*fighter2, round));
+    
+    std::cout << "=== BATTLE END ===\n";
     if (fighter1->isAlive()) {
-        std::cout << fighter1->name << " WINS!" << std::endl;
+        std::cout << fighter1->name << " WINS!\n";
     } else {
-        std::cout << fighter2->name << " WINS!" << std::endl;
+        std::cout << fighter2->name << " WINS!\n";
     }
 }
 
 // ========== HELPER FUNCTIONS ==========
 
+// These work on defaultWorld()
 inline std::shared_ptr<Fighter> createFighter(const std::string& name, const std::string& type, double hp) {
-    auto fighter = std::make_shared<Fighter>(name, type, hp);
-    fighterRegistry[name] = fighter;
-    return fighter;
+    return defaultWorld().createFighter(name, type, hp);
 }
 
 inline std::shared_ptr<Ability> createAbility(const std::string& name, std::shared_ptr<Command> action) {
-    auto ability = std::make_shared<Ability>(name);
-    ability->setAction(action);
-    abilityRegistry[name] = ability;
-    return ability;
+    return defaultWorld().createAbility(name, action);
 }
 
 inline void teachAbility(const std::string& fighterName, const std::string& abilityName) {
-    if (fighterRegistry.find(fighterName) != fighterRegistry.end() &&
-        abilityRegistry.find(abilityName) != abilityRegistry.end()) {
-        fighterRegistry[fighterName]->addAbility(abilityRegistry[abilityName]);
-    }
+    defaultWorld().teach(fighterName, abilityName);
+}
+
+// Registers a fighter type (or updates one) with its even-round heal,
+// as a fraction of maxHP.
+inline uint8_t defineArchetype(const std::string& type, double evenRoundHealFraction = 0.0) {
+    return archetypes().define(type, evenRoundHealFraction);
+}
+
+// Sets the damage multiplier for hits from one type on another, replacing
+// both the attacker bonus and the defender resistance for that pair.
+inline void setTypeMatchup(const std::string& attacker, const std::string& defender,
+                           double oddRounds, double evenRounds) {
+    ArchetypeTable& table = archetypes();
+    uint8_t a = table.idOf(attacker);
+    uint8_t d = table.idOf(defender);
+    DamageModifier odd = {oddRounds, 1.0};
+    DamageModifier even = {evenRounds, 1.0};
+    table.setModifier(a, d, 1, odd);
+    table.setModifier(a, d, 0, even);
+}
+
+inline void setTypeMatchup(const std::string& attacker, const std::string& defender, double multiplier) {
+    setTypeMatchup(attacker, defender, multiplier, multiplier);
 }
 
 inline NumericValue GET_HP(bool isAttacker) {
     return NumericValue([isAttacker](Fighter* a, Fighter* d) {
         return isAttacker ? a->currentHP : d->currentHP;
-    });
+    }, ValueSource::of(ValueSource::HP, isAttacker));
 }
 
 inline StringValue GET_TYPE(bool isAttacker) {
     return StringValue([isAttacker](Fighter* a, Fighter* d) {
         return isAttacker ? a->type : d->type;
-    });
+    }, ValueSource::of(ValueSource::TYPE, isAttacker));
 }
 
 inline StringValue GET_NAME(bool isAttacker) {
     return StringValue([isAttacker](Fighter* a, Fighter* d) {
         return isAttacker ? a->name : d->name;
-    });
+    }, ValueSource::of(ValueSource::NAME, isAttacker));
 }
 
 inline BoolValue IS_OUT_OF_RING(bool isAttacker) {
     return BoolValue([isAttacker](Fighter* a, Fighter* d) {
         return isAttacker ? !a->inRing : !d->inRing;
-    });
+    }, ValueSource::of(ValueSource::OUT_OF_RING, isAttacker));
 }
 
 // ========== DSL MACROS ==========
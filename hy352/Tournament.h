@@ -0,0 +1,210 @@
+#ifndef TOURNAMENT_H
+#define TOURNAMENT_H
+
+#include "Engine.h"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+
+// ========== TOURNAMENT RUNNER ==========
+//
+// Plays every ordered pair of a World's fighters (mirrors included) N times
+// on all cores. The duels of a pair are cut into fixed-size tasks; every
+// worker starts with a contiguous block of tasks and idle workers steal
+// the back half of a busy worker's block, so long Heavy/Grappler matchups
+// do not leave cores waiting. Each task seeds its policies from
+// (seed, pair, chunk), which makes the result independent of the number of
+// threads and of who ends up running which task.
+
+struct TournamentResult {
+    std::vector<std::string> names;   // name order
+    std::vector<long> wins;           // wins[i * n + j]: i (player 1) beat j
+    std::vector<long> draws;          // draws[i * n + j]
+    long duelsPerPair;
+    long totalRounds;
+    double seconds;
+
+    size_t size() const { return names.size(); }
+
+    // Fraction of the duels between i (player 1) and j (player 2) won by i
+    double winRate(size_t i, size_t j) const {
+        return duelsPerPair ? (double)wins[i * names.size() + j] / duelsPerPair : 0.0;
+    }
+
+    long totalDuels() const { return duelsPerPair * (long)(names.size() * names.size()); }
+
+    void print(std::ostream& out) const {
+        char cell[32];
+        out << "Win rate % (row = player 1, column = player 2)\n" << std::string(12, ' ');
+        for (auto& name : names) {
+            snprintf(cell, sizeof(cell), " %10.10s", name.c_str());
+            out << cell;
+        }
+        out << "\n";
+        for (size_t i = 0; i < names.size(); i++) {
+            snprintf(cell, sizeof(cell), "%-12.12s", names[i].c_str());
+            out << cell;
+            for (size_t j = 0; j < names.size(); j++) {
+                snprintf(cell, sizeof(cell), " %10.2f", 100.0 * winRate(i, j));
+                out << cell;
+            }
+            out << "\n";
+        }
+    }
+};
+
+// Lock-free block of task ids owned by one worker. The owner pops from the
+// front, thieves split off the back half; both sides move the packed
+// [begin, end) pair with a single compare-and-swap.
+class TaskRange {
+    std::atomic<uint64_t> range;
+
+    static uint64_t pack(uint32_t begin, uint32_t end) { return ((uint64_t)begin << 32) | end; }
+    static uint32_t begin(uint64_t r) { return (uint32_t)(r >> 32); }
+    static uint32_t end(uint64_t r) { return (uint32_t)r; }
+
+public:
+    TaskRange() : range(0) {}
+
+    void assign(uint32_t b, uint32_t e) { range.store(pack(b, e), std::memory_order_release); }
+
+    bool pop(uint32_t& task) {
+        uint64_t r = range.load(std::memory_order_acquire);
+        while (begin(r) < end(r)) {
+            if (range.compare_exchange_weak(r, pack(begin(r) + 1, end(r)),
+                                            std::memory_order_acq_rel)) {
+                task = begin(r);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool steal(uint32_t& b, uint32_t& e) {
+        uint64_t r = range.load(std::memory_order_acquire);
+        while (begin(r) < end(r)) {
+            uint32_t half = (end(r) - begin(r) + 1) / 2;
+            if (range.compare_exchange_weak(r, pack(begin(r), end(r) - half),
+                                            std::memory_order_acq_rel)) {
+                b = end(r) - half;
+                e = end(r);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Per-worker state, padded so that neighbouring workers never share a line.
+struct alignas(64) TournamentWorker {
+    TaskRange tasks;
+    std::vector<long> wins;
+    std::vector<long> draws;
+    long rounds;
+    char padding[64];
+};
+
+inline TournamentResult runTournament(long duelsPerPair, unsigned threads = 0,
+                                      uint64_t seed = 1, int maxRounds = 1000,
+                                      const World& world = defaultWorld()) {
+    const uint32_t chunkDuels = 128;
+
+    TournamentResult result;
+    std::vector<const Fighter*> roster;
+    for (FighterId id : world.fightersByName()) {
+        result.names.push_back(world.fighter(id).name);
+        roster.push_back(&world.fighter(id));
+    }
+    const size_t n = roster.size();
+    result.duelsPerPair = duelsPerPair;
+    result.wins.assign(n * n, 0);
+    result.draws.assign(n * n, 0);
+    result.totalRounds = 0;
+    result.seconds = 0;
+    if (n == 0 || duelsPerPair <= 0) return result;
+
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    const uint32_t chunksPerPair = (uint32_t)((duelsPerPair + chunkDuels - 1) / chunkDuels);
+    const uint32_t taskCount = (uint32_t)(n * n) * chunksPerPair;
+
+    std::vector<TournamentWorker> workers(threads);
+    std::atomic<uint32_t> unclaimed(taskCount);
+    for (unsigned w = 0; w < threads; w++) {
+        workers[w].tasks.assign((uint32_t)((uint64_t)taskCount * w / threads),
+                                (uint32_t)((uint64_t)taskCount * (w + 1) / threads));
+        workers[w].wins.assign(n * n, 0);
+        workers[w].draws.assign(n * n, 0);
+        workers[w].rounds = 0;
+    }
+
+    auto work = [&](unsigned self) {
+        TournamentWorker& me = workers[self];
+        DuelEngine engine(maxRounds);
+        RandomPolicy policy1, policy2;
+        FastRng victimRng(seed ^ self);
+
+        for (;;) {
+            uint32_t task;
+            if (!me.tasks.pop(task)) {
+                // Out of work: try every other worker, starting at a random one.
+                // A thief may hold a stolen block it has not published yet, so
+                // keep looking until every task has been claimed.
+                if (unclaimed.load(std::memory_order_acquire) == 0) break;
+                bool stole = false;
+                unsigned start = (unsigned)victimRng.below((int)threads);
+                for (unsigned k = 0; k < threads && !stole; k++) {
+                    unsigned victim = (start + k) % threads;
+                    uint32_t b, e;
+                    if (victim != self && workers[victim].tasks.steal(b, e)) {
+                        me.tasks.assign(b, e);
+                        stole = true;
+                    }
+                }
+                if (!stole) std::this_thread::yield();
+                continue;
+            }
+            unclaimed.fetch_sub(1, std::memory_order_acq_rel);
+
+            uint32_t pair = task / chunksPerPair;
+            uint32_t chunk = task % chunksPerPair;
+            long first = (long)chunk * chunkDuels;
+            long count = std::min<long>(chunkDuels, duelsPerPair - first);
+            policy1.reseed(policySeed(seed, task, 0));
+            policy2.reseed(policySeed(seed, task, 1));
+
+            const Fighter& f1 = *roster[pair / n];
+            const Fighter& f2 = *roster[pair % n];
+            long wins = 0, draws = 0, rounds = 0;
+            for (long d = 0; d < count; d++) {
+                DuelResult r = engine.run(f1, f2, policy1, policy2);
+                wins += r.winner == 1;
+                draws += r.winner == 0;
+                rounds += r.rounds;
+            }
+            me.wins[pair] += wins;
+            me.draws[pair] += draws;
+            me.rounds += rounds;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < threads; w++) {
+        pool.emplace_back(work, w);
+    }
+    work(0);
+    for (auto& t : pool) t.join();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto& w : workers) {
+        for (size_t p = 0; p < n * n; p++) {
+            result.wins[p] += w.wins[p];
+            result.draws[p] += w.draws[p];
+        }
+        result.totalRounds += w.rounds;
+    }
+    return result;
+}
+
+#endif // TOURNAMENT_H
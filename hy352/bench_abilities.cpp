@@ -0,0 +1,99 @@
+#include "Tekken.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Per-ability execution cost: walking the command tree (Command::execute)
+// against running the compiled bytecode (Ability::use).
+//
+//   ./bench_abilities [iterations]
+
+// Best of five runs, to keep scheduler noise out of the comparison
+template <typename F>
+static double nsPerOp(long iterations, Fighter& a, Fighter& d, F body) {
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++) {
+            a.reset();
+            d.reset();
+            body(i);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, seconds * 1e9 / iterations);
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+    createAbility("Punch", DAMAGE_DEFENDER(15));
+    createAbility("Meditate", HEAL_ATTACKER(20));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(HEAL_ATTACKER(5));
+        createAbility("Power_Combo", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(IF_THEN_ELSE(GET_HP(DEFENDER) > NumericValue(50),
+                              DAMAGE_DEFENDER(30), DAMAGE_DEFENDER(15)));
+        createAbility("Smart_Attack", cmd);
+    }
+    createAbility("Poison", FOR_ROUNDS(3, DAMAGE_DEFENDER(10)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(5));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(25)));
+        createAbility("Time_Bomb", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Grappler",
+                              DAMAGE_DEFENDER(25), DAMAGE_DEFENDER(18)));
+        createAbility("Rolling_Kick", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        auto inner = std::make_shared<CompositeCommand>();
+        inner->add(DAMAGE_DEFENDER(4));
+        inner->add(DAMAGE_DEFENDER(4));
+        cmd->add(IF_THEN_ELSE(AND(GET_HP(ATTACKER) < NumericValue(60), NOT(IS_OUT_OF_RING(DEFENDER).toCondition())),
+                              inner, HEAL_ATTACKER(5)));
+        cmd->add(DAMAGE_DEFENDER(3));
+        createAbility("Desperation", cmd);
+    }
+
+    Fighter attacker("Striker", "Rushdown", 100000);
+    Fighter defender("Wrestler", "Grappler", 100000);
+
+    printf("%-16s %12s %12s %8s\n", "ability", "tree ns/op", "bytecode", "speedup");
+    World& world = defaultWorld();
+    for (AbilityId id : world.abilitiesByName()) {
+        Ability& ability = world.ability(id);
+        Command& tree = *ability.action;
+
+        double treeNs = nsPerOp(iterations, attacker, defender, [&](long i) {
+            tree.execute(&attacker, &defender, (int)(i & 7) + 1);
+        });
+        double byteNs = nsPerOp(iterations, attacker, defender, [&](long i) {
+            ability.use(&attacker, &defender, (int)(i & 7) + 1);
+        });
+        double resetNs = nsPerOp(iterations, attacker, defender, [](long) {});
+
+        treeNs -= resetNs;
+        byteNs -= resetNs;
+        printf("%-16s %12.2f %12.2f %7.2fx\n", ability.name.c_str(), treeNs, byteNs,
+               byteNs > 0 ? treeNs / byteNs : 0.0);
+    }
+    return 0;
+}
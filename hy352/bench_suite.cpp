@@ -0,0 +1,340 @@
+#include "Bench.h"
+#include "Tournament.h"
+#include <cstring>
+#include <fstream>
+
+// Micro and macro benchmarks of the engine's hot paths: fighter updates,
+// every command and condition node, clone(), effect scheduling, whole
+// headless duels and tournaments over a generated roster.
+//
+//   ./bench_suite [--json out.json] [--baseline old.json] [--filter text]
+//                 [--min-time seconds] [--samples n] [--threshold percent] [--strict]
+//
+// With --baseline every benchmark is compared with the saved run; --strict
+// makes regressions beyond the threshold fail the program.
+
+TEKKEN_BENCH_COUNT_ALLOCATIONS
+
+static const char* const TYPES[] = {"Rushdown", "Heavy", "Evasive", "Grappler"};
+
+// Random abilities over every kind of node, and fighters with three to five
+// of them. The same seed gives the same world.
+static void buildRoster(World& world, int fighters, uint64_t seed) {
+    FastRng rng(seed);
+    int abilities = fighters * 2;
+    for (int i = 0; i < abilities; i++) {
+        std::string name = "Move" + std::to_string(i);
+        int a = 5 + rng.below(20), b = 2 + rng.below(10);
+        std::shared_ptr<Command> cmd;
+        switch (i % 8) {
+            case 0: cmd = DAMAGE_DEFENDER(a); break;
+            case 1: {
+                auto c = std::make_shared<CompositeCommand>();
+                c->add(DAMAGE_DEFENDER(a));
+                c->add(HEAL_ATTACKER(b));
+                cmd = c;
+                break;
+            }
+            case 2: cmd = FOR_ROUNDS(2 + rng.below(3), DAMAGE_DEFENDER(b)); break;
+            case 3: {
+                auto c = std::make_shared<CompositeCommand>();
+                c->add(DAMAGE_DEFENDER(b));
+                c->add(AFTER_ROUNDS(1 + rng.below(3), DAMAGE_DEFENDER(a + 10)));
+                cmd = c;
+                break;
+            }
+            case 4: cmd = IF_THEN_ELSE(GET_HP(DEFENDER) < NumericValue(20 + a), DAMAGE_DEFENDER(a + 15),
+                                       DAMAGE_DEFENDER(b)); break;
+            case 5: cmd = IF_THEN_ELSE(GET_TYPE(DEFENDER) == TYPES[rng.below(4)], DAMAGE_DEFENDER(a),
+                                       HEAL_ATTACKER(b)); break;
+            case 6: {
+                auto c = std::make_shared<CompositeCommand>();
+                c->add(TAG_DEFENDER_OUT);
+                c->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+                cmd = c;
+                break;
+            }
+            default: cmd = IF_THEN_ELSE(AND(GET_HP(ATTACKER) < NumericValue(50),
+                                            NOT(IS_OUT_OF_RING(DEFENDER).toCondition())),
+                                        HEAL_ATTACKER(a), DAMAGE_DEFENDER(b)); break;
+        }
+        world.createAbility(name, cmd);
+    }
+    for (int i = 0; i < fighters; i++) {
+        std::string name = "Fighter" + std::to_string(i);
+        world.createFighter(name, TYPES[i % 4], 80 + rng.below(70));
+        int known = 3 + rng.below(3);
+        for (int k = 0; k < known; k++) {
+            world.teach(world.fighterId(name), (AbilityId)rng.below(abilities));
+        }
+    }
+}
+
+static void microBenchmarks(BenchSuite& suite) {
+    Fighter attacker("Striker", "Rushdown", 1e12);
+    Fighter defender("Wrestler", "Grappler", 1e12);
+
+    // Fighter
+    suite.run("fighter/take_damage", [&](long n) {
+        for (long i = 0; i < n; i++) defender.takeDamage(15, &attacker, (int)i);
+    });
+    suite.run("fighter/heal", [&](long n) {
+        for (long i = 0; i < n; i++) attacker.heal(5);
+    });
+
+    // Command::execute, one node type each
+    auto execute = [&](const char* name, std::shared_ptr<Command> cmd, bool resetEvery64) {
+        Command& c = *cmd;
+        suite.run(name, [&](long n) {
+            for (long i = 0; i < n; i++) {
+                if (resetEvery64 && (i & 63) == 0) {
+                    attacker.reset();
+                    defender.reset();
+                }
+                c.execute(&attacker, &defender, (int)i);
+            }
+        });
+        attacker.reset();
+        defender.reset();
+    };
+    execute("command/damage", DAMAGE_DEFENDER(15), false);
+    execute("command/heal", HEAL_ATTACKER(20), false);
+    {
+        auto out = TAG_DEFENDER_OUT;
+        auto in = TAG_DEFENDER_IN;
+        suite.run("command/tag", [&](long n) {
+            for (long i = 0; i < n; i++) ((i & 1) ? *in : *out).execute(&attacker, &defender, (int)i);
+        });
+        defender.enterRing();
+    }
+    execute("command/for_rounds", FOR_ROUNDS(3, DAMAGE_DEFENDER(10)), true);
+    execute("command/after_rounds", AFTER_ROUNDS(2, DAMAGE_DEFENDER(25)), true);
+    execute("command/if_then_else", IF_THEN_ELSE(GET_HP(DEFENDER) > NumericValue(50),
+                                                 DAMAGE_DEFENDER(30), DAMAGE_DEFENDER(15)), false);
+    std::shared_ptr<Command> combo;
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(HEAL_ATTACKER(5));
+        combo = cmd;
+    }
+    execute("command/composite3", combo, false);
+    std::shared_ptr<Command> show = ShowBuilder() << GET_NAME(ATTACKER) << " hits " << GET_NAME(DEFENDER)
+                                                  << " at " << GET_HP(DEFENDER) << " HP";
+    execute("command/show_no_sink", show, false);
+    {
+        NullEventSink sink;
+        eventSink() = &sink;
+        execute("command/show", show, false);
+        eventSink() = nullptr;
+    }
+
+    // A whole ability: command tree against its bytecode
+    std::shared_ptr<Command> desperation;
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        auto inner = std::make_shared<CompositeCommand>();
+        inner->add(DAMAGE_DEFENDER(4));
+        inner->add(DAMAGE_DEFENDER(4));
+        cmd->add(IF_THEN_ELSE(AND(GET_HP(ATTACKER) < NumericValue(60), NOT(IS_OUT_OF_RING(DEFENDER).toCondition())),
+                              inner, HEAL_ATTACKER(5)));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(3)));
+        desperation = cmd;
+    }
+    Ability ability("Desperation");
+    ability.setAction(desperation);
+    execute("ability/tree", desperation, true);
+    suite.run("ability/use", [&](long n) {
+        for (long i = 0; i < n; i++) {
+            if ((i & 63) == 0) {
+                attacker.reset();
+                defender.reset();
+            }
+            ability.use(&attacker, &defender, (int)i);
+        }
+    });
+    attacker.reset();
+    defender.reset();
+
+    // ConditionExpr::evaluate
+    auto evaluate = [&](const char* name, std::shared_ptr<ConditionExpr> cond) {
+        ConditionExpr& c = *cond;
+        suite.run(name, [&](long n) {
+            int hits = 0;
+            for (long i = 0; i < n; i++) hits += c.evaluate(&attacker, &defender);
+            doNotOptimize(hits);
+        });
+    };
+    evaluate("condition/compare", GET_HP(DEFENDER) < NumericValue(30));
+    evaluate("condition/compare_lambda",
+             NumericValue([](Fighter* a, Fighter*) { return a->currentHP; }) > NumericValue(50));
+    evaluate("condition/string_compare", GET_TYPE(DEFENDER) == "Grappler");
+    evaluate("condition/string_compare_lambda",
+             StringValue([](Fighter*, Fighter* d) { return d->type; }) == "Grappler");
+    evaluate("condition/and", AND(GET_HP(ATTACKER) > NumericValue(60), GET_TYPE(DEFENDER) == "Grappler"));
+    evaluate("condition/or", OR(GET_HP(ATTACKER) < NumericValue(60), GET_TYPE(DEFENDER) == "Heavy"));
+    evaluate("condition/not", NOT(IS_OUT_OF_RING(DEFENDER).toCondition()));
+
+    // clone()
+    auto cloneBench = [&](const char* name, std::shared_ptr<Command> cmd) {
+        suite.run(name, [&](long n) {
+            for (long i = 0; i < n; i++) {
+                std::shared_ptr<Command> copy = cmd->clone();
+                doNotOptimize(copy);
+            }
+        });
+    };
+    cloneBench("clone/damage", DAMAGE_DEFENDER(15));
+    cloneBench("clone/composite3", combo);
+    cloneBench("clone/ability_tree", desperation);
+    {
+        auto cond = AND(GET_HP(ATTACKER) > NumericValue(60), GET_TYPE(DEFENDER) == "Grappler");
+        suite.run("clone/condition_and", [&](long n) {
+            for (long i = 0; i < n; i++) {
+                std::shared_ptr<ConditionExpr> copy = cond->clone();
+                doNotOptimize(copy);
+            }
+        });
+    }
+
+    // Delayed and recurring effects: schedule one and start a turn, so the
+    // queues stay at a steady size
+    auto hit = DAMAGE_DEFENDER(1);
+    suite.run("effects/turn_empty", [&](long n) {
+        for (long i = 0; i < n; i++) {
+            attacker.processDelayedCommands(&defender, (int)i);
+            attacker.processRecurringCommands(&defender, (int)i);
+        }
+    });
+    attacker.reset();
+    suite.run("effects/delayed", [&](long n) {
+        for (long i = 0; i < n; i++) {
+            attacker.addDelayedCommand(1 + (int)(i % 3), hit);
+            attacker.processDelayedCommands(&defender, (int)i);
+        }
+    });
+    attacker.reset();
+    suite.run("effects/delayed_backlog64", [&](long n) {
+        for (long i = 0; i < n; i++) {
+            attacker.addDelayedCommand(64, hit);
+            attacker.processDelayedCommands(&defender, (int)i);
+        }
+    });
+    attacker.reset();
+    suite.run("effects/recurring", [&](long n) {
+        for (long i = 0; i < n; i++) {
+            attacker.addRecurringCommand(3, hit);
+            attacker.processRecurringCommands(&defender, (int)i);
+        }
+    });
+    attacker.reset();
+    defender.reset();
+}
+
+static void macroBenchmarks(BenchSuite& suite) {
+    World world;
+    buildRoster(world, 64, 11);
+    const FighterId n = (FighterId)world.fighterCount();
+
+    {
+        DuelEngine engine;
+        RandomPolicy p1, p2;
+        long duel = 0;
+        suite.run("duel/random", [&](long count) {
+            for (long i = 0; i < count; i++, duel++) {
+                p1.reseed(policySeed(1, duel, 0));
+                p2.reseed(policySeed(1, duel, 1));
+                DuelResult r = engine.run(world.fighter((FighterId)(duel % n)),
+                                          world.fighter((FighterId)(duel / n % n)), p1, p2);
+                doNotOptimize(r);
+            }
+        });
+    }
+    {
+        DuelEngine engine;
+        GreedyDamagePolicy p1, p2;
+        long duel = 0;
+        suite.run("duel/greedy", [&](long count) {
+            for (long i = 0; i < count; i++, duel++) {
+                DuelResult r = engine.run(world.fighter((FighterId)(duel % n)),
+                                          world.fighter((FighterId)(duel / n % n)), p1, p2);
+                doNotOptimize(r);
+            }
+        });
+    }
+
+    // One thread, so that runs on different machines compare
+    World small;
+    buildRoster(small, 16, 13);
+    suite.run("tournament/16x16x8", [&](long count) {
+        for (long i = 0; i < count; i++) {
+            TournamentResult r = runTournament(8, 1, (uint64_t)i + 1, 1000, small);
+            doNotOptimize(r);
+        }
+    });
+
+    suite.run("world/build_roster64", [&](long count) {
+        for (long i = 0; i < count; i++) {
+            World w;
+            buildRoster(w, 64, 11);
+            doNotOptimize(w);
+        }
+    });
+}
+
+int main(int argc, char** argv) {
+    BenchSuite suite;
+    const char* jsonPath = nullptr;
+    const char* baselinePath = nullptr;
+    double threshold = 10;
+    bool strict = false;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--json") == 0 && hasValue) jsonPath = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && hasValue) baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--filter") == 0 && hasValue) suite.filter = argv[++i];
+        else if (strcmp(argv[i], "--min-time") == 0 && hasValue) suite.minSeconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--samples") == 0 && hasValue) suite.samples = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--threshold") == 0 && hasValue) threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--strict") == 0) strict = true;
+        else {
+            fprintf(stderr, "usage: %s [--json out.json] [--baseline old.json] [--filter text] [--min-time s] "
+                            "[--samples n] [--threshold percent] [--strict]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<BenchResult> baseline;
+    if (baselinePath) {
+        std::ifstream in(baselinePath);
+        if (!in) {
+            fprintf(stderr, "cannot read %s\n", baselinePath);
+            return 1;
+        }
+        baseline = BenchJsonReader(in).read();
+    }
+
+    // Benchmarks run without event sinks, like the headless engine
+    eventSink() = nullptr;
+    BenchSuite::printHeader(stdout);
+    microBenchmarks(suite);
+    macroBenchmarks(suite);
+
+    if (jsonPath) {
+        std::ofstream out(jsonPath);
+        suite.writeJson(out);
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", jsonPath);
+            return 1;
+        }
+        printf("\nresults written to %s\n", jsonPath);
+    }
+    if (baselinePath) {
+        printf("\nagainst %s (threshold %.0f%%):\n", baselinePath, threshold);
+        int regressions = suite.compare(baseline, stdout, threshold / 100);
+        printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+        if (strict && regressions > 0) return 1;
+    }
+    return 0;
+}
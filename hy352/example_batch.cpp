@@ -0,0 +1,102 @@
+#include "BatchSim.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Batch simulator example: plays every matchup of a small roster on the
+// lane interpreter, checks each duel against the scalar DuelEngine with the
+// same seeds and compares throughput.
+//
+//   ./example_batch [duels per matchup]
+
+int main(int argc, char** argv) {
+    long duels = argc > 1 ? atol(argv[1]) : 200000;
+    const uint64_t seed = 7;
+
+    createAbility("Jab", DAMAGE_DEFENDER(9));
+    createAbility("Haymaker", DAMAGE_DEFENDER(22));
+    createAbility("Second_Wind", HEAL_ATTACKER(18));
+    createAbility("Bleed", FOR_ROUNDS(4, DAMAGE_DEFENDER(5)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(6));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(20)));
+        createAbility("Time_Bomb", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    createAbility("Finisher", IF_THEN_ELSE(GET_HP(DEFENDER) < NumericValue(30),
+                                           DAMAGE_DEFENDER(35), DAMAGE_DEFENDER(8)));
+    createAbility("Counter", IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Rushdown",
+                                          DAMAGE_DEFENDER(16), HEAL_ATTACKER(6)));
+
+    createFighter("Law", "Rushdown", 100);
+    createFighter("King", "Grappler", 120);
+    createFighter("Kuma", "Heavy", 140);
+    createFighter("Asuka", "Evasive", 95);
+
+    teachAbility("Law", "Jab");
+    teachAbility("Law", "Haymaker");
+    teachAbility("Law", "Bleed");
+    teachAbility("Law", "Finisher");
+    teachAbility("King", "Haymaker");
+    teachAbility("King", "Ring_Out");
+    teachAbility("King", "Second_Wind");
+    teachAbility("King", "Counter");
+    teachAbility("Kuma", "Jab");
+    teachAbility("Kuma", "Time_Bomb");
+    teachAbility("Kuma", "Bleed");
+    teachAbility("Asuka", "Jab");
+    teachAbility("Asuka", "Ring_Out");
+    teachAbility("Asuka", "Finisher");
+    teachAbility("Asuka", "Counter");
+
+    World& world = defaultWorld();
+    DuelEngine engine;
+    std::vector<DuelResult> batch;
+    double batchSeconds = 0, scalarSeconds = 0;
+    long mismatches = 0;
+
+    printf("%-8s %-8s %8s %8s %8s %10s %8s\n", "p1", "p2", "wins1", "wins2", "draws", "avg rounds", "scalar");
+    for (FighterId aId : world.fightersByName()) {
+        const Fighter& f1 = world.fighter(aId);
+        for (FighterId bId : world.fightersByName()) {
+            const Fighter& f2 = world.fighter(bId);
+            BatchSimulator sim(f1, f2);
+
+            auto start = std::chrono::steady_clock::now();
+            BatchStats stats = sim.run(duels, seed, &batch);
+            batchSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            start = std::chrono::steady_clock::now();
+            for (long i = 0; i < duels; i++) {
+                RandomPolicy p1(policySeed(seed, i, 0)), p2(policySeed(seed, i, 1));
+                DuelResult r = engine.run(f1, f2, p1, p2);
+                if (r.winner != batch[i].winner || r.rounds != batch[i].rounds ||
+                    r.finalHP1 != batch[i].finalHP1 || r.finalHP2 != batch[i].finalHP2) {
+                    if (mismatches++ < 5) {
+                        printf("mismatch %s vs %s duel %ld: batch %d/%d/%g/%g, scalar %d/%d/%g/%g\n",
+                               f1.name.c_str(), f2.name.c_str(), i,
+                               batch[i].winner, batch[i].rounds, batch[i].finalHP1, batch[i].finalHP2,
+                               r.winner, r.rounds, r.finalHP1, r.finalHP2);
+                    }
+                }
+            }
+            scalarSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            printf("%-8s %-8s %8ld %8ld %8ld %10.2f %8ld\n", f1.name.c_str(), f2.name.c_str(),
+                   stats.wins1, stats.wins2, stats.draws, (double)stats.totalRounds / duels,
+                   stats.scalarDuels);
+        }
+    }
+
+    long total = duels * (long)(world.fighterCount() * world.fighterCount());
+    printf("\n%ld duels, %ld mismatches\n", total, mismatches);
+    printf("batch:  %ld duels/sec\n", (long)(total / batchSeconds));
+    printf("scalar: %ld duels/sec\n", (long)(total / scalarSeconds));
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#include "Engine.h"
+#include "Events.h"
+#include <chrono>
+
+// Headless example: the roster from test_battle.cpp played without any
+// console interaction, once per policy and then as a throughput run.
+
+int main() {
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(2, TAG_DEFENDER_IN));
+        createAbility("Give_Autographs", cmd);
+    }
+
+    createAbility("Bleeding_Bite", FOR_ROUNDS(5, DAMAGE_DEFENDER(8)));
+    createAbility("Head_Smash", DAMAGE_DEFENDER(22));
+    createAbility("Catch_A_Break", HEAL_ATTACKER(30));
+
+    createFighter("Lee", "Rushdown", 100);
+    createFighter("Jack-6", "Heavy", 90);
+
+    teachAbility("Lee", "Give_Autographs");
+    teachAbility("Lee", "Head_Smash");
+    teachAbility("Lee", "Catch_A_Break");
+    teachAbility("Lee", "Bleeding_Bite");
+
+    teachAbility("Jack-6", "Head_Smash");
+    teachAbility("Jack-6", "Catch_A_Break");
+    teachAbility("Jack-6", "Bleeding_Bite");
+
+    const Fighter& lee = *defaultWorld().findFighter("Lee");
+    const Fighter& jack = *defaultWorld().findFighter("Jack-6");
+    DuelEngine engine;
+
+    // Scripted: Lee smashes every turn, Jack keeps applying Bleeding_Bite
+    ScriptedPolicy smash(std::vector<int>{1});
+    ScriptedPolicy bite(std::vector<int>{2});
+    DuelResult r = engine.run(lee, jack, smash, bite);
+    std::cout << "Scripted: winner " << r.winner << " after " << r.rounds << " rounds ("
+              << (int)r.finalHP1 << " / " << (int)r.finalHP2 << " HP)" << std::endl;
+
+    GreedyDamagePolicy greedy1, greedy2;
+    r = engine.run(lee, jack, greedy1, greedy2);
+    std::cout << "Greedy:   winner " << r.winner << " after " << r.rounds << " rounds ("
+              << (int)r.finalHP1 << " / " << (int)r.finalHP2 << " HP)" << std::endl;
+
+    // Callback: heal when low, otherwise smash
+    CallbackPolicy careful([](Fighter* self, Fighter*, const AbilityList&, int) {
+        return self->currentHP < 30 ? 2 : 1;
+    });
+    RandomPolicy random(42);
+    r = engine.run(lee, jack, careful, random);
+    std::cout << "Callback: winner " << r.winner << " after " << r.rounds << " rounds ("
+              << (int)r.finalHP1 << " / " << (int)r.finalHP2 << " HP)" << std::endl;
+
+    // Event log of one duel, then a compact binary record of another
+    {
+        TextEventSink log(std::cout);
+        engine.setEventSink(&log);
+        ScriptedPolicy autographs(std::vector<int>{0, 1, 1});
+        std::cout << "\nScripted duel events:\n";
+        engine.run(lee, jack, autographs, bite);
+    }
+    RingEventSink ring(256);
+    engine.setEventSink(&ring);
+    RandomPolicy recorded1(7), recorded2(8);
+    engine.run(lee, jack, recorded1, recorded2);
+    engine.setEventSink(nullptr);
+    long damageEvents = 0, knockOuts = 0;
+    double damageDealt = 0;
+    for (size_t i = 0; i < ring.size(); i++) {
+        damageEvents += ring[i].type == EventType::DAMAGE;
+        knockOuts += ring[i].type == EventType::KNOCK_OUT;
+        if (ring[i].type == EventType::DAMAGE) damageDealt += ring[i].value;
+    }
+    std::cout << "Recorded " << ring.size() << " events (" << ring.dropped() << " dropped): "
+              << damageEvents << " hits for " << (int)damageDealt << " damage, "
+              << knockOuts << " knock-outs" << std::endl;
+
+    // A second ruleset next to the default one: same names, other numbers
+    {
+        World arcade;
+        arcade.createAbility("Head_Smash", DAMAGE_DEFENDER(30));
+        arcade.createAbility("Catch_A_Break", HEAL_ATTACKER(10));
+        arcade.createFighter("Lee", "Rushdown", 80);
+        arcade.createFighter("Jack-6", "Heavy", 120);
+        arcade.teach("Lee", "Head_Smash");
+        arcade.teach("Jack-6", "Head_Smash");
+        arcade.teach("Jack-6", "Catch_A_Break");
+        GreedyDamagePolicy g1, g2;
+        r = runHeadlessDuel("Lee", "Jack-6", g1, g2, 1000, arcade);
+        std::cout << "Arcade:   winner " << r.winner << " after " << r.rounds << " rounds ("
+                  << (int)r.finalHP1 << " / " << (int)r.finalHP2 << " HP)" << std::endl;
+    }
+
+    // Throughput
+    const int duels = 1000000;
+    RandomPolicy random1(1), random2(2);
+    int wins[3] = {0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < duels; i++) {
+        wins[engine.run(lee, jack, random1, random2).winner]++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "\n" << duels << " random duels: Lee " << wins[1] << ", Jack-6 " << wins[2]
+              << ", draws " << wins[0] << std::endl;
+    std::cout << (long)(duels / seconds) << " duels/sec" << std::endl;
+    return 0;
+}
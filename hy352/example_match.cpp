@@ -0,0 +1,98 @@
+#include "Match.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Match state example: replays random duels on MatchState and checks them
+// against DuelEngine, then measures snapshot/restore and rollouts from a
+// saved position.
+//
+//   ./example_match [duels]
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    long duels = argc > 1 ? atol(argv[1]) : 100000;
+
+    createAbility("Jab", DAMAGE_DEFENDER(9));
+    createAbility("Haymaker", DAMAGE_DEFENDER(22));
+    createAbility("Second_Wind", HEAL_ATTACKER(18));
+    createAbility("Bleed", FOR_ROUNDS(4, DAMAGE_DEFENDER(5)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    createAbility("Finisher", IF_THEN_ELSE(GET_HP(DEFENDER) < NumericValue(30),
+                                           DAMAGE_DEFENDER(35), DAMAGE_DEFENDER(8)));
+
+    createFighter("Law", "Rushdown", 100);
+    createFighter("King", "Grappler", 120);
+    teachAbility("Law", "Jab");
+    teachAbility("Law", "Haymaker");
+    teachAbility("Law", "Bleed");
+    teachAbility("Law", "Finisher");
+    teachAbility("King", "Haymaker");
+    teachAbility("King", "Ring_Out");
+    teachAbility("King", "Second_Wind");
+
+    const Fighter& law = *defaultWorld().findFighter("Law");
+    const Fighter& king = *defaultWorld().findFighter("King");
+    Match match(law, king);
+    DuelEngine engine;
+
+    // Same random choices on both engines
+    long mismatches = 0;
+    for (long i = 0; i < duels; i++) {
+        RandomPolicy p1(policySeed(3, i, 0)), p2(policySeed(3, i, 1));
+        DuelResult expected = engine.run(law, king, p1, p2);
+
+        FastRng r1(policySeed(3, i, 0)), r2(policySeed(3, i, 1));
+        MatchState s = match.start();
+        while (!s.over) {
+            FastRng& rng = s.mover() == 0 ? r1 : r2;
+            match.play(s, rng.below(match.choices(s)));
+        }
+        DuelResult got = match.result(s);
+        if (got.winner != expected.winner || got.rounds != expected.rounds ||
+            got.finalHP1 != expected.finalHP1 || got.finalHP2 != expected.finalHP2) {
+            mismatches++;
+        }
+    }
+    printf("%ld duels replayed on MatchState, %ld mismatches\n", duels, mismatches);
+
+    // Branch from a position a few turns in
+    MatchState root = match.start();
+    match.play(root, 2);
+    match.play(root, 1);
+    match.play(root, 3);
+    printf("sizeof(MatchState) = %zu bytes, position hash %016llx\n",
+           sizeof(MatchState), (unsigned long long)root.hash());
+
+    const long copies = 10000000;
+    MatchState scratch;
+    uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < copies; i++) {
+        scratch = root;
+        scratch.side[i & 1].hp -= 1;
+        sink += (uint64_t)scratch.side[0].hp;
+    }
+    printf("snapshot/restore: %.1f M/sec\n", copies / secondsSince(start) / 1e6);
+
+    const long rollouts = 1000000;
+    FastRng rng(11);
+    long wins = 0;
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rollouts; i++) {
+        scratch = root;
+        while (!scratch.over) match.play(scratch, rng.below(match.choices(scratch)));
+        wins += match.result(scratch).winner == 1;
+    }
+    printf("random rollouts: %.2f M/sec (Law wins %.1f%%)\n",
+           rollouts / secondsSince(start) / 1e6, 100.0 * wins / rollouts);
+    return mismatches || sink == 0 ? 1 : 0;
+}
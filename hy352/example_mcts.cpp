@@ -0,0 +1,93 @@
+#include "Mcts.h"
+#include "Search.h"
+#include <cstdio>
+#include <cstdlib>
+
+// MCTS example: a ruleset with long AFTER_ROUNDS/FOR_ROUNDS horizons.
+// Measures rollouts per second for 1, 2, 4, ... threads on the opening
+// position, then plays MCTS as player 1 against the alpha-beta search and
+// the greedy policy.
+//
+//   ./example_mcts [ms per move]
+
+int main(int argc, char** argv) {
+    double budget = (argc > 1 ? atof(argv[1]) : 2.0) / 1000.0;
+    const int maxRounds = 200;
+
+    createAbility("Strike", DAMAGE_DEFENDER(12));
+    createAbility("Regenerate", FOR_ROUNDS(6, HEAL_ATTACKER(5)));
+    createAbility("Doom", AFTER_ROUNDS(5, DAMAGE_ATTACKER(45)));
+    createAbility("Open_Wound", FOR_ROUNDS(5, DAMAGE_DEFENDER(4)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(3, TAG_DEFENDER_IN));
+        createAbility("Lockdown", cmd);
+    }
+
+    createFighter("Yoshimitsu", "Evasive", 110);
+    createFighter("Bryan", "Rushdown", 120);
+    createFighter("Heihachi", "Heavy", 130);
+
+    teachAbility("Yoshimitsu", "Strike");
+    teachAbility("Yoshimitsu", "Regenerate");
+    teachAbility("Yoshimitsu", "Doom");
+    teachAbility("Yoshimitsu", "Lockdown");
+    teachAbility("Bryan", "Strike");
+    teachAbility("Bryan", "Open_Wound");
+    teachAbility("Bryan", "Regenerate");
+    teachAbility("Bryan", "Lockdown");
+    teachAbility("Heihachi", "Strike");
+    teachAbility("Heihachi", "Doom");
+    teachAbility("Heihachi", "Regenerate");
+    World& world = defaultWorld();
+
+    // Rollout rate by thread count
+    {
+        const Fighter& f1 = *world.findFighter("Yoshimitsu");
+        const Fighter& f2 = *world.findFighter("Bryan");
+        Match match(f1, f2, maxRounds);
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        printf("%d cores, opening position of %s vs %s, 200ms per search\n",
+               (int)cores, f1.name.c_str(), f2.name.c_str());
+        printf("%8s %14s %8s %10s %6s\n", "threads", "rollouts/sec", "speedup", "nodes", "move");
+        double single = 0;
+        for (unsigned threads = 1; threads <= std::max(4u, cores); threads *= 2) {
+            MctsSearch search(match);
+            MctsStats stats;
+            search.bestMove(match.start(), MctsLimits(0.2, threads), &stats);
+            if (threads == 1) single = stats.rolloutsPerSecond();
+            printf("%8u %14.0f %7.2fx %10ld %6s\n", threads, stats.rolloutsPerSecond(),
+                   stats.rolloutsPerSecond() / single, stats.nodes,
+                   f1.abilities[stats.bestMove]->name.c_str());
+        }
+    }
+
+    // MCTS as player 1
+    printf("\nMCTS (%.0fms per move, all cores) as player 1\n", budget * 1000);
+    printf("%-10s %-10s %14s %14s\n", "p1", "p2", "vs alpha-beta", "vs greedy");
+    DuelEngine engine(maxRounds);
+    MctsPolicy mcts(1, MctsLimits(budget));
+    mcts.setMaxRounds(maxRounds);
+    long wins = 0, duels = 0;
+    for (FighterId aId : world.fightersByName()) {
+        const Fighter& a = world.fighter(aId);
+        for (FighterId bId : world.fightersByName()) {
+            const Fighter& b = world.fighter(bId);
+            SearchPolicy alphaBeta(2, SearchLimits(budget));
+            alphaBeta.setMaxRounds(maxRounds);
+            GreedyDamagePolicy greedy;
+            DuelResult r1 = engine.run(a, b, mcts, alphaBeta);
+            DuelResult r2 = engine.run(a, b, mcts, greedy);
+            wins += (r1.winner == 1) + (r2.winner == 1);
+            duels += 2;
+            const char* outcome[] = {"draw", "win", "loss"};
+            printf("%-10s %-10s %14s %14s\n", a.name.c_str(), b.name.c_str(),
+                   outcome[r1.winner], outcome[r2.winner]);
+        }
+    }
+    const MctsStats& total = mcts.totals();
+    printf("\n%ld/%ld duels won, %ld moves searched, %.0f rollouts/sec on %u threads\n",
+           wins, duels, mcts.movesSearched(), total.rolloutsPerSecond(), total.threads);
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "Tekken.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// The ability optimizer on trees the way generators and copy-paste leave
+// them: nested composites, repeated type checks, constant conditions and
+// arms that do the same thing. For each ability it prints the tree and
+// bytecode sizes without and with the optimizer, the verification result
+// and the cost of Ability::use both ways. Summing adjacent hits
+// (mergeHits) is then shown failing verification.
+//
+//   ./example_optimizer [iterations]
+
+// Best of five runs, as in bench_abilities
+template <typename F>
+static double nsPerOp(long iterations, Fighter& a, Fighter& d, F body) {
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++) {
+            a.reset();
+            d.reset();
+            body(i);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, seconds * 1e9 / iterations);
+    }
+    return best;
+}
+
+static std::shared_ptr<CompositeCommand> sequence(std::initializer_list<std::shared_ptr<Command>> commands) {
+    auto cmd = std::make_shared<CompositeCommand>();
+    for (auto& c : commands) cmd->add(c);
+    return cmd;
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    std::vector<std::pair<std::string, std::shared_ptr<Command>>> abilities;
+
+    abilities.push_back({"Combo_String", sequence({
+        sequence({DAMAGE_DEFENDER(6), DAMAGE_DEFENDER(6)}),
+        sequence({}),
+        sequence({TAG_DEFENDER_OUT, TAG_DEFENDER_IN, TAG_DEFENDER_OUT}),
+        sequence({sequence({HEAL_ATTACKER(4)})})})});
+    abilities.push_back({"Type_Counter", IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Grappler",
+        IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Grappler", DAMAGE_DEFENDER(25), DAMAGE_DEFENDER(10)),
+        IF_THEN_ELSE(AND(GET_TYPE(DEFENDER) == "Grappler", GET_HP(DEFENDER) < NumericValue(50)),
+                     DAMAGE_DEFENDER(40), DAMAGE_DEFENDER(18)))});
+    abilities.push_back({"Debug_Strike", sequence({
+        IF_THEN(NumericValue(1) > NumericValue(2), DAMAGE_DEFENDER(1000)),
+        IF_THEN_ELSE(AND(BoolValue(true).toCondition(), GET_HP(ATTACKER) >= NumericValue(20)),
+                     DAMAGE_DEFENDER(22), DAMAGE_DEFENDER(11))})});
+    abilities.push_back({"Guarded_Heal", IF_THEN_ELSE(NOT(IS_OUT_OF_RING(ATTACKER).toCondition()),
+                                                      HEAL_ATTACKER(10), HEAL_ATTACKER(10))});
+    abilities.push_back({"Counter_Poison", FOR_ROUNDS(3, sequence({
+        IF_THEN_ELSE(NOT(GET_HP(DEFENDER) > NumericValue(40)), DAMAGE_DEFENDER(8), DAMAGE_DEFENDER(4)),
+        sequence({})}))});
+    abilities.push_back({"Smart_Bomb", sequence({
+        DAMAGE_DEFENDER(5),
+        AFTER_ROUNDS(2, IF_THEN_ELSE(OR(GET_NAME(DEFENDER) == "King", GET_NAME(DEFENDER) == "King"),
+                                     sequence({DAMAGE_DEFENDER(30)}), DAMAGE_DEFENDER(25)))})});
+
+    Fighter attacker("Striker", "Rushdown", 100000);
+    Fighter defender("Wrestler", "Grappler", 100000);
+    OptimizerOptions& options = optimizerOptions();
+
+    printf("%-16s %12s %12s %-10s %10s %10s %8s\n", "ability", "nodes", "instructions", "verified",
+           "plain ns", "opt ns", "speedup");
+    for (auto& entry : abilities) {
+        options.enabled = false;
+        Ability plain(entry.first);
+        plain.setAction(entry.second);
+        options.enabled = true;
+        Ability optimized(entry.first);
+        optimized.setAction(entry.second);
+
+        OptimizerCheck check = verifyOptimization(entry.second, optimized.action);
+        char nodes[32], instructions[32];
+        snprintf(nodes, sizeof nodes, "%zu -> %zu", AbilityOptimizer::nodeCount(entry.second.get()),
+                 AbilityOptimizer::nodeCount(optimized.action.get()));
+        snprintf(instructions, sizeof instructions, "%zu -> %zu", plain.program.code.size(),
+                 optimized.program.code.size());
+
+        double resetNs = nsPerOp(iterations, attacker, defender, [](long) {});
+        double plainNs = nsPerOp(iterations, attacker, defender, [&](long i) {
+            plain.use(&attacker, &defender, (int)(i & 7) + 1);
+        }) - resetNs;
+        double optimizedNs = nsPerOp(iterations, attacker, defender, [&](long i) {
+            optimized.use(&attacker, &defender, (int)(i & 7) + 1);
+        }) - resetNs;
+        printf("%-16s %12s %12s %-10s %10.2f %10.2f %7.2fx\n", entry.first.c_str(), nodes, instructions,
+               check.identical ? "yes" : "NO", plainNs, optimizedNs, optimizedNs > 0 ? plainNs / optimizedNs : 0.0);
+        if (!check.identical) printf("  %s\n", check.mismatch.c_str());
+    }
+
+    // Summing hits changes the rounding: the verifier finds a position
+    // where the HP differs in the last bit
+    options.mergeHits = true;
+    std::shared_ptr<Command> chip = sequence({DAMAGE_DEFENDER(0.1), DAMAGE_DEFENDER(0.2), DAMAGE_DEFENDER(0.3)});
+    std::shared_ptr<Command> merged = AbilityOptimizer::optimize(chip, options);
+    OptimizerCheck check = verifyOptimization(chip, merged);
+    printf("\nmergeHits: %zu -> %zu nodes, %s after %ld probes\n", AbilityOptimizer::nodeCount(chip.get()),
+           AbilityOptimizer::nodeCount(merged.get()), check.identical ? "identical" : "rejected", check.probes);
+    if (!check.identical) printf("  %s\n", check.mismatch.c_str());
+
+    options.verify = true;
+    try {
+        createAbility("Chip_Damage", chip);
+        printf("createAbility with verify: accepted\n");
+    } catch (const std::logic_error& e) {
+        printf("createAbility with verify: %s\n", e.what());
+    }
+    return 0;
+}
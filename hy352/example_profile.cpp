@@ -0,0 +1,107 @@
+#include "Tournament.h"
+#include <cstdlib>
+#include <fstream>
+
+// Hot-path profile of a tournament: built with -DTEKKEN_PROFILE, it plays
+// the tournament roster on all cores, then merges the per-thread counters
+// and writes them as CSV and JSON.
+//
+//   ./example_profile [duels per pair] [threads]
+
+#ifndef TEKKEN_PROFILE
+#error "example_profile needs -DTEKKEN_PROFILE (see the Makefile)"
+#endif
+
+int main(int argc, char** argv) {
+    long duels = argc > 1 ? atol(argv[1]) : 2000;
+    unsigned threads = argc > 2 ? (unsigned)atoi(argv[2]) : 0;
+
+    createAbility("Punch", DAMAGE_DEFENDER(15));
+    createAbility("Meditate", HEAL_ATTACKER(20));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(HEAL_ATTACKER(5));
+        createAbility("Power_Combo", cmd);
+    }
+    createAbility("Smart_Attack", IF_THEN_ELSE(GET_HP(DEFENDER) > NumericValue(50),
+                                               DAMAGE_DEFENDER(30), DAMAGE_DEFENDER(15)));
+    createAbility("Poison", FOR_ROUNDS(3, DAMAGE_DEFENDER(10)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(5));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(25)));
+        createAbility("Time_Bomb", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    createAbility("Rolling_Kick", IF_THEN_ELSE(OR(GET_TYPE(DEFENDER) == "Grappler", GET_TYPE(DEFENDER) == "Heavy"),
+                                               DAMAGE_DEFENDER(25), DAMAGE_DEFENDER(18)));
+    createAbility("Yoshimitsu_Heal", IF_THEN_ELSE(AND(GET_HP(ATTACKER) < NumericValue(30),
+                                                      NOT(IS_OUT_OF_RING(DEFENDER).toCondition())),
+                                                  HEAL_ATTACKER(25), HEAL_ATTACKER(15)));
+
+    createFighter("Striker", "Rushdown", 100);
+    createFighter("Tank", "Heavy", 150);
+    createFighter("Ninja", "Evasive", 80);
+    createFighter("Wrestler", "Grappler", 120);
+    createFighter("Yoshimitsu", "Evasive", 85);
+    createFighter("King", "Grappler", 150);
+
+    teachAbility("Striker", "Punch");
+    teachAbility("Striker", "Power_Combo");
+    teachAbility("Striker", "Poison");
+    teachAbility("Tank", "Punch");
+    teachAbility("Tank", "Meditate");
+    teachAbility("Tank", "Smart_Attack");
+    teachAbility("Ninja", "Ring_Out");
+    teachAbility("Ninja", "Time_Bomb");
+    teachAbility("Ninja", "Poison");
+    teachAbility("Wrestler", "Punch");
+    teachAbility("Wrestler", "Power_Combo");
+    teachAbility("Wrestler", "Meditate");
+    teachAbility("Wrestler", "Smart_Attack");
+    teachAbility("Yoshimitsu", "Yoshimitsu_Heal");
+    teachAbility("Yoshimitsu", "Rolling_Kick");
+    teachAbility("King", "Rolling_Kick");
+    teachAbility("King", "Punch");
+
+    TournamentResult result = runTournament(duels, threads);
+    printf("%ld duels in %.2f s (%ld duels/sec with profiling)\n\n", result.totalDuels(), result.seconds,
+           (long)(result.totalDuels() / result.seconds));
+
+    // The workers have exited; their counters were folded into the report
+    ProfileReport report = profileReport();
+    printf("%-16s %12s %12s %10s\n", "ability", "uses", "total ms", "mean ns");
+    for (const ProfiledAbility& a : report.abilities) {
+        printf("%-16s %12llu %12.2f %10.1f\n", a.name.c_str(), (unsigned long long)a.uses, a.totalNs / 1e6,
+               (double)a.totalNs / a.uses);
+    }
+    printf("\n%-16s %12s\n", "command", "executions");
+    for (int c = 0; c < (int)ProfiledCommand::COUNT; c++) {
+        printf("%-16s %12llu\n", profiledName((ProfiledCommand)c), (unsigned long long)report.commands[c]);
+    }
+    printf("\n%-16s %12s %12s\n", "condition", "true", "false");
+    for (int c = 0; c < (int)ProfiledCondition::COUNT; c++) {
+        printf("%-16s %12llu %12llu\n", profiledName((ProfiledCondition)c),
+               (unsigned long long)report.conditions[c][1], (unsigned long long)report.conditions[c][0]);
+    }
+    printf("\n%-16s %12s %10s %10s %10s %10s\n", "latency", "count", "mean ns", "p50 ns", "p99 ns", "max ns");
+    for (int l = 0; l < (int)ProfiledLatency::COUNT; l++) {
+        const LatencyHistogram& h = report.latency[l];
+        printf("%-16s %12llu %10.1f %10llu %10llu %10llu\n", profiledName((ProfiledLatency)l),
+               (unsigned long long)h.count, h.meanNs(), (unsigned long long)h.quantileNs(0.5),
+               (unsigned long long)h.quantileNs(0.99), (unsigned long long)h.maxNs);
+    }
+
+    std::ofstream csv("profile.csv"), json("profile.json");
+    report.writeCsv(csv);
+    report.writeJson(json);
+    printf("\nwritten to profile.csv and profile.json\n");
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include "Ruleset.h"
+#include "Replay.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Ruleset example: roster.tkr against the same roster written in C++, its
+// binary cache, and load times of a generated ruleset with thousands of
+// fighters and abilities from text and from the cache.
+//
+//   ./example_ruleset [fighters]
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The same random duels in two worlds with the same ids
+static long compareDuels(const World& a, const World& b, long duels) {
+    DuelEngine engineA, engineB;
+    uint32_t n = (uint32_t)a.fighterCount();
+    long mismatches = 0;
+    for (long i = 0; i < duels; i++) {
+        FighterId f1 = (FighterId)(policySeed(3, i, 0) % n), f2 = (FighterId)(policySeed(5, i, 1) % n);
+        RandomPolicy a1(policySeed(1, i, 0)), a2(policySeed(1, i, 1));
+        RandomPolicy b1(policySeed(1, i, 0)), b2(policySeed(1, i, 1));
+        DuelResult ra = engineA.run(a.fighter(f1), a.fighter(f2), a1, a2);
+        DuelResult rb = engineB.run(b.fighter(f1), b.fighter(f2), b1, b2);
+        mismatches += finalStateHash(engineA, ra) != finalStateHash(engineB, rb);
+    }
+    return mismatches;
+}
+
+// Every construct of the format, spread over `fighters` fighters
+static std::string generateRuleset(int fighters) {
+    std::string text = "# generated by example_ruleset\n";
+    char line[512];
+    const int types = 8;
+    for (int t = 0; t < types; t++) {
+        snprintf(line, sizeof line, "type Style%d heal %.2f\n", t, t % 3 == 0 ? 0.03 : 0.0);
+        text += line;
+    }
+    for (int t = 0; t < types; t++) {
+        snprintf(line, sizeof line, "matchup Style%d Style%d %.2f %.2f\n", t, (t + 1) % types, 1.1, 0.95);
+        text += line;
+    }
+    int abilities = fighters * 2;
+    for (int i = 0; i < abilities; i++) {
+        switch (i % 8) {
+            case 0: snprintf(line, sizeof line, "ability Move%d = DAMAGE_DEFENDER(%d)\n", i, 5 + i % 20); break;
+            case 1: snprintf(line, sizeof line, "ability Move%d = { DAMAGE_DEFENDER(%d); HEAL_ATTACKER(%d) }\n",
+                             i, 4 + i % 9, 2 + i % 5); break;
+            case 2: snprintf(line, sizeof line, "ability Move%d = FOR_ROUNDS(%d, DAMAGE_DEFENDER(3))\n", i, 2 + i % 4); break;
+            case 3: snprintf(line, sizeof line, "ability Move%d = { DAMAGE_DEFENDER(4); AFTER_ROUNDS(%d, DAMAGE_DEFENDER(15)) }\n",
+                             i, 1 + i % 3); break;
+            case 4: snprintf(line, sizeof line, "ability Move%d = IF_THEN_ELSE(AND(GET_HP(DEFENDER) < %d, "
+                             "NOT(IS_OUT_OF_RING(DEFENDER))), DAMAGE_DEFENDER(30), DAMAGE_DEFENDER(7))\n", i, 30 + i % 20); break;
+            case 5: snprintf(line, sizeof line, "ability Move%d = IF_THEN(OR(GET_TYPE(DEFENDER) == \"Style%d\", "
+                             "GET_NAME(ATTACKER) != \"Fighter0\"), HEAL_ATTACKER(9))\n", i, i % types); break;
+            case 6: snprintf(line, sizeof line, "ability Move%d = {\n    TAG_DEFENDER_OUT\n    AFTER_ROUNDS(1, TAG_DEFENDER_IN)\n"
+                             "    SHOW(GET_NAME(ATTACKER), \" pushes \", GET_NAME(DEFENDER), \" out at \", GET_HP(DEFENDER), \" HP\")\n}\n", i); break;
+            default: snprintf(line, sizeof line, "ability Move%d = IF_THEN_ELSE(GET_HP(ATTACKER) >= GET_HP(DEFENDER), "
+                              "DAMAGE_DEFENDER(12), FOR_ROUNDS(3, HEAL_ATTACKER(4)))\n", i); break;
+        }
+        text += line;
+    }
+    for (int i = 0; i < fighters; i++) {
+        snprintf(line, sizeof line, "fighter Fighter%d Style%d %d: Move%d, Move%d, Move%d, Move%d\n", i, i % types,
+                 80 + i % 60, (i * 7) % abilities, (i * 7 + 1) % abilities, (i * 7 + 2) % abilities, (i * 7 + 3) % abilities);
+        text += line;
+    }
+    return text;
+}
+
+int main(int argc, char** argv) {
+    int generated = argc > 1 ? atoi(argv[1]) : 5000;
+
+    // The example_batch roster, in C++
+    createAbility("Jab", DAMAGE_DEFENDER(9));
+    createAbility("Haymaker", DAMAGE_DEFENDER(22));
+    createAbility("Second_Wind", HEAL_ATTACKER(18));
+    createAbility("Bleed", FOR_ROUNDS(4, DAMAGE_DEFENDER(5)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(6));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(20)));
+        createAbility("Time_Bomb", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    createAbility("Finisher", IF_THEN_ELSE(GET_HP(DEFENDER) < NumericValue(30),
+                                           DAMAGE_DEFENDER(35), DAMAGE_DEFENDER(8)));
+    createAbility("Counter", IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Rushdown",
+                                          DAMAGE_DEFENDER(16), HEAL_ATTACKER(6)));
+
+    createFighter("Law", "Rushdown", 100);
+    createFighter("King", "Grappler", 120);
+    createFighter("Kuma", "Heavy", 140);
+    createFighter("Asuka", "Evasive", 95);
+
+    teachAbility("Law", "Jab");
+    teachAbility("Law", "Haymaker");
+    teachAbility("Law", "Bleed");
+    teachAbility("Law", "Finisher");
+    teachAbility("King", "Haymaker");
+    teachAbility("King", "Ring_Out");
+    teachAbility("King", "Second_Wind");
+    teachAbility("King", "Counter");
+    teachAbility("Kuma", "Jab");
+    teachAbility("Kuma", "Time_Bomb");
+    teachAbility("Kuma", "Bleed");
+    teachAbility("Asuka", "Jab");
+    teachAbility("Asuka", "Ring_Out");
+    teachAbility("Asuka", "Finisher");
+    teachAbility("Asuka", "Counter");
+
+    try {
+        // The same roster from roster.tkr, once parsed and once from its cache
+        World fromText, fromCache;
+        loadRulesetText(fromText, "roster.tkr");
+        std::remove("roster.tkr.cache");
+        loadRuleset(fromCache, "roster.tkr");       // writes the cache
+        World cached;
+        bool used = loadRuleset(cached, "roster.tkr");
+        printf("roster.tkr: %zu fighters, %zu abilities, cache %s\n", fromText.fighterCount(),
+               fromText.abilityCount(), used ? "used" : "not used");
+        printf("ruleset hash  C++ %016llx  text %016llx  cache %016llx\n",
+               (unsigned long long)rulesetHash(defaultWorld()), (unsigned long long)rulesetHash(fromText),
+               (unsigned long long)rulesetHash(cached));
+        printf("100000 random duels, text vs C++: %ld mismatches, cache vs C++: %ld mismatches\n\n",
+               compareDuels(fromText, defaultWorld(), 100000), compareDuels(cached, defaultWorld(), 100000));
+
+        // A large generated ruleset
+        std::string text = generateRuleset(generated);
+        {
+            std::ofstream out("generated.tkr", std::ios::binary);
+            out << text;
+        }
+        std::remove("generated.tkr.cache");
+        World parsed;
+        auto start = std::chrono::steady_clock::now();
+        loadRulesetText(parsed, "generated.tkr");
+        double parseSeconds = secondsSince(start);
+
+        World first;
+        start = std::chrono::steady_clock::now();
+        loadRuleset(first, "generated.tkr");
+        double buildSeconds = secondsSince(start);
+
+        World loaded;
+        start = std::chrono::steady_clock::now();
+        used = loadRuleset(loaded, "generated.tkr");
+        double cacheSeconds = secondsSince(start);
+
+        long cacheBytes = (long)std::ifstream("generated.tkr.cache", std::ios::binary | std::ios::ate).tellg();
+        printf("generated.tkr: %zu fighters, %zu abilities, %zu bytes of text, %ld bytes of cache\n",
+               loaded.fighterCount(), loaded.abilityCount(), text.size(), cacheBytes);
+        printf("parse text:          %8.2f ms\n", parseSeconds * 1000);
+        printf("parse + write cache: %8.2f ms\n", buildSeconds * 1000);
+        printf("load cache:          %8.2f ms (cache %s)\n", cacheSeconds * 1000, used ? "used" : "not used");
+        printf("ruleset hash  text %016llx  cache %016llx\n",
+               (unsigned long long)rulesetHash(parsed), (unsigned long long)rulesetHash(loaded));
+        printf("100000 random duels, cache vs text: %ld mismatches\n\n", compareDuels(loaded, parsed, 100000));
+
+        // Errors name the line
+        try {
+            Ruleset::parse("ability Jab = DAMAGE_DEFENDER(9)\nfighter Law Rushdown 100: Jab, Upercut\n", "typo.tkr");
+        } catch (const std::runtime_error& e) {
+            printf("error: %s\n", e.what());
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "Search.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Search example: how deep the alpha-beta search gets on the roster of
+// example_batch for a few time budgets, and how its choices fare against
+// the greedy and random policies.
+//
+//   ./example_search [ms per move]   statistics and results
+//   ./example_search play            runDuel() against the search as player 2
+
+int main(int argc, char** argv) {
+    createAbility("Jab", DAMAGE_DEFENDER(9));
+    createAbility("Haymaker", DAMAGE_DEFENDER(22));
+    createAbility("Second_Wind", HEAL_ATTACKER(18));
+    createAbility("Bleed", FOR_ROUNDS(4, DAMAGE_DEFENDER(5)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(6));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(20)));
+        createAbility("Time_Bomb", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    createAbility("Finisher", IF_THEN_ELSE(GET_HP(DEFENDER) < NumericValue(30),
+                                           DAMAGE_DEFENDER(35), DAMAGE_DEFENDER(8)));
+    createAbility("Counter", IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Rushdown",
+                                          DAMAGE_DEFENDER(16), HEAL_ATTACKER(6)));
+
+    createFighter("Law", "Rushdown", 100);
+    createFighter("King", "Grappler", 120);
+    createFighter("Kuma", "Heavy", 140);
+    createFighter("Asuka", "Evasive", 95);
+
+    teachAbility("Law", "Jab");
+    teachAbility("Law", "Haymaker");
+    teachAbility("Law", "Bleed");
+    teachAbility("Law", "Finisher");
+    teachAbility("King", "Haymaker");
+    teachAbility("King", "Ring_Out");
+    teachAbility("King", "Second_Wind");
+    teachAbility("King", "Counter");
+    teachAbility("Kuma", "Jab");
+    teachAbility("Kuma", "Time_Bomb");
+    teachAbility("Kuma", "Bleed");
+    teachAbility("Asuka", "Jab");
+    teachAbility("Asuka", "Ring_Out");
+    teachAbility("Asuka", "Finisher");
+    teachAbility("Asuka", "Counter");
+
+    if (argc > 1 && strcmp(argv[1], "play") == 0) {
+        SearchPolicy computer(2, SearchLimits(0.2));
+        setComputerPlayer(2, &computer);
+        runDuel();
+        setComputerPlayer(2, nullptr);
+        return 0;
+    }
+    double budget = (argc > 1 ? atof(argv[1]) : 2.0) / 1000.0;
+    World& world = defaultWorld();
+
+    // Opening position of each matchup, searched from scratch
+    printf("%-6s %-6s %7s %6s %10s %10s %8s\n", "p1", "p2", "budget", "depth", "nodes", "nodes/s", "tt hits");
+    const double budgets[] = {0.001, 0.01, 0.05};
+    for (FighterId aId : world.fightersByName()) {
+        const Fighter& a = world.fighter(aId);
+        for (FighterId bId : world.fightersByName()) {
+            const Fighter& b = world.fighter(bId);
+            if (a.name >= b.name) continue;
+            Match match(a, b);
+            for (double seconds : budgets) {
+                AlphaBetaSearch search(match);
+                SearchStats stats;
+                search.bestMove(match.start(), SearchLimits(seconds), &stats);
+                printf("%-6s %-6s %5.0fms %6d %10ld %10.0f %8ld\n", a.name.c_str(), b.name.c_str(),
+                       seconds * 1000, stats.depth, stats.nodes, stats.nodesPerSecond(), stats.ttHits);
+            }
+        }
+    }
+
+    // Search as player 1 against greedy and random opponents
+    printf("\nSearch (%.0fms per move) as player 1\n", budget * 1000);
+    printf("%-6s %-6s %12s %12s\n", "p1", "p2", "vs greedy", "vs random");
+    const int randomDuels = 10;
+    DuelEngine engine;
+    SearchPolicy searcher(1, SearchLimits(budget));
+    long wins = 0, duels = 0;
+    for (FighterId aId : world.fightersByName()) {
+        const Fighter& a = world.fighter(aId);
+        for (FighterId bId : world.fightersByName()) {
+            const Fighter& b = world.fighter(bId);
+            GreedyDamagePolicy greedy;
+            DuelResult r = engine.run(a, b, searcher, greedy);
+            int randomWins = 0;
+            for (int i = 0; i < randomDuels; i++) {
+                RandomPolicy random(policySeed(1, i, 1));
+                randomWins += engine.run(a, b, searcher, random).winner == 1;
+            }
+            wins += (r.winner == 1) + randomWins;
+            duels += 1 + randomDuels;
+            printf("%-6s %-6s %12s %9d/%d\n", a.name.c_str(), b.name.c_str(),
+                   r.winner == 1 ? "win" : r.winner == 2 ? "loss" : "draw", randomWins, randomDuels);
+        }
+    }
+    const SearchStats& total = searcher.totals();
+    printf("\n%ld/%ld duels won, %ld moves searched\n", wins, duels, searcher.movesSearched());
+    printf("average depth %.1f (max %d), %.0f nodes/sec\n",
+           searcher.averageDepth(), total.depth, total.nodesPerSecond());
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "Solver.h"
+#include <cstdio>
+#include <cstdlib>
+
+// Exact win probabilities of the tournament roster under uniform random
+// play, next to sampled duels (DuelEngine + RandomPolicy) with the
+// difference in standard errors. Then one matchup with weighted choices,
+// the value of each opening move, and solve time by thread count.
+//
+//   ./example_solver [sampled duels per pair]
+
+int main(int argc, char** argv) {
+    long duels = argc > 1 ? atol(argv[1]) : 20000;
+
+    createAbility("Punch", DAMAGE_DEFENDER(15));
+    createAbility("Meditate", HEAL_ATTACKER(20));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(HEAL_ATTACKER(5));
+        createAbility("Power_Combo", cmd);
+    }
+    createAbility("Smart_Attack", IF_THEN_ELSE(GET_HP(DEFENDER) > NumericValue(50),
+                                               DAMAGE_DEFENDER(30), DAMAGE_DEFENDER(15)));
+    createAbility("Poison", FOR_ROUNDS(3, DAMAGE_DEFENDER(10)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(5));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(25)));
+        createAbility("Time_Bomb", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    createAbility("Rolling_Kick", IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Grappler",
+                                               DAMAGE_DEFENDER(25), DAMAGE_DEFENDER(18)));
+    createAbility("Yoshimitsu_Heal", IF_THEN_ELSE(GET_HP(ATTACKER) < NumericValue(30),
+                                                  HEAL_ATTACKER(25), HEAL_ATTACKER(15)));
+
+    createFighter("Striker", "Rushdown", 100);
+    createFighter("Tank", "Heavy", 150);
+    createFighter("Ninja", "Evasive", 80);
+    createFighter("Wrestler", "Grappler", 120);
+    createFighter("Yoshimitsu", "Evasive", 85);
+    createFighter("King", "Grappler", 150);
+
+    teachAbility("Striker", "Punch");
+    teachAbility("Striker", "Power_Combo");
+    teachAbility("Striker", "Poison");
+    teachAbility("Tank", "Punch");
+    teachAbility("Tank", "Meditate");
+    teachAbility("Tank", "Smart_Attack");
+    teachAbility("Ninja", "Ring_Out");
+    teachAbility("Ninja", "Time_Bomb");
+    teachAbility("Ninja", "Poison");
+    teachAbility("Wrestler", "Punch");
+    teachAbility("Wrestler", "Power_Combo");
+    teachAbility("Wrestler", "Meditate");
+    teachAbility("Wrestler", "Smart_Attack");
+    teachAbility("Yoshimitsu", "Yoshimitsu_Heal");
+    teachAbility("Yoshimitsu", "Rolling_Kick");
+    teachAbility("King", "Rolling_Kick");
+    teachAbility("King", "Punch");
+    World& world = defaultWorld();
+
+    printf("%-10s %-10s %9s %9s %9s %8s %9s %10s %8s\n", "p1", "p2", "P(p1)", "sampled", "error", "rounds",
+           "states", "table KB", "ms");
+    DuelEngine engine;
+    double worst = 0;
+    const Fighter* largest[2] = {nullptr, nullptr};
+    size_t largestStates = 0;
+    for (FighterId aId : world.fightersByName()) {
+        const Fighter& a = world.fighter(aId);
+        for (FighterId bId : world.fightersByName()) {
+            const Fighter& b = world.fighter(bId);
+            Match match(a, b);
+            MatchSolver solver(match);
+            SolverResult exact = solver.solve();
+
+            RandomPolicy p1(policySeed(7, aId, 0)), p2(policySeed(7, bId, 1));
+            long wins = 0;
+            for (long i = 0; i < duels; i++) wins += engine.run(a, b, p1, p2).winner == 1;
+            double sampled = (double)wins / duels;
+            double sigma = std::sqrt(std::max(exact.win1 * (1 - exact.win1), 1e-12) / duels);
+            double z = (sampled - exact.win1) / sigma;
+            worst = std::max(worst, std::fabs(z));
+            if (exact.states > largestStates) {
+                largestStates = exact.states;
+                largest[0] = &a;
+                largest[1] = &b;
+            }
+            printf("%-10s %-10s %9.6f %9.4f %+8.2fσ %8.2f %9zu %10.1f %8.2f\n", a.name.c_str(), b.name.c_str(),
+                   exact.win1, sampled, z, exact.expectedRounds, exact.states, exact.tableBytes / 1024.0,
+                   (exact.exploreSeconds + exact.solveSeconds) * 1000);
+        }
+    }
+    printf("largest sampling error: %.2f standard errors over %ld duels per pair\n", worst, duels);
+
+    // Weighted play and the value of each opening move
+    const Fighter& wrestler = *world.findFighter("Wrestler");
+    const Fighter& tank = *world.findFighter("Tank");
+    Match match(wrestler, tank);
+    SolverOptions weighted;
+    weighted.weights[0] = {1, 4, 1, 4};     // Punch, Power_Combo, Meditate, Smart_Attack
+    MatchSolver solver(match, weighted);
+    SolverResult r = solver.solve();
+    printf("\n%s (Power_Combo and Smart_Attack 4x as likely) vs %s (uniform)\n", wrestler.name.c_str(),
+           tank.name.c_str());
+    printf("P(p1) %.6f  P(p2) %.6f  draw %.2e  endless %.2e  rounds %.3f\n", r.win1, r.win2, r.draw, r.endless,
+           r.expectedRounds);
+    printf("%zu positions (%zu on cycles, %zu components in %zu levels), %zu transitions, %ld sweeps\n", r.states,
+           r.cyclic, r.components, r.levels, r.transitions, r.sweeps);
+    for (int c = 0; c < match.abilities(0); c++) {
+        MatchState s = match.start();
+        match.play(s, c);
+        SolverValue v = solver.value(s);
+        printf("  opening with %-14s P(p1) %.6f\n", wrestler.abilities[c]->name.c_str(), v.win1);
+    }
+
+    // Threads
+    printf("\n%s vs %s (%zu positions) by thread count\n", largest[0]->name.c_str(), largest[1]->name.c_str(),
+           largestStates);
+    printf("%8s %12s %12s %12s\n", "threads", "explore ms", "solve ms", "P(p1)");
+    Match big(*largest[0], *largest[1]);
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= std::max(4u, cores); threads *= 2) {
+        SolverOptions options;
+        options.threads = threads;
+        MatchSolver s(big, options);
+        SolverResult t = s.solve();
+        printf("%8u %12.2f %12.2f %12.9f\n", threads, t.exploreSeconds * 1000, t.solveSeconds * 1000, t.win1);
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "Replay.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+// Replay tool: records random duels of the example_batch roster into a
+// binary log, then streams the log from a memory map and re-simulates
+// every duel, checking that it ends in the recorded state.
+//
+//   ./replay record <file> [duels]   write a log
+//   ./replay verify <file> [threads] replay a log (0 threads: one per core)
+//   ./replay                         both, on replays.bin
+
+static void buildRoster() {
+    createAbility("Jab", DAMAGE_DEFENDER(9));
+    createAbility("Haymaker", DAMAGE_DEFENDER(22));
+    createAbility("Second_Wind", HEAL_ATTACKER(18));
+    createAbility("Bleed", FOR_ROUNDS(4, DAMAGE_DEFENDER(5)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(6));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(20)));
+        createAbility("Time_Bomb", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    createAbility("Finisher", IF_THEN_ELSE(GET_HP(DEFENDER) < NumericValue(30),
+                                           DAMAGE_DEFENDER(35), DAMAGE_DEFENDER(8)));
+    createAbility("Counter", IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Rushdown",
+                                          DAMAGE_DEFENDER(16), HEAL_ATTACKER(6)));
+
+    createFighter("Law", "Rushdown", 100);
+    createFighter("King", "Grappler", 120);
+    createFighter("Kuma", "Heavy", 140);
+    createFighter("Asuka", "Evasive", 95);
+
+    teachAbility("Law", "Jab");
+    teachAbility("Law", "Haymaker");
+    teachAbility("Law", "Bleed");
+    teachAbility("Law", "Finisher");
+    teachAbility("King", "Haymaker");
+    teachAbility("King", "Ring_Out");
+    teachAbility("King", "Second_Wind");
+    teachAbility("King", "Counter");
+    teachAbility("Kuma", "Jab");
+    teachAbility("Kuma", "Time_Bomb");
+    teachAbility("Kuma", "Bleed");
+    teachAbility("Asuka", "Jab");
+    teachAbility("Asuka", "Ring_Out");
+    teachAbility("Asuka", "Finisher");
+    teachAbility("Asuka", "Counter");
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Every ordered matchup in turn, each duel with its own random seeds
+static int record(const World& world, const char* path, long duels) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    const uint64_t seed = 7;
+    FighterId n = (FighterId)world.fighterCount();
+    auto start = std::chrono::steady_clock::now();
+    {
+        ReplayWriter writer(out);
+        ReplayRecorder recorder(world, writer);
+        for (long i = 0; i < duels; i++) {
+            RandomPolicy p1(policySeed(seed, i, 0)), p2(policySeed(seed, i, 1));
+            recorder.run((FighterId)(i % n), (FighterId)(i / n % n), p1, p2);
+        }
+    }
+    out.close();
+    double seconds = secondsSince(start);
+    long bytes = (long)std::ifstream(path, std::ios::binary | std::ios::ate).tellg();
+    printf("recorded %ld duels into %s: %ld bytes (%.1f per duel), %ld duels/sec\n",
+           duels, path, bytes, (double)bytes / duels, (long)(duels / seconds));
+    return 0;
+}
+
+struct Failure {
+    long record;
+    ReplayRecord r;
+    ReplayStatus status;
+};
+
+// The log is cut into chunks of records that threads take in turn, each
+// with its own Replayer
+static int verify(const World& world, const char* path, unsigned threads) {
+    const long chunk = 8192;
+    long counts[4] = {0, 0, 0, 0};
+    long records = 0;
+    std::vector<Failure> failures;
+    double seconds = 0;
+    try {
+        MappedFile file(path);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<size_t> chunks;
+        {
+            ReplayReader reader(file);
+            ReplayRecord r;
+            for (;; records++) {
+                if (records % chunk == 0) chunks.push_back(reader.offset());
+                if (!reader.next(r)) break;
+            }
+        }
+
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        std::atomic<size_t> nextChunk(0);
+        std::mutex lock;
+        auto work = [&]() {
+            ReplayReader reader(file);
+            Replayer replayer(world);
+            ReplayRecord r;
+            long local[4] = {0, 0, 0, 0};
+            std::vector<Failure> localFailures;
+            for (size_t c; (c = nextChunk++) < chunks.size();) {
+                reader.seek(chunks[c]);
+                for (long i = 0; i < chunk && reader.next(r); i++) {
+                    ReplayStatus status = replayer.replay(r);
+                    local[(int)status]++;
+                    if (status != ReplayStatus::OK) {
+                        Failure f = {(long)c * chunk + i, r, status};
+                        localFailures.push_back(f);
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            for (int s = 0; s < 4; s++) counts[s] += local[s];
+            failures.insert(failures.end(), localFailures.begin(), localFailures.end());
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; t++) pool.emplace_back(work);
+        work();
+        for (auto& t : pool) t.join();
+        seconds = secondsSince(start);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s: %s\n", path, e.what());
+        return 1;
+    }
+
+    std::sort(failures.begin(), failures.end(),
+              [](const Failure& a, const Failure& b) { return a.record < b.record; });
+    for (size_t i = 0; i < failures.size() && i < 5; i++) {
+        const Failure& f = failures[i];
+        printf("record %ld (fighters %u and %u) does not replay: %s\n", f.record, f.r.fighter1, f.r.fighter2,
+               f.status == ReplayStatus::MISMATCH ? "final state differs"
+               : f.status == ReplayStatus::WRONG_RULESET ? "other ruleset" : "bad record");
+    }
+    printf("replayed %ld duels from %s on %u threads: %ld ok, %ld mismatches, %ld other ruleset, %ld bad\n",
+           records, path, threads, counts[0], counts[1], counts[2], counts[3]);
+    if (seconds > 0) printf("%ld replays/sec\n", (long)(records / seconds));
+    return records == counts[0] ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    buildRoster();
+    const World& world = defaultWorld();
+    if (argc >= 3 && strcmp(argv[1], "record") == 0) {
+        return record(world, argv[2], argc > 3 ? atol(argv[3]) : 200000);
+    }
+    if (argc >= 3 && strcmp(argv[1], "verify") == 0) {
+        return verify(world, argv[2], argc > 3 ? (unsigned)atoi(argv[3]) : 0);
+    }
+    if (argc > 1) {
+        fprintf(stderr, "usage: %s [record <file> [duels] | verify <file> [threads]]\n", argv[0]);
+        return 2;
+    }
+    if (record(world, "replays.bin", 200000)) return 1;
+    return verify(world, "replays.bin", 0);
+}
@@ -0,0 +1,81 @@
+#include "Tournament.h"
+#include <cstdlib>
+
+// Round-robin over a mixed roster: every ordered pair plays N random duels
+// on all cores.
+//
+//   ./tournament [duels per pair] [threads]
+
+int main(int argc, char** argv) {
+    long duels = argc > 1 ? atol(argv[1]) : 10000;
+    unsigned threads = argc > 2 ? (unsigned)atoi(argv[2]) : 0;
+
+    // Abilities
+    createAbility("Punch", DAMAGE_DEFENDER(15));
+    createAbility("Meditate", HEAL_ATTACKER(20));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(DAMAGE_DEFENDER(10));
+        cmd->add(HEAL_ATTACKER(5));
+        createAbility("Power_Combo", cmd);
+    }
+    createAbility("Smart_Attack", IF_THEN_ELSE(GET_HP(DEFENDER) > NumericValue(50),
+                                               DAMAGE_DEFENDER(30), DAMAGE_DEFENDER(15)));
+    createAbility("Poison", FOR_ROUNDS(3, DAMAGE_DEFENDER(10)));
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(DAMAGE_DEFENDER(5));
+        cmd->add(AFTER_ROUNDS(2, DAMAGE_DEFENDER(25)));
+        createAbility("Time_Bomb", cmd);
+    }
+    {
+        auto cmd = std::make_shared<CompositeCommand>();
+        cmd->add(TAG_DEFENDER_OUT);
+        cmd->add(AFTER_ROUNDS(1, TAG_DEFENDER_IN));
+        createAbility("Ring_Out", cmd);
+    }
+    createAbility("Rolling_Kick", IF_THEN_ELSE(GET_TYPE(DEFENDER) == "Grappler",
+                                               DAMAGE_DEFENDER(25), DAMAGE_DEFENDER(18)));
+    createAbility("Yoshimitsu_Heal", IF_THEN_ELSE(GET_HP(ATTACKER) < NumericValue(30),
+                                                  HEAL_ATTACKER(25), HEAL_ATTACKER(15)));
+
+    // Fighters
+    createFighter("Striker", "Rushdown", 100);
+    createFighter("Tank", "Heavy", 150);
+    createFighter("Ninja", "Evasive", 80);
+    createFighter("Wrestler", "Grappler", 120);
+    createFighter("Yoshimitsu", "Evasive", 85);
+    createFighter("King", "Grappler", 150);
+
+    teachAbility("Striker", "Punch");
+    teachAbility("Striker", "Power_Combo");
+    teachAbility("Striker", "Poison");
+
+    teachAbility("Tank", "Punch");
+    teachAbility("Tank", "Meditate");
+    teachAbility("Tank", "Smart_Attack");
+
+    teachAbility("Ninja", "Ring_Out");
+    teachAbility("Ninja", "Time_Bomb");
+    teachAbility("Ninja", "Poison");
+
+    teachAbility("Wrestler", "Punch");
+    teachAbility("Wrestler", "Power_Combo");
+    teachAbility("Wrestler", "Meditate");
+    teachAbility("Wrestler", "Smart_Attack");
+
+    teachAbility("Yoshimitsu", "Yoshimitsu_Heal");
+    teachAbility("Yoshimitsu", "Rolling_Kick");
+
+    teachAbility("King", "Rolling_Kick");
+    teachAbility("King", "Punch");
+
+    TournamentResult result = runTournament(duels, threads);
+
+    result.print(std::cout);
+    std::cout << "\n" << result.totalDuels() << " duels in " << result.seconds << " s ("
+              << (long)(result.totalDuels() / result.seconds) << " duels/sec, "
+              << (double)result.totalRounds / result.totalDuels() << " rounds/duel)" << std::endl;
+    return 0;
+}